@@ -0,0 +1,495 @@
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/wait.h>
+#define OPTPARSE_IMPLEMENTATION
+#define OPTPARSE_API static __attribute__((unused))
+#include "optparse.h"
+#define OPTPARSE_HELP_IMPLEMENTATION
+#define OPTPARSE_HELP_API static
+#include "optparse-help.h"
+#include "hako-common.h"
+#include "hako-trace.h"
+
+#define PROG_NAME "hako-bench"
+#define quit(code) exit_code = code; goto quit;
+
+#define TRACE_FD 3
+#define TRACE_FD_OPT "--trace-fd=3"
+#define MAX_PHASES 64
+#define MAX_TRACE 65536
+
+struct phase_s
+{
+	char name[64];
+	size_t num_samples;
+	uint64_t* samples;
+};
+
+struct bench_s
+{
+	char** argv;
+	bool trace;
+	int null_fd;
+	unsigned int num_launches;
+	unsigned int num_phases;
+	struct phase_s phases[MAX_PHASES];
+	char trace_buf[MAX_TRACE];
+};
+
+static struct phase_s*
+find_phase(struct bench_s* bench, const char* name, size_t len)
+{
+	for(unsigned int i = 0; i < bench->num_phases; ++i)
+	{
+		struct phase_s* phase = &bench->phases[i];
+		if(strlen(phase->name) == len && memcmp(phase->name, name, len) == 0)
+		{
+			return phase;
+		}
+	}
+
+	if(bench->num_phases == MAX_PHASES) { return NULL; }
+
+	// Every phase can be sampled once per launch
+	struct phase_s* phase = &bench->phases[bench->num_phases];
+	phase->samples = calloc(bench->num_launches, sizeof(uint64_t));
+	if(phase->samples == NULL) { return NULL; }
+
+	snprintf(phase->name, sizeof(phase->name), "%.*s", (int)len, name);
+	++bench->num_phases;
+
+	return phase;
+}
+
+static bool
+add_sample(struct bench_s* bench, const char* name, size_t len, uint64_t value)
+{
+	struct phase_s* phase = find_phase(bench, name, len);
+	if(phase == NULL)
+	{
+		fprintf(stderr, "Could not record phase %.*s\n", (int)len, name);
+		return false;
+	}
+
+	if(phase->num_samples < bench->num_launches)
+	{
+		phase->samples[phase->num_samples++] = value;
+	}
+
+	return true;
+}
+
+static bool
+parse_field(const char* line, const char* field, uint64_t* value)
+{
+	const char* pos = strstr(line, field);
+	if(pos == NULL) { return false; }
+
+	*value = strtoull(pos + strlen(field), NULL, 10);
+	return true;
+}
+
+static const char*
+parse_str_field(const char* line, const char* field, size_t* len)
+{
+	const char* str = strstr(line, field);
+	if(str == NULL) { return NULL; }
+
+	str += strlen(field);
+	const char* end = strchr(str, '"');
+	if(end == NULL) { return NULL; }
+
+	*len = end - str;
+	return str;
+}
+
+// Phases are told apart by their target, e.g. "mount /usr".
+// Phases which are still running when hako-run exits (exec) end at end_time.
+static bool
+record_trace(struct bench_s* bench, char* trace, uint64_t end_time)
+{
+	for(char* line = strtok(trace, "\n"); line != NULL; line = strtok(NULL, "\n"))
+	{
+		size_t phase_len, target_len;
+		uint64_t start, duration;
+		const char* phase = parse_str_field(line, "\"phase\":\"", &phase_len);
+		const char* target = parse_str_field(line, "\"target\":\"", &target_len);
+		if(phase == NULL || !parse_field(line, "\"start\":", &start))
+		{
+			fprintf(stderr, "Invalid trace record: %s\n", line);
+			return false;
+		}
+
+		if(!parse_field(line, "\"duration\":", &duration))
+		{
+			duration = end_time > start ? end_time - start : 0;
+		}
+
+		char name[sizeof(bench->phases[0].name)];
+		int name_len = target == NULL ?
+			snprintf(name, sizeof(name), "%.*s", (int)phase_len, phase) :
+			snprintf(
+				name, sizeof(name), "%.*s %.*s",
+				(int)phase_len, phase, (int)target_len, target
+			);
+		if(name_len >= (int)sizeof(name)) { name_len = sizeof(name) - 1; }
+
+		if(!add_sample(bench, name, name_len, duration)) { return false; }
+	}
+
+	return true;
+}
+
+static pid_t
+spawn_hako_run(const struct bench_s* bench, int trace_fd)
+{
+	pid_t pid = vfork();
+	if(pid == 0)
+	{
+		if(trace_fd == TRACE_FD) { fcntl(TRACE_FD, F_SETFD, 0); }
+		else if(trace_fd >= 0) { dup2(trace_fd, TRACE_FD); }
+
+		dup2(bench->null_fd, STDIN_FILENO);
+		dup2(bench->null_fd, STDOUT_FILENO);
+		execv(bench->argv[0], bench->argv);
+		_exit(127);
+	}
+
+	return pid;
+}
+
+static bool
+launch(struct bench_s* bench, bool record)
+{
+	int trace_pipe[2] = { -1, -1 };
+	if(bench->trace && pipe2(trace_pipe, O_CLOEXEC) == -1)
+	{
+		perror("pipe2() failed");
+		return false;
+	}
+
+	uint64_t start_time = trace_now();
+	pid_t pid = spawn_hako_run(bench, trace_pipe[1]);
+
+	bool result;
+	size_t trace_len = 0;
+	if(bench->trace)
+	{
+		close(trace_pipe[1]);
+
+		// hako-run keeps the trace open until it exits
+		ssize_t num_read;
+		while(trace_len < MAX_TRACE - 1 && (num_read = read(
+			trace_pipe[0],
+			bench->trace_buf + trace_len,
+			MAX_TRACE - 1 - trace_len
+		)) != 0)
+		{
+			if(num_read == -1)
+			{
+				if(errno == EINTR) { continue; }
+
+				perror("Could not read trace");
+				break;
+			}
+
+			trace_len += num_read;
+		}
+		bench->trace_buf[trace_len] = '\0';
+
+		close(trace_pipe[0]);
+	}
+
+	if(pid == -1)
+	{
+		perror("vfork() failed");
+		return false;
+	}
+
+	int status;
+	while(waitpid(pid, &status, 0) == -1)
+	{
+		if(errno != EINTR)
+		{
+			perror("waitpid() failed");
+			return false;
+		}
+	}
+	uint64_t end_time = trace_now();
+
+	if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	{
+		if(WIFEXITED(status))
+		{
+			fprintf(stderr, "Launch exited with %d\n", WEXITSTATUS(status));
+		}
+		else
+		{
+			fprintf(stderr, "Launch killed by signal %d\n", WTERMSIG(status));
+		}
+
+		return false;
+	}
+
+	result = true;
+	if(record && bench->trace)
+	{
+		result = record_trace(bench, bench->trace_buf, end_time);
+	}
+
+	if(record && result)
+	{
+		result = add_sample(bench, "total", 5, end_time - start_time);
+	}
+
+	return result;
+}
+
+static int
+compare_samples(const void* lhs, const void* rhs)
+{
+	uint64_t a = *(const uint64_t*)lhs;
+	uint64_t b = *(const uint64_t*)rhs;
+	return (a > b) - (a < b);
+}
+
+static double
+percentile(const struct phase_s* phase, size_t permille)
+{
+	size_t index = (phase->num_samples * permille + 999) / 1000;
+	return phase->samples[index > 0 ? index - 1 : 0] / 1000.0;
+}
+
+static void
+print_report(struct bench_s* bench)
+{
+	printf(
+		"%-20s %8s %10s %10s %10s %10s %10s\n",
+		"phase (usec)", "count", "min", "p50", "p99", "p99.9", "max"
+	);
+
+	for(unsigned int i = 0; i < bench->num_phases; ++i)
+	{
+		struct phase_s* phase = &bench->phases[i];
+		if(phase->num_samples == 0) { continue; }
+
+		qsort(
+			phase->samples, phase->num_samples, sizeof(uint64_t),
+			compare_samples
+		);
+
+		printf(
+			"%-20s %8zu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+			phase->name, phase->num_samples,
+			phase->samples[0] / 1000.0,
+			percentile(phase, 500),
+			percentile(phase, 990),
+			percentile(phase, 999),
+			phase->samples[phase->num_samples - 1] / 1000.0
+		);
+	}
+}
+
+int
+main(int argc, char* argv[])
+{
+	int exit_code = EXIT_SUCCESS;
+
+	struct optparse_long opts[] = {
+		{"help", 'h', OPTPARSE_NONE},
+		{"iterations", 'n', OPTPARSE_REQUIRED},
+		{"warmup", 'w', OPTPARSE_REQUIRED},
+		{"hako-run", 'r', OPTPARSE_REQUIRED},
+		{"option", 'o', OPTPARSE_REQUIRED},
+		{"end-to-end", 'E', OPTPARSE_NONE},
+		{"max-p99", 't', OPTPARSE_REQUIRED},
+		{0}
+	};
+
+	const char* help[] = {
+		NULL, "Print this message",
+		"N", "Number of measured launches (default: 1000)",
+		"N", "Number of launches before measuring (default: 10)",
+		"FILE", "Path to hako-run (default: next to " PROG_NAME ")",
+		"OPTION", "Pass an option to hako-run, can be repeated",
+		NULL, "Only measure whole launches, without phase timings",
+		"USEC", "Fail when the p99 of whole launches exceeds this",
+	};
+
+	const char* usage = "Usage: " PROG_NAME " [options] <target> [command] [args]";
+
+	int option;
+	long num;
+	unsigned int num_warmup = 10;
+	long max_p99 = -1;
+	const char* hako_run = NULL;
+	char hako_run_buf[PATH_MAX];
+	char** run_opts = calloc(argc, sizeof(char*));
+	unsigned int num_run_opts = 0;
+	struct optparse options;
+	struct bench_s* bench = calloc(1, sizeof(struct bench_s));
+	if(run_opts == NULL || bench == NULL)
+	{
+		perror("Could not allocate memory");
+		quit(EXIT_FAILURE);
+	}
+
+	bench->trace = true;
+	bench->num_launches = 1000;
+	bench->null_fd = -1;
+	optparse_init(&options, argv);
+	options.permute = 0;
+
+	while((option = optparse_long(&options, opts, NULL)) != -1)
+	{
+		switch(option)
+		{
+			case 'h':
+				optparse_help(usage, opts, help);
+				quit(EXIT_SUCCESS);
+				break;
+			case 'n':
+			case 'w':
+				if(!strtonum(options.optarg, &num) || num < 0 || num > INT_MAX)
+				{
+					fprintf(
+						stderr, PROG_NAME ": invalid number: %s\n",
+						options.optarg
+					);
+					quit(EXIT_FAILURE);
+				}
+
+				if(option == 'n') { bench->num_launches = num; }
+				else { num_warmup = num; }
+				break;
+			case 'r':
+				hako_run = options.optarg;
+				break;
+			case 'o':
+				run_opts[num_run_opts++] = options.optarg;
+				break;
+			case 'E':
+				bench->trace = false;
+				break;
+			case 't':
+				if(!strtonum(options.optarg, &max_p99) || max_p99 < 0)
+				{
+					fprintf(
+						stderr, PROG_NAME ": invalid time: %s\n",
+						options.optarg
+					);
+					quit(EXIT_FAILURE);
+				}
+				break;
+			case '?':
+				fprintf(stderr, PROG_NAME ": %s\n", options.errmsg);
+				quit(EXIT_FAILURE);
+				break;
+			default:
+				fprintf(stderr, "Unimplemented option\n");
+				quit(EXIT_FAILURE);
+				break;
+		}
+	}
+
+	if(options.optind >= argc)
+	{
+		fprintf(stderr, PROG_NAME ": must provide sandbox dir\n");
+		quit(EXIT_FAILURE);
+	}
+
+	if(hako_run == NULL)
+	{
+		ssize_t len = readlink(
+			"/proc/self/exe", hako_run_buf, sizeof(hako_run_buf) - 1
+		);
+		if(len == -1)
+		{
+			perror("Could not locate " PROG_NAME);
+			quit(EXIT_FAILURE);
+		}
+		hako_run_buf[len] = '\0';
+
+		char* dir = dirname(hako_run_buf);
+		memmove(hako_run_buf, dir, strlen(dir) + 1);
+		if(strlen(hako_run_buf) + sizeof("/hako-run") > sizeof(hako_run_buf))
+		{
+			fprintf(stderr, "Path to hako-run is too long\n");
+			quit(EXIT_FAILURE);
+		}
+		strcat(hako_run_buf, "/hako-run");
+		hako_run = hako_run_buf;
+	}
+
+	// hako-run [--trace-fd FD] [options] <target> [command] [args]
+	int num_args = argc - options.optind;
+	bench->argv = calloc(num_run_opts + num_args + 5, sizeof(char*));
+	if(bench->argv == NULL)
+	{
+		perror("Could not allocate memory");
+		quit(EXIT_FAILURE);
+	}
+
+	char** arg = bench->argv;
+	*arg++ = (char*)hako_run;
+	if(bench->trace)
+	{
+		static char trace_fd_opt[] = TRACE_FD_OPT;
+		*arg++ = trace_fd_opt;
+	}
+	for(unsigned int i = 0; i < num_run_opts; ++i) { *arg++ = run_opts[i]; }
+	for(int i = 0; i < num_args; ++i) { *arg++ = argv[options.optind + i]; }
+	if(num_args == 1)
+	{
+		static char default_cmd[] = "/bin/true";
+		*arg++ = default_cmd;
+	}
+
+	bench->null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+	if(bench->null_fd == -1)
+	{
+		perror("Could not open /dev/null");
+		quit(EXIT_FAILURE);
+	}
+
+	for(unsigned int i = 0; i < num_warmup; ++i)
+	{
+		if(!launch(bench, false)) { quit(EXIT_FAILURE); }
+	}
+
+	for(unsigned int i = 0; i < bench->num_launches; ++i)
+	{
+		if(!launch(bench, true)) { quit(EXIT_FAILURE); }
+	}
+
+	print_report(bench);
+
+	struct phase_s* total = find_phase(bench, "total", 5);
+	if(max_p99 >= 0 && total != NULL && total->num_samples > 0
+		&& percentile(total, 990) > max_p99)
+	{
+		fprintf(
+			stderr, PROG_NAME ": p99 of %.1f usec exceeds %ld usec\n",
+			percentile(total, 990), max_p99
+		);
+		quit(EXIT_FAILURE);
+	}
+
+quit:
+	if(bench != NULL)
+	{
+		if(bench->null_fd >= 0) { close(bench->null_fd); }
+		for(unsigned int i = 0; i < bench->num_phases; ++i)
+		{
+			free(bench->phases[i].samples);
+		}
+		free(bench->argv);
+	}
+	free(bench);
+	free(run_opts);
+
+	return exit_code;
+}
@@ -10,24 +10,45 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <limits.h>
+#include <sched.h>
 #include <grp.h>
 #include <pwd.h>
 #include <sys/types.h>
 #include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/ioprio.h>
+#include <linux/seccomp.h>
 #include "optparse.h"
 
-#define CASE_RUN_OPT case 'e': case 'u': case 'g': case 'c'
+// For helpers which are not used by every tool
+#define HAKO_UNUSED __attribute__((unused))
+
+#define CASE_RUN_OPT \
+	case 'e': case 'u': case 'g': case 'c': case 'S': case 'V': case 'O'
 #define RUN_CTX_OPTS \
 	{"env", 'e', OPTPARSE_REQUIRED}, \
 	{"user", 'u', OPTPARSE_REQUIRED}, \
 	{"group", 'g', OPTPARSE_REQUIRED}, \
-	{"chdir", 'c', OPTPARSE_REQUIRED}
+	{"chdir", 'c', OPTPARSE_REQUIRED}, \
+	{"sched", 'S', OPTPARSE_REQUIRED}, \
+	{"nice", 'V', OPTPARSE_REQUIRED}, \
+	{"ioprio", 'O', OPTPARSE_REQUIRED}
 
 #define RUN_CTX_HELP \
 	"NAME=VALUE", "Set environment variable inside sandbox", \
 	"USER", "Run as this user", \
 	"GROUP", "Run as this group", \
-	"DIR", "Change to this directory inside sandbox"
+	"DIR", "Change to this directory inside sandbox", \
+	"POLICY", "Scheduling policy: other, batch, idle, fifo:PRIO or rr:PRIO", \
+	"N", "Set nice value", \
+	"CLASS:LEVEL", "Set I/O priority: rt:0-7, be:0-7 or idle"
+
+// Scheduling settings which are not given are left as is
+#define NICE_UNSET INT_MIN
+
+struct sock_fprog;
 
 struct run_ctx_s
 {
@@ -38,6 +59,11 @@ struct run_ctx_s
 	char** env;
 	char** command;
 	char* default_cmd[2];
+	int sched_policy; // -1 when unset
+	int sched_priority;
+	int nice; // NICE_UNSET when unset
+	int ioprio; // -1 when unset
+	const struct sock_fprog* seccomp; // NULL for none
 };
 
 static bool
@@ -48,23 +74,104 @@ strtonum(const char* str, long* number)
 	return *end == '\0';
 }
 
-static void
+static HAKO_UNUSED void
 init_run_ctx(struct run_ctx_s* run_ctx, int argc)
 {
 	*run_ctx = (struct run_ctx_s){
 		.uid = (uid_t)-1,
 		.gid = (gid_t)-1,
-		.env = calloc(argc / 2, sizeof(char*))
+		.env = calloc(argc / 2, sizeof(char*)),
+		.sched_policy = -1,
+		.nice = NICE_UNSET,
+		.ioprio = -1
 	};
 }
 
-static void
+static HAKO_UNUSED void
 cleanup_run_ctx(struct run_ctx_s* run_ctx)
 {
 	free(run_ctx->env);
 }
 
-static bool
+static HAKO_UNUSED bool
+parse_sched_option(struct run_ctx_s* run_ctx, const char* optarg)
+{
+	static const struct
+	{
+		const char* name;
+		int policy;
+		bool realtime;
+	} policies[] = {
+		{ "other", SCHED_OTHER, false },
+		{ "batch", SCHED_BATCH, false },
+		{ "idle", SCHED_IDLE, false },
+		{ "fifo", SCHED_FIFO, true },
+		{ "rr", SCHED_RR, true },
+	};
+
+	const char* priority = strchr(optarg, ':');
+	size_t name_len = priority != NULL ?
+		(size_t)(priority - optarg) : strlen(optarg);
+	for(unsigned int i = 0; i < sizeof(policies) / sizeof(policies[0]); ++i)
+	{
+		if(strlen(policies[i].name) != name_len
+			|| strncmp(policies[i].name, optarg, name_len) != 0)
+		{
+			continue;
+		}
+
+		// Only realtime policies have a priority
+		long num = 0;
+		if(policies[i].realtime != (priority != NULL)) { return false; }
+		if(priority != NULL && !(strtonum(priority + 1, &num)
+			&& num >= sched_get_priority_min(policies[i].policy)
+			&& num <= sched_get_priority_max(policies[i].policy)))
+		{
+			return false;
+		}
+
+		run_ctx->sched_policy = policies[i].policy;
+		run_ctx->sched_priority = (int)num;
+		return true;
+	}
+
+	return false;
+}
+
+static HAKO_UNUSED bool
+parse_ioprio_option(struct run_ctx_s* run_ctx, const char* optarg)
+{
+	long level = 0;
+	const char* separator = strchr(optarg, ':');
+	bool has_level = separator != NULL;
+	if(has_level && !(strtonum(separator + 1, &level)
+		&& level >= 0 && level < IOPRIO_NR_LEVELS))
+	{
+		return false;
+	}
+
+	size_t class_len = has_level ? (size_t)(separator - optarg) : strlen(optarg);
+	if(class_len == 2 && strncmp(optarg, "rt", 2) == 0 && has_level)
+	{
+		run_ctx->ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_RT, level);
+	}
+	else if(class_len == 2 && strncmp(optarg, "be", 2) == 0 && has_level)
+	{
+		run_ctx->ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, level);
+	}
+	else if(class_len == 4 && strncmp(optarg, "idle", 4) == 0 && !has_level)
+	{
+		run_ctx->ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0);
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+
+static HAKO_UNUSED bool
 parse_run_option(
 	struct run_ctx_s* run_ctx,
 	const char* prog_name,
@@ -119,13 +226,37 @@ parse_run_option(
 		case 'c':
 			run_ctx->work_dir = optarg;
 			return true;
+		case 'S':
+			if(!parse_sched_option(run_ctx, optarg))
+			{
+				fprintf(
+					stderr, "%s: invalid scheduling policy: %s\n", prog_name, optarg
+				);
+				return false;
+			}
+			return true;
+		case 'V':
+			if(!strtonum(optarg, &num) || num < -20 || num > 19)
+			{
+				fprintf(stderr, "%s: invalid nice value: %s\n", prog_name, optarg);
+				return false;
+			}
+			run_ctx->nice = (int)num;
+			return true;
+		case 'O':
+			if(!parse_ioprio_option(run_ctx, optarg))
+			{
+				fprintf(stderr, "%s: invalid I/O priority: %s\n", prog_name, optarg);
+				return false;
+			}
+			return true;
 		default:
 			fprintf(stderr, "%s: invalid option: %c\n", prog_name, option);
 			return false;
 	}
 }
 
-static bool
+static HAKO_UNUSED bool
 drop_privileges(const struct run_ctx_s* run_ctx)
 {
 	uid_t uid = run_ctx->uid;
@@ -152,7 +283,7 @@ drop_privileges(const struct run_ctx_s* run_ctx)
 	return true;
 }
 
-static const char*
+static HAKO_UNUSED const char*
 parse_run_command(struct run_ctx_s* run_ctx, struct optparse* options)
 {
 	const char* target = options->argv[options->optind];
@@ -170,9 +301,40 @@ parse_run_command(struct run_ctx_s* run_ctx, struct optparse* options)
 	return target;
 }
 
-static bool
+// Raising priorities needs the privileges which are about to be dropped
+static HAKO_UNUSED bool
+apply_scheduling(const struct run_ctx_s* run_ctx)
+{
+	struct sched_param param = { .sched_priority = run_ctx->sched_priority };
+	if(run_ctx->sched_policy >= 0
+		&& sched_setscheduler(0, run_ctx->sched_policy, &param) == -1)
+	{
+		perror("Could not set scheduling policy");
+		return false;
+	}
+
+	if(run_ctx->nice != NICE_UNSET
+		&& setpriority(PRIO_PROCESS, 0, run_ctx->nice) == -1)
+	{
+		perror("Could not set nice value");
+		return false;
+	}
+
+	if(run_ctx->ioprio >= 0
+		&& syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, run_ctx->ioprio) == -1)
+	{
+		perror("Could not set I/O priority");
+		return false;
+	}
+
+	return true;
+}
+
+static HAKO_UNUSED bool
 execute_run_ctx(const struct run_ctx_s* run_ctx)
 {
+	if(!apply_scheduling(run_ctx)) { return false; }
+
 	if(!drop_privileges(run_ctx)) { return false; }
 
 	if(prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1)
@@ -187,6 +349,14 @@ execute_run_ctx(const struct run_ctx_s* run_ctx)
 		return false;
 	}
 
+	// Last so that the policy only has to allow execve
+	if(run_ctx->seccomp != NULL
+		&& prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, run_ctx->seccomp) == -1)
+	{
+		perror("Could not load seccomp filter");
+		return false;
+	}
+
 	if(execve(run_ctx->command[0], run_ctx->command, run_ctx->env) == -1)
 	{
 		fprintf(
@@ -199,4 +369,59 @@ execute_run_ctx(const struct run_ctx_s* run_ctx)
 	return true;
 }
 
+static HAKO_UNUSED bool
+find_cgroup2_mount(char* mount_point, size_t size)
+{
+	FILE* file = fopen("/proc/self/mountinfo", "r");
+	if(file == NULL) { return false; }
+
+	bool found = false;
+	char line[PATH_MAX + 256];
+	while(!found && fgets(line, sizeof(line), file) != NULL)
+	{
+		char* fs_type = strstr(line, " - ");
+		if(fs_type == NULL || strncmp(fs_type, " - cgroup2 ", 11) != 0) { continue; }
+
+		// The mount point is the fifth field
+		char* field = line;
+		for(int i = 0; i < 4 && field != NULL; ++i)
+		{
+			field = strchr(field, ' ');
+			if(field != NULL) { ++field; }
+		}
+		if(field == NULL) { continue; }
+
+		size_t len = strcspn(field, " ");
+		found = len < size;
+		if(found) { snprintf(mount_point, size, "%.*s", (int)len, field); }
+	}
+
+	fclose(file);
+	return found;
+}
+
+// The unified hierarchy path of a process, as seen from our cgroup namespace
+static HAKO_UNUSED bool
+read_cgroup_path(pid_t pid, char* cgroup, size_t size)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/cgroup", (int)pid);
+	FILE* file = fopen(path, "r");
+	if(file == NULL) { return false; }
+
+	bool found = false;
+	char line[PATH_MAX + 16];
+	while(!found && fgets(line, sizeof(line), file) != NULL)
+	{
+		if(strncmp(line, "0::", 3) != 0) { continue; }
+
+		line[strcspn(line, "\n")] = '\0';
+		found = strlen(line + 3) < size;
+		if(found) { strcpy(cgroup, line + 3); }
+	}
+
+	fclose(file);
+	return found;
+}
+
 #endif
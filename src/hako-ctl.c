@@ -0,0 +1,181 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#define OPTPARSE_IMPLEMENTATION
+#define OPTPARSE_API static __attribute__((unused))
+#include "optparse.h"
+#define OPTPARSE_HELP_IMPLEMENTATION
+#define OPTPARSE_HELP_API static
+#include "optparse-help.h"
+#include "hako-common.h"
+#include "hako-ipc.h"
+
+#define PROG_NAME "hako-ctl"
+#define quit(code) exit_code = code; goto quit;
+
+// Prints the reply and returns the exit code matching it
+static int
+print_reply(int sock, const char* request, char* buf)
+{
+	ssize_t len = recv(sock, buf, HAKO_MAX_MSG - 1, 0);
+	if(len <= 0)
+	{
+		fprintf(stderr, PROG_NAME ": connection closed\n");
+		return EXIT_FAILURE;
+	}
+	buf[len] = '\0';
+
+	if(strncmp(buf, "error ", 6) == 0)
+	{
+		fprintf(stderr, PROG_NAME ": %s\n", buf + 6);
+		return EXIT_FAILURE;
+	}
+
+	if(strncmp(buf, "ok", 2) != 0)
+	{
+		fprintf(stderr, PROG_NAME ": invalid reply\n");
+		return EXIT_FAILURE;
+	}
+
+	const char* value = buf[2] == ' ' ? buf + 3 : "";
+	if(strcmp(request, "wait") == 0) { return atoi(value); }
+	if(strcmp(request, "list") != 0)
+	{
+		if(value[0] != '\0') { printf("%s\n", value); }
+		return EXIT_SUCCESS;
+	}
+
+	// The list may span several messages
+	long num_lines = strtol(value, NULL, 10);
+	const char* lines = strchr(buf, '\n');
+	lines = lines != NULL ? lines + 1 : "";
+	for(;;)
+	{
+		for(const char* c = lines; *c != '\0'; ++c) { num_lines -= *c == '\n'; }
+		fputs(lines, stdout);
+		if(num_lines <= 0) { return EXIT_SUCCESS; }
+
+		len = recv(sock, buf, HAKO_MAX_MSG - 1, 0);
+		if(len <= 0)
+		{
+			fprintf(stderr, PROG_NAME ": connection closed\n");
+			return EXIT_FAILURE;
+		}
+		buf[len] = '\0';
+		lines = buf;
+	}
+}
+
+int
+main(int argc, char* argv[])
+{
+	(void)argc;
+
+	int exit_code = EXIT_SUCCESS;
+	int sock = -1;
+	char* buf = NULL;
+
+	struct optparse_long opts[] = {
+		{"help", 'h', OPTPARSE_NONE},
+		{0}
+	};
+
+	const char* help[] = {
+		NULL, "Print this message",
+	};
+
+	const char* usage =
+		"Usage: " PROG_NAME " [options] <socket> <request> [args]\n"
+		"\n"
+		"Requests:\n"
+		"  start <name> [run options] <target> [command] [args]\n"
+		"  stop <name> [signal]\n"
+		"  list\n"
+		"  wait <name>\n";
+
+	int option;
+	struct optparse options;
+	optparse_init(&options, argv);
+	options.permute = 0;
+
+	while((option = optparse_long(&options, opts, NULL)) != -1)
+	{
+		switch(option)
+		{
+			case 'h':
+				optparse_help(usage, opts, help);
+				quit(EXIT_SUCCESS);
+				break;
+			case '?':
+				fprintf(stderr, PROG_NAME ": %s\n", options.errmsg);
+				quit(EXIT_FAILURE);
+				break;
+			default:
+				fprintf(stderr, "Unimplemented option\n");
+				quit(EXIT_FAILURE);
+				break;
+		}
+	}
+
+	const char* socket_path = optparse_arg(&options);
+	char** words = &options.argv[options.optind];
+	if(socket_path == NULL || words[0] == NULL)
+	{
+		fprintf(stderr, PROG_NAME ": must provide socket and request\n");
+		quit(EXIT_FAILURE);
+	}
+
+	buf = malloc(HAKO_MAX_MSG);
+	if(buf == NULL)
+	{
+		perror("Could not allocate request");
+		quit(EXIT_FAILURE);
+	}
+
+	// Arguments are sent as is, the daemon validates them
+	size_t len = 0;
+	for(char** word = words; *word != NULL; ++word)
+	{
+		if(!append_str(buf, &len, *word)) { quit(EXIT_FAILURE); }
+	}
+
+	struct sockaddr_un addr;
+	if(!make_unix_addr(socket_path, &addr)) { quit(EXIT_FAILURE); }
+
+	sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if(sock == -1)
+	{
+		perror("socket() failed");
+		quit(EXIT_FAILURE);
+	}
+
+	if(connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+	{
+		fprintf(
+			stderr, "Could not connect to %s: %s\n",
+			socket_path, strerror(errno)
+		);
+		quit(EXIT_FAILURE);
+	}
+
+	// A started sandbox gets our stdio
+	int stdio[HAKO_NUM_STDIO] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+	bool start = strcmp(words[0], "start") == 0;
+	if(send_msg_fds(sock, buf, len, stdio, start ? HAKO_NUM_STDIO : 0) == -1)
+	{
+		perror("Could not send request");
+		quit(EXIT_FAILURE);
+	}
+
+	exit_code = print_reply(sock, words[0], buf);
+
+quit:
+	if(sock >= 0) { close(sock); }
+	free(buf);
+
+	return exit_code;
+}
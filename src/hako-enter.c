@@ -11,6 +11,8 @@
 #include <dirent.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/syscall.h>
+#include <limits.h>
 #define OPTPARSE_IMPLEMENTATION
 #define OPTPARSE_API static __attribute__((unused))
 #include "optparse.h"
@@ -18,18 +20,165 @@
 #define OPTPARSE_HELP_API static
 #include "optparse-help.h"
 #include "hako-common.h"
+#include "hako-trace.h"
+#include "hako-seccomp.h"
+#include "hako-pty.h"
 
 #define PROG_NAME "hako-enter"
 #define quit(code) exit_code = code; goto quit;
 
+#ifndef __NR_pidfd_open // not provided by older libc
+#define __NR_pidfd_open 434 // same on every architecture
+#endif
+
+#ifndef CLONE_NEWTIME
+#define CLONE_NEWTIME 0x00000080
+#endif
+
+struct namespace_s
+{
+	const char* name;
+	int flag;
+};
+
+static const struct namespace_s namespaces[] = {
+	{ "cgroup", CLONE_NEWCGROUP },
+	{ "ipc", CLONE_NEWIPC },
+	{ "mnt", CLONE_NEWNS },
+	{ "net", CLONE_NEWNET },
+	{ "pid", CLONE_NEWPID },
+	{ "time", CLONE_NEWTIME },
+	{ "user", CLONE_NEWUSER },
+	{ "uts", CLONE_NEWUTS },
+};
+
+#define NUM_NAMESPACES (sizeof(namespaces) / sizeof(namespaces[0]))
+
+// The user namespace is usually the host's and joining it again fails
+#define DEFAULT_NS_FLAGS ( \
+	CLONE_NEWCGROUP | CLONE_NEWIPC | CLONE_NEWNS | CLONE_NEWNET \
+	| CLONE_NEWPID | CLONE_NEWTIME | CLONE_NEWUTS \
+)
+
+static int
+find_namespace(const char* name, size_t len)
+{
+	for(unsigned int i = 0; i < NUM_NAMESPACES; ++i)
+	{
+		if(strlen(namespaces[i].name) == len
+			&& strncmp(namespaces[i].name, name, len) == 0)
+		{
+			return namespaces[i].flag;
+		}
+	}
+
+	return 0;
+}
+
+static bool
+parse_ns_list(const char* list, int* flags)
+{
+	*flags = 0;
+	while(*list != '\0')
+	{
+		size_t len = strcspn(list, ",");
+		int flag = find_namespace(list, len);
+		if(flag == 0)
+		{
+			fprintf(
+				stderr, PROG_NAME ": unknown namespace: %.*s\n", (int)len, list
+			);
+			return false;
+		}
+
+		*flags |= flag;
+		list += len;
+		if(*list == ',') { ++list; }
+	}
+
+	if(*flags == 0)
+	{
+		fprintf(stderr, PROG_NAME ": no namespace given\n");
+		return false;
+	}
+
+	return true;
+}
+
+// The pid of the process behind a pidfd, -1 if it has exited
+static pid_t
+pidfd_get_pid(int pidfd)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/self/fdinfo/%d", pidfd);
+	FILE* file = fopen(path, "r");
+	if(file == NULL) { return -1; }
+
+	pid_t pid = -1;
+	char line[256];
+	while(fgets(line, sizeof(line), file) != NULL)
+	{
+		if(sscanf(line, "Pid: %d", &pid) == 1) { break; }
+	}
+
+	fclose(file);
+	return pid;
+}
+
+// Commands are accounted to the sandbox's cgroup, only cgroup v2 is supported
 static bool
-enter_sandbox(const char* pid)
+join_cgroup(pid_t pid)
+{
+	char target[PATH_MAX], own[PATH_MAX], mount_point[PATH_MAX];
+	if(!read_cgroup_path(pid, target, sizeof(target))
+		|| !find_cgroup2_mount(mount_point, sizeof(mount_point)))
+	{
+		return true;
+	}
+
+	if(read_cgroup_path(getpid(), own, sizeof(own)) && strcmp(own, target) == 0)
+	{
+		return true;
+	}
+
+	char procs[2 * PATH_MAX + 16];
+	snprintf(procs, sizeof(procs), "%s%s/cgroup.procs", mount_point, target);
+	int fd = open(procs, O_WRONLY | O_CLOEXEC);
+	bool joined = fd >= 0 && write(fd, "0", 1) == 1;
+	if(!joined)
+	{
+		fprintf(stderr, "Could not join cgroup %s: %s\n", target, strerror(errno));
+	}
+	if(fd >= 0) { close(fd); }
+
+	return joined;
+}
+
+// Placement given to the sandbox by hako-run also applies to what enters it.
+// The memory policy of another process cannot be read, only CPUs are copied.
+static bool
+copy_affinity(pid_t pid)
+{
+	cpu_set_t cpus;
+	if(sched_getaffinity(pid, sizeof(cpus), &cpus) == -1
+		|| sched_setaffinity(0, sizeof(cpus), &cpus) == -1)
+	{
+		perror("Could not copy CPU affinity");
+		return false;
+	}
+
+	return true;
+}
+
+// Join namespaces one by one, for kernels which cannot setns() a pidfd
+static bool
+enter_ns_links(pid_t pid, int ns_flags, struct trace_s* trace)
 {
 	bool exit_code = true;
 	DIR* dir = NULL;
 	char ns_dir[256]; // long enough to hold path to namespace
 
-	if(snprintf(ns_dir, sizeof(ns_dir), "/proc/%s/ns", pid) > (int)sizeof(ns_dir))
+	if(snprintf(ns_dir, sizeof(ns_dir), "/proc/%d/ns", (int)pid) > (int)sizeof(ns_dir))
 	{
 		fprintf(stderr, "Invalid pid\n");
 		quit(false);
@@ -48,11 +197,15 @@ enter_sandbox(const char* pid)
 		quit(false);
 	}
 
+	uint64_t start = trace_now();
 	struct dirent* dirent;
 	while((dirent = readdir(dir)) != NULL)
 	{
 		if(dirent->d_type != DT_LNK) { continue; }
 
+		int flag = find_namespace(dirent->d_name, strlen(dirent->d_name));
+		if(!(flag & ns_flags)) { continue; }
+
 		int ns = open(dirent->d_name, O_RDONLY);
 		if(ns < 0)
 		{
@@ -87,6 +240,8 @@ enter_sandbox(const char* pid)
 					quit(false);
 				}
 			}
+
+			start = trace_phase(trace, "setns", dirent->d_name, start);
 		}
 	}
 
@@ -96,6 +251,51 @@ quit:
 	return exit_code;
 }
 
+static bool
+enter_sandbox(int pidfd, pid_t pid, int ns_flags, struct trace_s* trace)
+{
+	// Join every namespace at once, this cannot race with pid reuse
+	if(pidfd >= 0)
+	{
+		uint64_t start = trace_now();
+		if(setns(pidfd, ns_flags) == 0)
+		{
+			trace_phase(trace, "setns", "pidfd", start);
+			return true;
+		}
+
+		// Older kernels only take namespace files
+		if(errno != EINVAL)
+		{
+			perror("Could not setns");
+			return false;
+		}
+	}
+
+	return enter_ns_links(pid, ns_flags, trace);
+}
+
+// Only returns in the parent, the signal mask is restored in the child
+static pid_t
+fork_command(const struct run_ctx_s* run_ctx, int pty_slave, sigset_t* sigmask)
+{
+	pid_t child = vfork();
+	if(child != 0) { return child; }
+
+	if(prctl(PR_SET_PDEATHSIG, SIGKILL, 0, 0, 0) == -1)
+	{
+		perror("Could not set parent death signal");
+		_exit(EXIT_FAILURE);
+	}
+
+	if(sigmask != NULL) { sigprocmask(SIG_SETMASK, sigmask, NULL); }
+
+	if(pty_slave >= 0 && !attach_pty(pty_slave)) { _exit(EXIT_FAILURE); }
+
+	execute_run_ctx(run_ctx);
+	_exit(EXIT_FAILURE);
+}
+
 int
 main(int argc, char* argv[])
 {
@@ -104,6 +304,12 @@ main(int argc, char* argv[])
 	struct optparse_long opts[] = {
 		{"help", 'h', OPTPARSE_NONE},
 		{"fork", 'f', OPTPARSE_NONE},
+		{"ns", 'n', OPTPARSE_REQUIRED},
+		{"pidfd", 'd', OPTPARSE_REQUIRED},
+		{"no-affinity", 'A', OPTPARSE_NONE},
+		{"seccomp", 's', OPTPARSE_REQUIRED},
+		{"pty", 't', OPTPARSE_NONE},
+		TRACE_OPTS,
 		RUN_CTX_OPTS,
 		{0}
 	};
@@ -111,15 +317,32 @@ main(int argc, char* argv[])
 	const char* help[] = {
 		NULL, "Print this message",
 		NULL, "Fork a new process inside sandbox",
+		"LIST", "Namespaces to join, comma separated (default: all but user)",
+		"FD", "Enter the sandbox referred to by this pidfd, without <pid>",
+		NULL, "Keep the current CPU affinity instead of the sandbox's",
+		"FILE", "Filter syscalls of the command with this seccomp policy",
+		NULL, "Run the command in a new pseudo-terminal, implies --fork",
+		TRACE_HELP,
 		RUN_CTX_HELP,
 	};
 
 	const char* usage = "Usage: " PROG_NAME " [options] <pid> [command] [args]";
 
 	int option;
+	long num;
 	bool fork_before_exec = false;
+	bool affinity = true;
+	struct sock_fprog seccomp = { 0 };
+	bool use_pty = false;
+	struct pty_s pty = { .master = -1, .slave = -1 };
+	int signal_fd = -1;
+	sigset_t set, old_set;
+	int ns_flags = DEFAULT_NS_FLAGS;
+	int pidfd = -1;
+	pid_t pid;
 	struct optparse options;
 	struct run_ctx_s run_ctx;
+	struct trace_s trace = { .fd = -1 };
 
 	init_run_ctx(&run_ctx, argc);
 	optparse_init(&options, argv);
@@ -136,6 +359,41 @@ main(int argc, char* argv[])
 			case 'f':
 				fork_before_exec = true;
 				break;
+			case 'A':
+				affinity = false;
+				break;
+			case 't':
+				use_pty = true;
+				fork_before_exec = true;
+				break;
+			case 's':
+				cleanup_seccomp_filter(&seccomp);
+				if(!load_seccomp_filter(options.optarg, &seccomp))
+				{
+					quit(EXIT_FAILURE);
+				}
+				run_ctx.seccomp = &seccomp;
+				break;
+			case 'n':
+				if(!parse_ns_list(options.optarg, &ns_flags)) { quit(EXIT_FAILURE); }
+				break;
+			case 'd':
+				if(!strtonum(options.optarg, &num) || num < 0
+					|| fcntl(num, F_SETFD, FD_CLOEXEC) == -1)
+				{
+					fprintf(
+						stderr, PROG_NAME ": invalid pidfd: %s\n", options.optarg
+					);
+					quit(EXIT_FAILURE);
+				}
+				pidfd = num;
+				break;
+			CASE_TRACE_OPT:
+				if(!parse_trace_option(&trace, PROG_NAME, option, options.optarg))
+				{
+					quit(EXIT_FAILURE);
+				}
+				break;
 			CASE_RUN_OPT:
 				if(!parse_run_option(&run_ctx, PROG_NAME, option, options.optarg))
 				{
@@ -153,43 +411,122 @@ main(int argc, char* argv[])
 		}
 	}
 
-	const char* pid = parse_run_command(&run_ctx, &options);
+	if(pidfd >= 0)
+	{
+		// The command comes right after the options
+		if(options.argv[options.optind] != NULL)
+		{
+			run_ctx.command = &options.argv[options.optind];
+		}
+		else
+		{
+			parse_run_command(&run_ctx, &options);
+		}
 
-	if(pid == NULL)
+		pid = pidfd_get_pid(pidfd);
+		if(pid <= 0)
+		{
+			fprintf(stderr, PROG_NAME ": pidfd does not refer to a live process\n");
+			quit(EXIT_FAILURE);
+		}
+	}
+	else
 	{
-		fprintf(stderr, PROG_NAME ": must provide sandbox PID\n");
+		const char* pid_str = parse_run_command(&run_ctx, &options);
+
+		if(pid_str == NULL)
+		{
+			fprintf(stderr, PROG_NAME ": must provide sandbox PID\n");
+			quit(EXIT_FAILURE);
+		}
+
+		if(!strtonum(pid_str, &num) || num <= 0)
+		{
+			fprintf(stderr, PROG_NAME ": invalid pid: %s\n", pid_str);
+			quit(EXIT_FAILURE);
+		}
+		pid = num;
+
+		// Kernels without pidfd_open() fall back to /proc
+		pidfd = syscall(__NR_pidfd_open, pid, 0);
+		if(pidfd == -1 && errno != ENOSYS)
+		{
+			fprintf(stderr, "Could not open pid %d: %s\n", (int)pid, strerror(errno));
+			quit(EXIT_FAILURE);
+		}
+	}
+
+	// From the host's /dev, the sandbox may not have one
+	if(use_pty && !open_pty(&pty))
+	{
+		if(pidfd >= 0) { close(pidfd); }
 		quit(EXIT_FAILURE);
 	}
 
-	if(!enter_sandbox(pid)) { quit(EXIT_FAILURE); }
+	trace.pid = pid;
+	bool entered = (!affinity || copy_affinity(pid))
+		&& join_cgroup(pid)
+		&& enter_sandbox(pidfd, pid, ns_flags, &trace);
+	if(pidfd >= 0) { close(pidfd); }
+	if(!entered) { quit(EXIT_FAILURE); }
+
+	trace_open_phase(&trace, "exec");
+	trace_flush(&trace);
 
 	if(fork_before_exec)
 	{
-		pid_t child = vfork();
-		if(child == -1)
+		// The relay handles signals along with the pty
+		if(use_pty)
 		{
-			perror("vfork() failed");
-			quit(EXIT_FAILURE);
-		}
-		else if(child == 0) // child
-		{
-			if(prctl(PR_SET_PDEATHSIG, SIGKILL, 0, 0, 0) == -1)
+			sigfillset(&set);
+			sigprocmask(SIG_BLOCK, &set, &old_set);
+			signal_fd = signalfd(-1, &set, SFD_CLOEXEC);
+			if(signal_fd == -1)
 			{
-				perror("Could not set parent death signal");
-				exit(EXIT_FAILURE);
+				perror("signalfd() failed");
+				quit(EXIT_FAILURE);
 			}
+		}
 
-			if(!execute_run_ctx(&run_ctx)) { exit(EXIT_FAILURE); }
-
-			exit(EXIT_SUCCESS);// unreachable
+		pid_t child = fork_command(
+			&run_ctx, pty.slave, use_pty ? &old_set : NULL
+		);
+		if(child == -1)
+		{
+			perror("vfork() failed");
+			quit(EXIT_FAILURE);
 		}
 		else // parent
 		{
 			if(!drop_privileges(&run_ctx)) { quit(EXIT_FAILURE); }
 
 			int status;
-			errno = 0;
-			while(waitpid(child, &status, 0) != child && errno == EINTR) {}
+			if(use_pty)
+			{
+				start_pty_relay(&pty);
+				for(;;)
+				{
+					int sig = wait_pty_signal(signal_fd, &pty, NULL, 0);
+					if(sig == SIGCHLD && waitpid(child, &status, WNOHANG) == child)
+					{
+						break;
+					}
+
+					if(sig == -1 || sig == SIGINT || sig == SIGTERM
+						|| sig == SIGHUP || sig == SIGQUIT)
+					{
+						kill(child, SIGKILL);
+						quit(sig == -1 ? EXIT_FAILURE : 128 + sig);
+					}
+				}
+
+				drain_pty(&pty);
+			}
+			else
+			{
+				errno = 0;
+				while(waitpid(child, &status, 0) != child && errno == EINTR) {}
+			}
 
 			quit(
 				WIFEXITED(status) ?
@@ -202,7 +539,11 @@ main(int argc, char* argv[])
 		if(!execute_run_ctx(&run_ctx)) { quit(EXIT_FAILURE); }
 	}
 quit:
+	cleanup_trace(&trace);
 	cleanup_run_ctx(&run_ctx);
+	cleanup_seccomp_filter(&seccomp);
+	cleanup_pty(&pty);
+	if(signal_fd >= 0) { close(signal_fd); }
 
 	return exit_code;
 }
@@ -0,0 +1,178 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/signalfd.h>
+#define OPTPARSE_IMPLEMENTATION
+#define OPTPARSE_API static __attribute__((unused))
+#include "optparse.h"
+#define OPTPARSE_HELP_IMPLEMENTATION
+#define OPTPARSE_HELP_API static
+#include "optparse-help.h"
+#include "hako-common.h"
+#include "hako-ipc.h"
+
+#define PROG_NAME "hako-exec"
+#define quit(code) exit_code = code; goto quit;
+
+int
+main(int argc, char* argv[])
+{
+	int exit_code = EXIT_SUCCESS;
+	int sock = -1;
+	int signal_fd = -1;
+
+	struct optparse_long opts[] = {
+		{"help", 'h', OPTPARSE_NONE},
+		RUN_CTX_OPTS,
+		{0}
+	};
+
+	const char* help[] = {
+		NULL, "Print this message",
+		RUN_CTX_HELP,
+	};
+
+	const char* usage = "Usage: " PROG_NAME " [options] <socket> [command] [args]";
+
+	int option;
+	struct optparse options;
+	struct run_ctx_s run_ctx;
+
+	init_run_ctx(&run_ctx, argc);
+	optparse_init(&options, argv);
+	options.permute = 0;
+
+	while((option = optparse_long(&options, opts, NULL)) != -1)
+	{
+		switch(option)
+		{
+			case 'h':
+				optparse_help(usage, opts, help);
+				quit(EXIT_SUCCESS);
+				break;
+			CASE_RUN_OPT:
+				if(!parse_run_option(&run_ctx, PROG_NAME, option, options.optarg))
+				{
+					quit(EXIT_FAILURE);
+				}
+				break;
+			case '?':
+				fprintf(stderr, PROG_NAME ": %s\n", options.errmsg);
+				quit(EXIT_FAILURE);
+				break;
+			default:
+				fprintf(stderr, "Unimplemented option\n");
+				quit(EXIT_FAILURE);
+				break;
+		}
+	}
+
+	const char* socket_path = parse_run_command(&run_ctx, &options);
+
+	if(socket_path == NULL)
+	{
+		fprintf(stderr, PROG_NAME ": must provide socket\n");
+		quit(EXIT_FAILURE);
+	}
+
+	// Let the server pick its own default command
+	if(run_ctx.command == run_ctx.default_cmd) { run_ctx.command = NULL; }
+
+	struct sockaddr_un addr;
+	if(!make_unix_addr(socket_path, &addr)) { quit(EXIT_FAILURE); }
+
+	sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if(sock == -1)
+	{
+		perror("socket() failed");
+		quit(EXIT_FAILURE);
+	}
+
+	if(connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+	{
+		fprintf(
+			stderr, "Could not connect to %s: %s\n",
+			socket_path, strerror(errno)
+		);
+		quit(EXIT_FAILURE);
+	}
+
+	int stdio[HAKO_NUM_STDIO] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+	if(!send_run_request(sock, &run_ctx, stdio)) { quit(EXIT_FAILURE); }
+
+	// Forward termination signals to the command
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGHUP);
+	sigaddset(&set, SIGQUIT);
+	sigprocmask(SIG_BLOCK, &set, NULL);
+	signal_fd = signalfd(-1, &set, SFD_CLOEXEC);
+	if(signal_fd == -1)
+	{
+		perror("signalfd() failed");
+		quit(EXIT_FAILURE);
+	}
+
+	// The pid comes first, then the wait status
+	bool started = false;
+	for(;;)
+	{
+		struct pollfd pollfds[] = {
+			{ .fd = sock, .events = POLLIN },
+			{ .fd = signal_fd, .events = POLLIN },
+		};
+		if(poll(pollfds, 2, -1) == -1)
+		{
+			if(errno == EINTR) { continue; }
+
+			perror("poll() failed");
+			quit(EXIT_FAILURE);
+		}
+
+		if(pollfds[1].revents & POLLIN)
+		{
+			struct signalfd_siginfo info;
+			if(read(signal_fd, &info, sizeof(info)) == sizeof(info))
+			{
+				int32_t sig = info.ssi_signo;
+				send(sock, &sig, sizeof(sig), MSG_NOSIGNAL);
+			}
+		}
+
+		if(pollfds[0].revents != 0)
+		{
+			int32_t value;
+			if(recv(sock, &value, sizeof(value), 0) != sizeof(value))
+			{
+				fprintf(stderr, PROG_NAME ": connection closed\n");
+				quit(EXIT_FAILURE);
+			}
+
+			if(started)
+			{
+				quit(
+					WIFEXITED(value) ?
+					WEXITSTATUS(value) : (128 + WTERMSIG(value))
+				);
+			}
+
+			started = true;
+		}
+	}
+
+quit:
+	if(signal_fd >= 0) { close(signal_fd); }
+	if(sock >= 0) { close(sock); }
+	cleanup_run_ctx(&run_ctx);
+
+	return exit_code;
+}
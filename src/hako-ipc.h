@@ -0,0 +1,282 @@
+#ifndef HAKO_IPC_H
+#define HAKO_IPC_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "hako-common.h"
+
+// Requests are sent as a single SOCK_SEQPACKET message:
+//
+// - A request header.
+// - argc NUL-terminated arguments, followed by envc NUL-terminated
+//   environment variables and the working directory (empty for none).
+// - The stdin, stdout and stderr of the command as SCM_RIGHTS.
+//
+// The server replies with the pid of the command then its wait status, both
+// as int32_t.
+// The client can send an int32_t signal number at any time to signal the
+// command.
+// Closing the connection kills the command.
+
+// The daemon of hako-run takes requests as a single SOCK_SEQPACKET message of
+// NUL-terminated words:
+//
+// - start NAME [options] <target> [command] [args]: options are the run ctx
+//   ones, the stdin, stdout and stderr of the sandbox can be sent as
+//   SCM_RIGHTS.
+// - stop NAME [SIGNAL]: SIGTERM by default.
+// - list
+// - wait NAME: the reply comes once the sandbox exits, the sandbox is then
+//   forgotten.
+//
+// Replies are text, either "ok [value]" or "error <message>".
+// The reply to list is "ok N" followed by N lines of "NAME PID running" or
+// "NAME PID exited CODE", split into as many messages as needed.
+
+#define HAKO_MAX_MSG 65536
+#define HAKO_MAX_NAME 64
+#define HAKO_NUM_STDIO 3
+
+struct hako_request_s
+{
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t argc;
+	uint32_t envc;
+	int32_t sched_policy;
+	int32_t sched_priority;
+	int32_t nice;
+	int32_t ioprio;
+};
+
+static HAKO_UNUSED bool
+make_unix_addr(const char* path, struct sockaddr_un* addr)
+{
+	*addr = (struct sockaddr_un){ .sun_family = AF_UNIX };
+	if(strlen(path) >= sizeof(addr->sun_path))
+	{
+		fprintf(stderr, "Socket path is too long: %s\n", path);
+		return false;
+	}
+
+	strcpy(addr->sun_path, path);
+	return true;
+}
+
+static HAKO_UNUSED ssize_t
+send_msg_fds(
+	int sock, const void* buf, size_t len, const int* fds, unsigned int num_fds
+)
+{
+	union
+	{
+		char buf[CMSG_SPACE(sizeof(int) * HAKO_NUM_STDIO)];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = { .iov_base = (void*)buf, .iov_len = len };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+	if(num_fds > 0)
+	{
+		msg.msg_control = control.buf;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * num_fds);
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * num_fds);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * num_fds);
+	}
+
+	ssize_t result;
+	while((result = sendmsg(sock, &msg, MSG_NOSIGNAL)) == -1 && errno == EINTR)
+	{ }
+
+	return result;
+}
+
+// Received descriptors are close-on-exec, unused slots are set to -1
+static HAKO_UNUSED ssize_t
+recv_msg_fds(int sock, void* buf, size_t len, int* fds, unsigned int max_fds)
+{
+	union
+	{
+		char buf[CMSG_SPACE(sizeof(int) * HAKO_NUM_STDIO)];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = { .iov_base = buf, .iov_len = len };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf)
+	};
+
+	for(unsigned int i = 0; i < max_fds; ++i) { fds[i] = -1; }
+
+	ssize_t result;
+	while((result = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR)
+	{ }
+	if(result == -1) { return -1; }
+
+	for(struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg != NULL;
+		cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+		if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+		{
+			continue;
+		}
+
+		// The control buffer cannot hold more than HAKO_NUM_STDIO descriptors
+		int received[HAKO_NUM_STDIO];
+		unsigned int num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		if(num_fds > HAKO_NUM_STDIO) { num_fds = HAKO_NUM_STDIO; }
+		memcpy(received, CMSG_DATA(cmsg), sizeof(int) * num_fds);
+		for(unsigned int i = 0; i < num_fds; ++i)
+		{
+			if(i < max_fds) { fds[i] = received[i]; }
+			else { close(received[i]); }
+		}
+	}
+
+	if(msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+	{
+		for(unsigned int i = 0; i < max_fds; ++i)
+		{
+			if(fds[i] >= 0) { close(fds[i]); }
+		}
+
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	return result;
+}
+
+static HAKO_UNUSED bool
+append_str(char* buf, size_t* len, const char* str)
+{
+	size_t str_len = strlen(str) + 1;
+	if(*len + str_len > HAKO_MAX_MSG)
+	{
+		fprintf(stderr, "Request is too large\n");
+		return false;
+	}
+
+	memcpy(buf + *len, str, str_len);
+	*len += str_len;
+	return true;
+}
+
+// A NULL command lets the server pick its default one
+static HAKO_UNUSED bool
+send_run_request(int sock, const struct run_ctx_s* run_ctx, const int* stdio)
+{
+	char buf[HAKO_MAX_MSG];
+	struct hako_request_s request = {
+		.uid = run_ctx->uid,
+		.gid = run_ctx->gid,
+		.envc = run_ctx->env_len,
+		.sched_policy = run_ctx->sched_policy,
+		.sched_priority = run_ctx->sched_priority,
+		.nice = run_ctx->nice,
+		.ioprio = run_ctx->ioprio
+	};
+	size_t len = sizeof(request);
+
+	for(char** arg = run_ctx->command; arg != NULL && *arg != NULL; ++arg)
+	{
+		if(!append_str(buf, &len, *arg)) { return false; }
+		++request.argc;
+	}
+
+	for(unsigned int i = 0; i < run_ctx->env_len; ++i)
+	{
+		if(!append_str(buf, &len, run_ctx->env[i])) { return false; }
+	}
+
+	const char* work_dir = run_ctx->work_dir != NULL ? run_ctx->work_dir : "";
+	if(!append_str(buf, &len, work_dir)) { return false; }
+
+	memcpy(buf, &request, sizeof(request));
+	if(send_msg_fds(sock, buf, len, stdio, HAKO_NUM_STDIO) == -1)
+	{
+		perror("Could not send request");
+		return false;
+	}
+
+	return true;
+}
+
+// On success, the strings in run_ctx point into buf and run_ctx->env must be
+// released with free()
+static HAKO_UNUSED bool
+recv_run_request(
+	int sock, struct run_ctx_s* run_ctx, char* buf, size_t size, int* stdio
+)
+{
+	ssize_t len = recv_msg_fds(sock, buf, size, stdio, HAKO_NUM_STDIO);
+	if(len == -1)
+	{
+		perror("Could not receive request");
+		return false;
+	}
+
+	struct hako_request_s request;
+	if((size_t)len < sizeof(request) || buf[len - 1] != '\0') { goto invalid; }
+	memcpy(&request, buf, sizeof(request));
+	if(request.argc > HAKO_MAX_MSG || request.envc > HAKO_MAX_MSG) { goto invalid; }
+
+	// Environment comes first so that the array can be freed through env
+	char** strs = calloc(request.envc + request.argc + 2, sizeof(char*));
+	if(strs == NULL)
+	{
+		perror("Could not allocate request");
+		goto error;
+	}
+
+	char* str = buf + sizeof(request);
+	char* work_dir = NULL;
+	for(unsigned int i = 0; i <= request.argc + request.envc; ++i)
+	{
+		if(str >= buf + len)
+		{
+			free(strs);
+			goto invalid;
+		}
+
+		if(i < request.argc) { strs[request.envc + 1 + i] = str; }
+		else if(i < request.argc + request.envc) { strs[i - request.argc] = str; }
+		else { work_dir = str; }
+
+		str += strlen(str) + 1;
+	}
+
+	*run_ctx = (struct run_ctx_s){
+		.uid = request.uid,
+		.gid = request.gid,
+		.work_dir = work_dir[0] != '\0' ? work_dir : NULL,
+		.env_len = request.envc,
+		.env = strs,
+		.command = request.argc > 0 ? strs + request.envc + 1 : NULL,
+		.sched_policy = request.sched_policy,
+		.sched_priority = request.sched_priority,
+		.nice = request.nice,
+		.ioprio = request.ioprio
+	};
+
+	return true;
+
+invalid:
+	fprintf(stderr, "Received an invalid request\n");
+error:
+	for(unsigned int i = 0; i < HAKO_NUM_STDIO; ++i)
+	{
+		if(stdio[i] >= 0) { close(stdio[i]); }
+	}
+
+	return false;
+}
+
+#endif
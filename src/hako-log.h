@@ -0,0 +1,273 @@
+#ifndef HAKO_LOG_H
+#define HAKO_LOG_H
+
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hako-common.h"
+
+// With --log, the output of a sandbox goes to one ring file per stream:
+// a header followed by the last bytes written, older ones being overwritten.
+// Each line starts with the time it was read: "2024-01-02T03:04:05.678901Z ".
+//
+// The supervisor is the only writer, it never waits for readers.
+// Readers map the file and copy from it, then check that what they copied was
+// not overwritten meanwhile.
+
+#define LOG_MAGIC "hakolog1"
+#define LOG_DATA_OFFSET 4096
+#define LOG_DEFAULT_SIZE (1024 * 1024)
+#define LOG_MAX_SIZE ((uint64_t)1 << 30)
+#define LOG_CHUNK 65536
+// Room for bursts while the supervisor is busy
+#define LOG_PIPE_SIZE (1024 * 1024)
+#define LOG_NUM_STREAMS 2
+
+struct log_header_s
+{
+	char magic[8];
+	uint64_t size; // of the data
+	uint64_t written; // bytes written since the start
+	uint64_t writing; // end of the write in progress, written when there is none
+	uint64_t dropped_lines; // overwritten by newer ones
+	uint64_t closed; // the sandbox has exited
+};
+
+struct log_ring_s
+{
+	struct log_header_s* header;
+	char* data;
+	size_t map_size;
+};
+
+// Accepts a K, M or G suffix
+static HAKO_UNUSED bool
+parse_log_size(const char* str, uint64_t* size)
+{
+	char* end;
+	errno = 0;
+	unsigned long long value = strtoull(str, &end, 10);
+	if(errno != 0 || end == str || str[0] == '-') { return false; }
+
+	int shift = 0;
+	switch(*end)
+	{
+		case 'K': shift = 10; ++end; break;
+		case 'M': shift = 20; ++end; break;
+		case 'G': shift = 30; ++end; break;
+	}
+	if(*end != '\0' || value == 0 || value > (LOG_MAX_SIZE >> shift))
+	{
+		return false;
+	}
+
+	*size = (uint64_t)value << shift;
+	return true;
+}
+
+static HAKO_UNUSED void
+cleanup_log_ring(struct log_ring_s* ring)
+{
+	if(ring->header == NULL) { return; }
+
+	munmap(ring->header, ring->map_size);
+	ring->header = NULL;
+}
+
+static HAKO_UNUSED bool
+map_log_ring(struct log_ring_s* ring, int fd, size_t map_size, int prot)
+{
+	void* map = mmap(NULL, map_size, prot, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED) { return false; }
+
+	ring->header = map;
+	ring->data = (char*)map + LOG_DATA_OFFSET;
+	ring->map_size = map_size;
+	return true;
+}
+
+// Replaces any previous ring of that name
+static HAKO_UNUSED bool
+create_log_ring(
+	struct log_ring_s* ring, int dir_fd, const char* name, uint64_t size
+)
+{
+	// Whole pages so that the end of the data is never past the file
+	long page_size = sysconf(_SC_PAGESIZE);
+	size = (size + page_size - 1) / page_size * page_size;
+
+	int fd = openat(dir_fd, name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	bool created = fd >= 0
+		&& ftruncate(fd, LOG_DATA_OFFSET + size) == 0
+		&& map_log_ring(ring, fd, LOG_DATA_OFFSET + size, PROT_READ | PROT_WRITE);
+	int error = errno;
+	if(fd >= 0) { close(fd); }
+	if(!created)
+	{
+		fprintf(stderr, "Could not create log %s: %s\n", name, strerror(error));
+		return false;
+	}
+
+	ring->header->size = size;
+	memcpy(ring->header->magic, LOG_MAGIC, sizeof(ring->header->magic));
+	return true;
+}
+
+static HAKO_UNUSED bool
+open_log_ring(struct log_ring_s* ring, const char* path)
+{
+	struct stat file_stat;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	bool opened = fd >= 0
+		&& fstat(fd, &file_stat) == 0
+		&& file_stat.st_size > LOG_DATA_OFFSET
+		&& map_log_ring(ring, fd, file_stat.st_size, PROT_READ);
+	int error = errno;
+	if(fd >= 0) { close(fd); }
+	if(!opened)
+	{
+		fprintf(stderr, "Could not open log %s: %s\n", path, strerror(error));
+		return false;
+	}
+
+	if(memcmp(ring->header->magic, LOG_MAGIC, sizeof(ring->header->magic)) != 0
+		|| ring->header->size > ring->map_size - LOG_DATA_OFFSET)
+	{
+		fprintf(stderr, "%s is not a log\n", path);
+		cleanup_log_ring(ring);
+		return false;
+	}
+
+	return true;
+}
+
+// Copies between the logical positions start and end of the ring
+static HAKO_UNUSED void
+copy_log_ring(
+	const struct log_ring_s* ring, char* buf, uint64_t start, uint64_t end
+)
+{
+	uint64_t size = ring->header->size;
+	while(start < end)
+	{
+		uint64_t offset = start % size;
+		uint64_t len = end - start < size - offset ? end - start : size - offset;
+		memcpy(buf, ring->data + offset, len);
+		buf += len;
+		start += len;
+	}
+}
+
+static HAKO_UNUSED void
+write_log_ring(struct log_ring_s* ring, const char* buf, size_t len)
+{
+	struct log_header_s* header = ring->header;
+	uint64_t size = header->size;
+	if(len > size)
+	{
+		buf += len - size;
+		len = size;
+	}
+
+	// Count the lines about to be overwritten
+	uint64_t written = header->written;
+	uint64_t end = written + len;
+	for(uint64_t pos = written > size ? written - size : 0;
+		pos + size < end;
+		++pos)
+	{
+		header->dropped_lines += ring->data[pos % size] == '\n';
+	}
+
+	// Readers check this once they have copied
+	__atomic_store_n(&header->writing, end, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	for(uint64_t pos = written; pos < end;)
+	{
+		uint64_t offset = pos % size;
+		uint64_t chunk = end - pos < size - offset ? end - pos : size - offset;
+		memcpy(ring->data + offset, buf + (pos - written), chunk);
+		pos += chunk;
+	}
+
+	__atomic_store_n(&header->written, end, __ATOMIC_RELEASE);
+}
+
+// Writes a chunk of output, starting lines with a timestamp
+static HAKO_UNUSED void
+append_log(struct log_ring_s* ring, bool* line_start, const char* buf, size_t len)
+{
+	struct timespec now;
+	struct tm tm;
+	char stamp[64];
+	size_t stamp_len = 0;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	gmtime_r(&now.tv_sec, &tm);
+	stamp_len = strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+	stamp_len += snprintf(
+		stamp + stamp_len, sizeof(stamp) - stamp_len, ".%06ldZ ",
+		now.tv_nsec / 1000
+	);
+
+	while(len > 0)
+	{
+		if(*line_start) { write_log_ring(ring, stamp, stamp_len); }
+
+		const char* newline = memchr(buf, '\n', len);
+		size_t line_len = newline != NULL ? (size_t)(newline - buf) + 1 : len;
+		write_log_ring(ring, buf, line_len);
+
+		*line_start = newline != NULL;
+		buf += line_len;
+		len -= line_len;
+	}
+}
+
+// Copies what was written after *pos, at most size bytes.
+// Returns the number of bytes copied, *lost is what was overwritten before it
+// could be copied.
+static HAKO_UNUSED size_t
+read_log_ring(
+	const struct log_ring_s* ring,
+	uint64_t* pos,
+	char* buf,
+	size_t size,
+	uint64_t* lost
+)
+{
+	const struct log_header_s* header = ring->header;
+	uint64_t ring_size = header->size;
+	*lost = 0;
+
+	for(;;)
+	{
+		uint64_t end = __atomic_load_n(&header->written, __ATOMIC_ACQUIRE);
+		uint64_t start = *pos;
+		if(end > ring_size && start < end - ring_size)
+		{
+			*lost += end - ring_size - start;
+			start = end - ring_size;
+		}
+		if(end - start > size) { end = start + size; }
+
+		copy_log_ring(ring, buf, start, end);
+
+		// Retry if the writer went over the start meanwhile
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		uint64_t writing = __atomic_load_n(&header->writing, __ATOMIC_RELAXED);
+		if(writing <= ring_size || start >= writing - ring_size)
+		{
+			*pos = end;
+			return end - start;
+		}
+
+		*lost += writing - ring_size - start;
+		*pos = writing - ring_size;
+	}
+}
+
+#endif
@@ -0,0 +1,183 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+#define OPTPARSE_IMPLEMENTATION
+#define OPTPARSE_API static __attribute__((unused))
+#include "optparse.h"
+#define OPTPARSE_HELP_IMPLEMENTATION
+#define OPTPARSE_HELP_API static
+#include "optparse-help.h"
+#include "hako-common.h"
+#include "hako-log.h"
+
+#define PROG_NAME "hako-logs"
+#define quit(code) exit_code = code; goto quit;
+
+// How often a followed log is checked for new lines
+#define FOLLOW_INTERVAL_MS 100
+
+static void
+print_log_stats(const char* stream, const struct log_ring_s* ring)
+{
+	const struct log_header_s* header = ring->header;
+	uint64_t written = __atomic_load_n(&header->written, __ATOMIC_ACQUIRE);
+	printf(
+		"%s: %" PRIu64 " bytes written, %" PRIu64 " kept, %" PRIu64
+		" lines dropped%s\n",
+		stream, written, written < header->size ? written : header->size,
+		header->dropped_lines, header->closed ? ", closed" : ""
+	);
+}
+
+int
+main(int argc, char* argv[])
+{
+	(void)argc;
+
+	int exit_code = EXIT_SUCCESS;
+	char* buf = NULL;
+	struct log_ring_s ring = { 0 };
+
+	struct optparse_long opts[] = {
+		{"help", 'h', OPTPARSE_NONE},
+		{"follow", 'f', OPTPARSE_NONE},
+		{"stream", 's', OPTPARSE_REQUIRED},
+		{"stats", 'S', OPTPARSE_NONE},
+		{0}
+	};
+
+	const char* help[] = {
+		NULL, "Print this message",
+		NULL, "Keep printing new lines until the sandbox exits",
+		"NAME", "Stream to print: stdout or stderr (default: stdout)",
+		NULL, "Print the counters of the log instead of its content",
+	};
+
+	const char* usage = "Usage: " PROG_NAME " [options] <dir>";
+
+	int option;
+	bool follow = false;
+	bool stats = false;
+	const char* stream = "stdout";
+	struct optparse options;
+	optparse_init(&options, argv);
+
+	while((option = optparse_long(&options, opts, NULL)) != -1)
+	{
+		switch(option)
+		{
+			case 'h':
+				optparse_help(usage, opts, help);
+				quit(EXIT_SUCCESS);
+				break;
+			case 'f':
+				follow = true;
+				break;
+			case 's':
+				stream = options.optarg;
+				break;
+			case 'S':
+				stats = true;
+				break;
+			case '?':
+				fprintf(stderr, PROG_NAME ": %s\n", options.errmsg);
+				quit(EXIT_FAILURE);
+				break;
+			default:
+				fprintf(stderr, "Unimplemented option\n");
+				quit(EXIT_FAILURE);
+				break;
+		}
+	}
+
+	if(strcmp(stream, "stdout") != 0 && strcmp(stream, "stderr") != 0)
+	{
+		fprintf(stderr, PROG_NAME ": invalid stream: %s\n", stream);
+		quit(EXIT_FAILURE);
+	}
+
+	const char* log_dir = optparse_arg(&options);
+	if(log_dir == NULL)
+	{
+		fprintf(stderr, PROG_NAME ": must provide log dir\n");
+		quit(EXIT_FAILURE);
+	}
+
+	char path[PATH_MAX];
+	if(snprintf(path, sizeof(path), "%s/%s", log_dir, stream) >= (int)sizeof(path))
+	{
+		fprintf(stderr, PROG_NAME ": path is too long\n");
+		quit(EXIT_FAILURE);
+	}
+
+	if(!open_log_ring(&ring, path)) { quit(EXIT_FAILURE); }
+
+	if(stats)
+	{
+		print_log_stats(stream, &ring);
+		quit(EXIT_SUCCESS);
+	}
+
+	buf = malloc(LOG_CHUNK);
+	if(buf == NULL)
+	{
+		perror("Could not allocate buffer");
+		quit(EXIT_FAILURE);
+	}
+
+	// The oldest line is cut once the ring is full
+	uint64_t pos = 0;
+	bool skip_line = false;
+	bool started = false;
+	for(;;)
+	{
+		bool closed = __atomic_load_n(&ring.header->closed, __ATOMIC_ACQUIRE);
+		uint64_t lost;
+		size_t len = read_log_ring(&ring, &pos, buf, LOG_CHUNK, &lost);
+		if(lost > 0)
+		{
+			if(started)
+			{
+				fprintf(
+					stderr, PROG_NAME ": %" PRIu64 " bytes were overwritten\n", lost
+				);
+			}
+			skip_line = true;
+		}
+		started = true;
+
+		const char* data = buf;
+		if(skip_line && len > 0)
+		{
+			const char* newline = memchr(buf, '\n', len);
+			skip_line = newline == NULL;
+			data = newline != NULL ? newline + 1 : buf + len;
+		}
+
+		fwrite(data, 1, len - (data - buf), stdout);
+		if(len > 0) { continue; }
+
+		if(!follow || closed) { break; }
+
+		fflush(stdout);
+		struct timespec interval = { 0, FOLLOW_INTERVAL_MS * 1000000L };
+		nanosleep(&interval, NULL);
+	}
+
+	if(fflush(stdout) != 0)
+	{
+		perror("Could not write log");
+		quit(EXIT_FAILURE);
+	}
+
+quit:
+	cleanup_log_ring(&ring);
+	free(buf);
+
+	return exit_code;
+}
@@ -0,0 +1,222 @@
+#ifndef HAKO_NETLINK_H
+#define HAKO_NETLINK_H
+
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <linux/veth.h>
+#include "hako-common.h"
+
+// Network setup of a new namespace over rtnetlink, without iproute2.
+// Each request waits for its acknowledgement, errors are returned in errno.
+
+// Fits every request built here
+#define NL_MSG_SIZE 512
+#define LOOPBACK_INDEX 1 // in every network namespace
+#define SANDBOX_IF "eth0"
+
+struct nl_msg_s
+{
+	struct nlmsghdr hdr;
+	char data[NL_MSG_SIZE];
+};
+
+// With --veth HOSTIF:ADDR/PREFIX[:GW], IPv4 only
+struct veth_s
+{
+	char host_if[IFNAMSIZ];
+	struct in_addr addr;
+	unsigned char prefix;
+	bool has_gateway;
+	struct in_addr gateway;
+};
+
+static HAKO_UNUSED bool
+parse_veth(const char* str, struct veth_s* veth)
+{
+	*veth = (struct veth_s){ 0 };
+
+	const char* addr = strchr(str, ':');
+	if(addr == NULL || addr == str || (size_t)(addr - str) >= IFNAMSIZ)
+	{
+		return false;
+	}
+	memcpy(veth->host_if, str, addr - str);
+	++addr;
+
+	const char* prefix = strchr(addr, '/');
+	if(prefix == NULL) { return false; }
+	const char* gateway = strchr(prefix, ':');
+
+	char buf[INET_ADDRSTRLEN];
+	if((size_t)(prefix - addr) >= sizeof(buf)) { return false; }
+	memcpy(buf, addr, prefix - addr);
+	buf[prefix - addr] = '\0';
+	if(inet_pton(AF_INET, buf, &veth->addr) != 1) { return false; }
+
+	char* end;
+	errno = 0;
+	long prefix_len = strtol(prefix + 1, &end, 10);
+	if(errno != 0 || end == prefix + 1 || prefix_len < 0 || prefix_len > 32
+		|| (gateway != NULL ? end != gateway : *end != '\0'))
+	{
+		return false;
+	}
+	veth->prefix = prefix_len;
+
+	veth->has_gateway = gateway != NULL;
+	return !veth->has_gateway
+		|| inet_pton(AF_INET, gateway + 1, &veth->gateway) == 1;
+}
+
+static HAKO_UNUSED void
+init_nl_msg(
+	struct nl_msg_s* msg, int type, int flags, const void* payload, size_t len
+)
+{
+	memset(msg, 0, sizeof(*msg));
+	msg->hdr.nlmsg_type = type;
+	msg->hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+	msg->hdr.nlmsg_len = NLMSG_LENGTH(len);
+	memcpy(NLMSG_DATA(&msg->hdr), payload, len);
+}
+
+// Returns the attribute so that others can be nested in it
+static HAKO_UNUSED struct rtattr*
+add_nl_attr(struct nl_msg_s* msg, int type, const void* value, size_t len)
+{
+	struct rtattr* attr = (struct rtattr*)(
+		(char*)msg + NLMSG_ALIGN(msg->hdr.nlmsg_len)
+	);
+	attr->rta_type = type;
+	attr->rta_len = RTA_LENGTH(len);
+	if(len > 0) { memcpy(RTA_DATA(attr), value, len); }
+
+	msg->hdr.nlmsg_len = NLMSG_ALIGN(msg->hdr.nlmsg_len) + RTA_ALIGN(attr->rta_len);
+	return attr;
+}
+
+static HAKO_UNUSED void
+end_nl_nest(struct nl_msg_s* msg, struct rtattr* nest)
+{
+	nest->rta_len = (char*)msg + msg->hdr.nlmsg_len - (char*)nest;
+}
+
+static HAKO_UNUSED bool
+send_nl_msg(int fd, struct nl_msg_s* msg)
+{
+	static uint32_t seq;
+	msg->hdr.nlmsg_seq = ++seq;
+	if(send(fd, msg, msg->hdr.nlmsg_len, 0) == -1) { return false; }
+
+	// The acknowledgement quotes the header of the request
+	union
+	{
+		struct nlmsghdr hdr;
+		char buf[NLMSG_SPACE(sizeof(struct nlmsgerr)) + NL_MSG_SIZE];
+	} reply;
+	ssize_t len;
+	while((len = recv(fd, &reply, sizeof(reply), 0)) == -1 && errno == EINTR) { }
+	if(len == -1) { return false; }
+
+	if(!NLMSG_OK(&reply.hdr, (size_t)len) || reply.hdr.nlmsg_type != NLMSG_ERROR)
+	{
+		errno = EPROTO;
+		return false;
+	}
+
+	const struct nlmsgerr* error = NLMSG_DATA(&reply.hdr);
+	errno = -error->error;
+	return error->error == 0;
+}
+
+static HAKO_UNUSED int
+open_netlink(void)
+{
+	return socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+}
+
+// By index, or by name when index is 0
+static HAKO_UNUSED bool
+set_link_up(int fd, int index, const char* name)
+{
+	struct ifinfomsg info = {
+		.ifi_family = AF_UNSPEC,
+		.ifi_index = index,
+		.ifi_flags = IFF_UP,
+		.ifi_change = IFF_UP
+	};
+	struct nl_msg_s msg;
+	init_nl_msg(&msg, RTM_NEWLINK, 0, &info, sizeof(info));
+	if(name != NULL) { add_nl_attr(&msg, IFLA_IFNAME, name, strlen(name) + 1); }
+
+	return send_nl_msg(fd, &msg);
+}
+
+// The peer goes straight to the namespace of peer_netns_fd
+static HAKO_UNUSED bool
+create_veth(int fd, const char* name, const char* peer_name, int peer_netns_fd)
+{
+	struct ifinfomsg info = { .ifi_family = AF_UNSPEC };
+	struct nl_msg_s msg;
+	init_nl_msg(
+		&msg, RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL, &info, sizeof(info)
+	);
+	add_nl_attr(&msg, IFLA_IFNAME, name, strlen(name) + 1);
+
+	struct rtattr* link_info = add_nl_attr(&msg, IFLA_LINKINFO, NULL, 0);
+	add_nl_attr(&msg, IFLA_INFO_KIND, "veth", strlen("veth"));
+	struct rtattr* data = add_nl_attr(&msg, IFLA_INFO_DATA, NULL, 0);
+	struct rtattr* peer = add_nl_attr(&msg, VETH_INFO_PEER, &info, sizeof(info));
+	add_nl_attr(&msg, IFLA_IFNAME, peer_name, strlen(peer_name) + 1);
+	uint32_t netns_fd = peer_netns_fd;
+	add_nl_attr(&msg, IFLA_NET_NS_FD, &netns_fd, sizeof(netns_fd));
+	end_nl_nest(&msg, peer);
+	end_nl_nest(&msg, data);
+	end_nl_nest(&msg, link_info);
+
+	return send_nl_msg(fd, &msg);
+}
+
+static HAKO_UNUSED bool
+add_ipv4_address(int fd, int index, struct in_addr addr, unsigned char prefix)
+{
+	struct ifaddrmsg info = {
+		.ifa_family = AF_INET,
+		.ifa_prefixlen = prefix,
+		.ifa_scope = RT_SCOPE_UNIVERSE,
+		.ifa_index = index
+	};
+	struct nl_msg_s msg;
+	init_nl_msg(
+		&msg, RTM_NEWADDR, NLM_F_CREATE | NLM_F_EXCL, &info, sizeof(info)
+	);
+	add_nl_attr(&msg, IFA_LOCAL, &addr, sizeof(addr));
+	add_nl_attr(&msg, IFA_ADDRESS, &addr, sizeof(addr));
+
+	return send_nl_msg(fd, &msg);
+}
+
+static HAKO_UNUSED bool
+add_default_route(int fd, struct in_addr gateway)
+{
+	struct rtmsg info = {
+		.rtm_family = AF_INET,
+		.rtm_table = RT_TABLE_MAIN,
+		.rtm_protocol = RTPROT_BOOT,
+		.rtm_scope = RT_SCOPE_UNIVERSE,
+		.rtm_type = RTN_UNICAST
+	};
+	struct nl_msg_s msg;
+	init_nl_msg(
+		&msg, RTM_NEWROUTE, NLM_F_CREATE | NLM_F_EXCL, &info, sizeof(info)
+	);
+	add_nl_attr(&msg, RTA_GATEWAY, &gateway, sizeof(gateway));
+
+	return send_nl_msg(fd, &msg);
+}
+
+#endif
@@ -0,0 +1,347 @@
+#ifndef HAKO_PTY_H
+#define HAKO_PTY_H
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include "hako-common.h"
+
+// With --pty, the command gets the slave side of a new pseudo-terminal as its
+// controlling tty while the supervisor relays it to its own stdio.
+// Each direction goes through a pipe with splice() so that the data is never
+// copied to userspace, files which cannot splice fall back to read/write.
+
+// Fits in the default pipe capacity
+#define PTY_CHUNK 65536
+#define PTY_BUF_SIZE 4096 // without splice
+#define PTY_NUM_POLLFDS 2
+#define PTY_MAX_OTHER_FDS 4
+// Output left once the command exits comes right away
+#define PTY_DRAIN_MS 100
+
+struct pty_stream_s
+{
+	int in;
+	int out;
+	int pipe[2];
+	size_t pending; // bytes in the pipe or in buf
+	bool eof;
+	// Taken from the pipe without splice, until out has room for it
+	char buf[PTY_BUF_SIZE];
+	size_t buf_start;
+	size_t buf_len;
+};
+
+struct pty_s
+{
+	int master;
+	int slave; // until the command has it
+	bool raw; // stdin must be restored to termios
+	struct termios termios;
+	struct pty_stream_s input;
+	struct pty_stream_s output;
+};
+
+static HAKO_UNUSED bool
+open_pty(struct pty_s* pty)
+{
+	*pty = (struct pty_s){
+		.master = -1,
+		.slave = -1,
+		.input = { .in = STDIN_FILENO, .pipe = { -1, -1 } },
+		.output = { .out = STDOUT_FILENO, .pipe = { -1, -1 } }
+	};
+
+	pty->master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if(pty->master == -1 || unlockpt(pty->master) == -1)
+	{
+		perror("Could not allocate pty");
+		return false;
+	}
+
+	// Unlike its path, the peer does not have to be visible in the sandbox
+	pty->slave = ioctl(pty->master, TIOCGPTPEER, O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if(pty->slave == -1)
+	{
+		perror("Could not open pty");
+		return false;
+	}
+
+	// The command starts with the caller's terminal settings
+	struct termios termios;
+	struct winsize size;
+	if(tcgetattr(STDIN_FILENO, &termios) == 0)
+	{
+		tcsetattr(pty->slave, TCSANOW, &termios);
+	}
+	if(ioctl(STDIN_FILENO, TIOCGWINSZ, &size) == 0)
+	{
+		ioctl(pty->slave, TIOCSWINSZ, &size);
+	}
+
+	pty->input.out = pty->master;
+	pty->output.in = pty->master;
+	if(fcntl(pty->master, F_SETFL, O_NONBLOCK) == -1
+		|| pipe2(pty->input.pipe, O_CLOEXEC | O_NONBLOCK) == -1
+		|| pipe2(pty->output.pipe, O_CLOEXEC | O_NONBLOCK) == -1)
+	{
+		perror("Could not set up pty relay");
+		return false;
+	}
+
+	return true;
+}
+
+// In the command's process, right before exec
+static HAKO_UNUSED bool
+attach_pty(int slave)
+{
+	if(setsid() == -1 || ioctl(slave, TIOCSCTTY, 0) == -1)
+	{
+		perror("Could not set controlling tty");
+		return false;
+	}
+
+	for(int fd = STDIN_FILENO; fd <= STDERR_FILENO; ++fd)
+	{
+		if(dup2(slave, fd) == -1)
+		{
+			perror("dup2() failed");
+			return false;
+		}
+	}
+
+	close(slave);
+	return true;
+}
+
+// Once the command has the slave side
+static HAKO_UNUSED void
+start_pty_relay(struct pty_s* pty)
+{
+	close(pty->slave);
+	pty->slave = -1;
+
+	// Keys go to the command as typed, its own tty handles them
+	if(tcgetattr(STDIN_FILENO, &pty->termios) == 0)
+	{
+		struct termios raw = pty->termios;
+		cfmakeraw(&raw);
+		pty->raw = tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0;
+	}
+}
+
+static HAKO_UNUSED void
+resize_pty(const struct pty_s* pty)
+{
+	struct winsize size;
+	if(ioctl(STDIN_FILENO, TIOCGWINSZ, &size) == 0)
+	{
+		ioctl(pty->master, TIOCSWINSZ, &size);
+	}
+}
+
+// Into the pipe, which is empty so that a write never comes up short
+static HAKO_UNUSED ssize_t
+pty_fill(struct pty_stream_s* stream)
+{
+	ssize_t result = splice(
+		stream->in, NULL, stream->pipe[1], NULL, PTY_CHUNK,
+		SPLICE_F_MOVE | SPLICE_F_NONBLOCK
+	);
+	if(result >= 0 || errno != EINVAL) { return result; }
+
+	char buf[PTY_BUF_SIZE];
+	result = read(stream->in, buf, sizeof(buf));
+	if(result <= 0) { return result; }
+
+	return write(stream->pipe[1], buf, result);
+}
+
+// Out of the pipe, returns the number of bytes written
+static HAKO_UNUSED ssize_t
+pty_flush(struct pty_stream_s* stream)
+{
+	if(stream->buf_len == 0)
+	{
+		ssize_t result = splice(
+			stream->pipe[0], NULL, stream->out, NULL, stream->pending,
+			SPLICE_F_MOVE | SPLICE_F_NONBLOCK
+		);
+		if(result >= 0 || errno != EINVAL) { return result; }
+
+		size_t len = stream->pending < sizeof(stream->buf) ?
+			stream->pending : sizeof(stream->buf);
+		result = read(stream->pipe[0], stream->buf, len);
+		if(result <= 0) { return result; }
+
+		stream->buf_start = 0;
+		stream->buf_len = result;
+	}
+
+	ssize_t written = write(
+		stream->out, stream->buf + stream->buf_start, stream->buf_len
+	);
+	if(written > 0)
+	{
+		stream->buf_start += written;
+		stream->buf_len -= written;
+	}
+
+	return written;
+}
+
+static HAKO_UNUSED void
+relay_pty_stream(struct pty_stream_s* stream, short revents)
+{
+	if(stream->eof) { return; }
+
+	if(stream->pending == 0 && (revents & (POLLIN | POLLHUP | POLLERR)))
+	{
+		ssize_t len = pty_fill(stream);
+		if(len > 0) { stream->pending = len; }
+		// The master reports EIO once the command and its children are gone
+		else if(len == 0 || errno == EIO) { stream->eof = true; }
+		else if(errno != EAGAIN && errno != EINTR)
+		{
+			perror("Could not read pty");
+			stream->eof = true;
+		}
+	}
+
+	// Most of the time, the other side takes it right away
+	while(stream->pending > 0)
+	{
+		ssize_t len = pty_flush(stream);
+		if(len == -1 && (errno == EAGAIN || errno == EINTR)) { break; }
+		if(len <= 0)
+		{
+			perror("Could not write pty");
+			stream->eof = true;
+			break;
+		}
+
+		stream->pending -= len;
+	}
+}
+
+// Waits for input when the pipe is empty and for room otherwise
+static HAKO_UNUSED void
+pty_stream_pollfd(const struct pty_stream_s* stream, struct pollfd* fd)
+{
+	fd->fd = stream->eof ? -1 : stream->pending > 0 ? stream->out : stream->in;
+	fd->events = stream->pending > 0 ? POLLOUT : POLLIN;
+	fd->revents = 0;
+}
+
+static HAKO_UNUSED void
+relay_pty(struct pty_s* pty, const struct pollfd* fds)
+{
+	relay_pty_stream(&pty->output, fds[1].revents);
+
+	if(pty->input.eof) { return; }
+
+	relay_pty_stream(&pty->input, fds[0].revents);
+
+	// End of input is typed like in a terminal
+	struct termios termios;
+	if(pty->input.eof && tcgetattr(pty->master, &termios) == 0)
+	{
+		write(pty->master, &termios.c_cc[VEOF], 1);
+	}
+}
+
+// Relays the pty, if any, until a signal other than SIGWINCH comes or one of
+// the other fds is ready.
+// Returns the signal, 0 for the other fds and -1 on error.
+static HAKO_UNUSED int
+wait_pty_signal(
+	int signal_fd, struct pty_s* pty, struct pollfd* other_fds, nfds_t num_other
+)
+{
+	for(;;)
+	{
+		struct pollfd fds[1 + PTY_NUM_POLLFDS + PTY_MAX_OTHER_FDS] = {
+			{ .fd = signal_fd, .events = POLLIN }
+		};
+		nfds_t nfds = 1;
+		if(pty != NULL)
+		{
+			pty_stream_pollfd(&pty->input, &fds[1]);
+			pty_stream_pollfd(&pty->output, &fds[2]);
+			nfds += PTY_NUM_POLLFDS;
+		}
+		if(num_other > 0)
+		{
+			memcpy(&fds[nfds], other_fds, num_other * sizeof(struct pollfd));
+		}
+
+		if(poll(fds, nfds + num_other, -1) == -1)
+		{
+			if(errno == EINTR) { continue; }
+
+			perror("poll() failed");
+			return -1;
+		}
+
+		if(pty != NULL) { relay_pty(pty, &fds[1]); }
+
+		bool other_ready = false;
+		for(nfds_t i = 0; i < num_other; ++i)
+		{
+			other_fds[i].revents = fds[nfds + i].revents;
+			other_ready |= other_fds[i].revents != 0;
+		}
+
+		struct signalfd_siginfo info;
+		if(!(fds[0].revents & POLLIN)
+			|| read(signal_fd, &info, sizeof(info)) != sizeof(info))
+		{
+			if(other_ready) { return 0; }
+			continue;
+		}
+
+		if(info.ssi_signo != SIGWINCH) { return info.ssi_signo; }
+		if(pty != NULL) { resize_pty(pty); }
+		if(other_ready) { return 0; }
+	}
+}
+
+// Relays what the command wrote before exiting
+static HAKO_UNUSED void
+drain_pty(struct pty_s* pty)
+{
+	struct pollfd fd;
+	while(!pty->output.eof)
+	{
+		pty_stream_pollfd(&pty->output, &fd);
+		int ready = poll(&fd, 1, PTY_DRAIN_MS);
+		if(ready == 0 || (ready == -1 && errno != EINTR)) { break; }
+
+		relay_pty_stream(&pty->output, fd.revents);
+	}
+}
+
+static HAKO_UNUSED void
+cleanup_pty(struct pty_s* pty)
+{
+	if(pty->master < 0) { return; }
+
+	if(pty->raw) { tcsetattr(STDIN_FILENO, TCSADRAIN, &pty->termios); }
+
+	close(pty->master);
+	if(pty->slave >= 0) { close(pty->slave); }
+	const struct pty_stream_s* streams[] = { &pty->input, &pty->output };
+	for(int i = 0; i < 2; ++i)
+	{
+		if(streams[i]->pipe[0] >= 0) { close(streams[i]->pipe[0]); }
+		if(streams[i]->pipe[1] >= 0) { close(streams[i]->pipe[1]); }
+	}
+
+	pty->master = -1;
+}
+
+#endif
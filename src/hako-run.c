@@ -1,15 +1,38 @@
 #define _GNU_SOURCE
 #include <inttypes.h>
+#include <stdarg.h>
 #include <ctype.h>
 #include <signal.h>
 #include <errno.h>
 #include <alloca.h>
 #include <fcntl.h>
 #include <sched.h>
+#include <limits.h>
+#include <libgen.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/file.h>
+#include <sys/sysmacros.h>
 #include <sys/wait.h>
 #include <sys/mount.h>
+#include <sys/vfs.h>
 #include <sys/syscall.h>
+#ifndef OPEN_TREE_CLONE // not provided by older libc
+#include <linux/mount.h>
+#endif
+#include <linux/openat2.h>
+#include <linux/loop.h>
+#include <linux/sched.h>
+#include <linux/mempolicy.h>
+#include <linux/magic.h>
+#include <dirent.h>
+#ifndef __NR_pidfd_open // not provided by older libc
+#define __NR_pidfd_open 434 // same on every architecture
+#endif
+#include <sys/signalfd.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <netdb.h>
 #define OPTPARSE_IMPLEMENTATION
 #define OPTPARSE_API static __attribute__((unused))
 #include "optparse.h"
@@ -17,252 +40,4946 @@
 #define OPTPARSE_HELP_API static
 #include "optparse-help.h"
 #include "hako-common.h"
+#include "hako-ipc.h"
+#include "hako-trace.h"
+#include "hako-seccomp.h"
+#include "hako-pty.h"
+#include "hako-log.h"
+#include "hako-stats.h"
+#include "hako-netlink.h"
 
 #define HAKO_DIR ".hako"
+#define HAKO_SHM_DIR "/run/hako/shm"
+#define MAX_SHM_REGIONS 8
+#define NOTIFY_MSG_SIZE 4096
+#define MAX_LISTEN_FDS 16
+#define LISTEN_FDS_START 3 // as in sd_listen_fds()
+#define LISTEN_PID_SIZE 21
+#define MAX_WARM_FAILURES 3 // in a row, before a zygote gives up
 #define PROG_NAME "hako-run"
 #define quit(code) exit_code = code; goto quit;
 
+enum mount_type_e
+{
+	MOUNT_BIND,
+	MOUNT_FS,
+	MOUNT_DEV,
+	MOUNT_HOSTNAME
+};
+
+struct mount_entry_s
+{
+	enum mount_type_e type;
+	const char* fs_type;
+	char* src;
+	char* dest;
+	char* data;
+	uint64_t attr;
+};
+
+struct mount_manifest_s
+{
+	bool found;
+	unsigned int num_entries;
+	struct mount_entry_s* entries;
+};
+
+struct sandbox_tree_s
+{
+	int fd;
+	const char* mountpoint; // NULL when the tree must stay detached
+	bool attached;
+};
+
+struct placement_s
+{
+	bool auto_cpus; // one CPU per sandbox, picked from cpus
+	bool auto_node; // one NUMA node per sandbox
+	bool has_cpus;
+	cpu_set_t cpus;
+	int node; // -1 for none
+	int mempolicy; // -1 to keep the default one
+	unsigned long nodemask; // nodes of the memory policy
+};
+
+struct shm_region_s
+{
+	const char* name;
+	const char* size; // as given to the filesystem
+	bool hugepages;
+};
+
+// Either an address to listen on or a socket given with --pass-fd
+struct listener_s
+{
+	const char* addr;
+	int pass_fd;
+};
+
 struct sandbox_cfg_s
 {
 	const char* sandbox_dir;
+	const char* root_dir; // content of the root, differs from sandbox_dir for images
 	const char* netns;
 	int netns_flag;
-	struct bindmnt_s* mounts;
+	const char* ipcns;
+	int ipcns_flag;
+	bool net_lo; // bring the loopback up
+	const struct veth_s* veth; // NULL for none
+	int host_netns_fd; // where the host side of the veth goes, -1 for none
+	int host_netlink_fd; // in the host network namespace, -1 for none
+	const struct shm_region_s* shm_regions;
+	unsigned int num_shm_regions;
+	const int* from_fds; // namespaces of a persisted sandbox, NULL for none
+	struct mount_manifest_s manifest;
+	bool has_init;
 	bool writable;
+	const char* overlay; // upper directory, empty for a tmpfs
+	int tree_fd;
+	int zygote_fd;
+	int cgroup_fd;
+	int* stdio; // NULL to inherit
+	int pty_slave; // -1 without --pty
+	bool builtin_init; // pid 1 stays to reap orphans and forward signals
+	bool pause; // pid 1 runs no command
+	int sync_fd; // gets a byte once set up, closed when the command is started
+	int notify_fd; // bound to notify_path in the sandbox, -1 for none
+	const char* notify_path;
+	const int* listen_fds;
+	unsigned int num_listen_fds;
+	char* listen_pid_env; // completed by the command with its own pid
+	bool join_cgroup; // when it could not be created inside the cgroup
+	struct placement_s placement;
+	struct trace_s trace;
+	uint64_t clone_start;
 	struct run_ctx_s run_ctx;
 };
 
-static int
-sandbox_entry(void* arg)
-{
-	int exit_code = EXIT_SUCCESS;
+struct zygote_child_s
+{
+	pid_t pid;
+	int fd;
+	bool ready;
+};
+
+struct zygote_s
+{
+	struct sandbox_cfg_s* sandbox_cfg;
+	int tree_fd;
+	char* buf;
+	unsigned int pool_size;
+	unsigned int num_warm;
+	struct zygote_child_s* warm;
+	unsigned int warm_failures; // sandboxes which died during setup in a row
+	unsigned int num_clients;
+	unsigned int client_capacity;
+	struct zygote_child_s* clients; // pid is 0 until a request is dispatched
+};
+
+struct cgroup_limit_s
+{
+	const char* file;
+	const char* controller;
+	const char* value;
+};
+
+struct agent_client_s
+{
+	pid_t pid;
+	int fd;
+};
+
+struct agent_s
+{
+	const struct run_ctx_s* defaults;
+	char* buf;
+	unsigned int num_clients;
+	unsigned int client_capacity;
+	struct agent_client_s* clients; // pid is 0 until a command is started
+};
+
+// Jobs usually share their sandbox with the previous one
+struct sandbox_cache_s
+{
+	char* sandbox_dir;
+	struct mount_manifest_s manifest;
+	bool has_init;
+};
+
+struct batch_job_s
+{
+	pid_t pid; // 0 when the slot is free
+	int pidfd;
+	unsigned int line;
+	uint64_t start;
+};
+
+struct batch_s
+{
+	const struct sandbox_cfg_s* defaults;
+	FILE* file;
+	bool eof;
+	char* line_buf;
+	size_t line_size;
+	unsigned int line;
+	struct sandbox_cache_s cache;
+	int stats_fd; // -1 without --stats
+	unsigned int num_jobs;
+	unsigned int num_failed;
+	unsigned int num_finished;
+	uint64_t min_time;
+	uint64_t max_time;
+	uint64_t total_time;
+};
+
+enum daemon_watch_e
+{
+	WATCH_LISTENER,
+	WATCH_SIGNAL,
+	WATCH_CLIENT,
+	WATCH_SANDBOX
+};
+
+struct daemon_sandbox_s
+{
+	enum daemon_watch_e watch; // first so that epoll events can point to it
+	pid_t pid;
+	int pidfd; // -1 once exited
+	int exit_code;
+	char name[HAKO_MAX_NAME];
+	struct daemon_sandbox_s* next;
+};
+
+struct daemon_client_s
+{
+	enum daemon_watch_e watch;
+	int fd;
+	struct daemon_sandbox_s* waiting;
+	struct daemon_client_s* next;
+};
+
+struct daemon_s
+{
+	const struct sandbox_cfg_s* defaults;
+	struct sandbox_cache_s cache;
+	unsigned int num_started; // for automatic placement
+	int epoll_fd;
+	char* buf;
+	struct daemon_sandbox_s* sandboxes;
+	struct daemon_client_s* clients;
+};
+
+struct log_stream_s
+{
+	int fd; // read end of the command's pipe, -1 once closed
+	bool line_start;
+	struct log_ring_s ring;
+};
+
+// Namespaces saved by --persist, in the order --from joins them: the mount
+// namespace last since it changes what paths refer to
+static const struct
+{
+	const char* name;
+	int type;
+} persist_namespaces[] = {
+	{ "net", CLONE_NEWNET },
+	{ "ipc", CLONE_NEWIPC },
+	{ "uts", CLONE_NEWUTS },
+	{ "mnt", CLONE_NEWNS },
+};
+
+#define NUM_PERSIST_NS (sizeof(persist_namespaces) / sizeof(persist_namespaces[0]))
+
+struct dev_node_s
+{
+	const char* name;
+	unsigned int major;
+	unsigned int minor;
+};
+
+static const struct dev_node_s dev_nodes[] = {
+	{ "null", 1, 3 },
+	{ "zero", 1, 5 },
+	{ "full", 1, 7 },
+	{ "random", 1, 8 },
+	{ "urandom", 1, 9 },
+	{ "tty", 5, 0 },
+};
+
+// Attributes forced on the whole sandbox unless it is writable
+#define PROTECT_ATTR (MOUNT_ATTR_RDONLY | MOUNT_ATTR_NOSUID | MOUNT_ATTR_NODEV)
+
+static int
+sys_open_tree(int dirfd, const char* path, unsigned int flags)
+{
+	return (int)syscall(__NR_open_tree, dirfd, path, flags);
+}
+
+static int
+sys_move_mount(
+	int from_dirfd, const char* from_path,
+	int to_dirfd, const char* to_path,
+	unsigned int flags
+)
+{
+	return (int)syscall(
+		__NR_move_mount, from_dirfd, from_path, to_dirfd, to_path, flags
+	);
+}
+
+static int
+sys_fsopen(const char* fs_name, unsigned int flags)
+{
+	return (int)syscall(__NR_fsopen, fs_name, flags);
+}
+
+static int
+sys_fsconfig(
+	int fd, unsigned int cmd, const char* key, const void* value, int aux
+)
+{
+	return (int)syscall(__NR_fsconfig, fd, cmd, key, value, aux);
+}
+
+static int
+sys_fsmount(int fd, unsigned int flags, unsigned int attr_flags)
+{
+	return (int)syscall(__NR_fsmount, fd, flags, attr_flags);
+}
+
+static int
+sys_mount_setattr(
+	int dirfd, const char* path, unsigned int flags, uint64_t set, uint64_t clr
+)
+{
+	struct mount_attr attr = { .attr_set = set, .attr_clr = clr };
+	return (int)syscall(
+		__NR_mount_setattr, dirfd, path, flags, &attr, sizeof(attr)
+	);
+}
+
+static void
+parse_mount_flags(char* options, uint64_t* attr, char** data)
+{
+	// Split options into mount attributes and filesystem parameters
+	char* out = options;
+	char* saveptr;
+	for(char* opt = strtok_r(options, ",", &saveptr);
+		opt != NULL;
+		opt = strtok_r(NULL, ",", &saveptr))
+	{
+		if(strcmp(opt, "ro") == 0) { *attr |= MOUNT_ATTR_RDONLY; }
+		else if(strcmp(opt, "rw") == 0) { *attr &= ~MOUNT_ATTR_RDONLY; }
+		else if(strcmp(opt, "nosuid") == 0) { *attr |= MOUNT_ATTR_NOSUID; }
+		else if(strcmp(opt, "suid") == 0) { *attr &= ~MOUNT_ATTR_NOSUID; }
+		else if(strcmp(opt, "nodev") == 0) { *attr |= MOUNT_ATTR_NODEV; }
+		else if(strcmp(opt, "dev") == 0) { *attr &= ~MOUNT_ATTR_NODEV; }
+		else if(strcmp(opt, "noexec") == 0) { *attr |= MOUNT_ATTR_NOEXEC; }
+		else if(strcmp(opt, "exec") == 0) { *attr &= ~MOUNT_ATTR_NOEXEC; }
+		else
+		{
+			size_t len = strlen(opt);
+			if(out != options) { *out++ = ','; }
+			memmove(out, opt, len);
+			out += len;
+		}
+	}
+
+	*out = '\0';
+	*data = out != options ? options : NULL;
+}
+
+static bool
+parse_mount_entry(struct mount_entry_s* entry, char* argv[], unsigned int argc)
+{
+	const char* type = argv[0];
+	char* options = NULL;
+	*entry = (struct mount_entry_s){
+		.attr = MOUNT_ATTR_NOSUID | MOUNT_ATTR_NODEV
+	};
+
+	if((strcmp(type, "bind") == 0 || strcmp(type, "ro-bind") == 0)
+		&& argc >= 3 && argc <= 4)
+	{
+		entry->type = MOUNT_BIND;
+		entry->src = argv[1];
+		entry->dest = argv[2];
+		options = argc == 4 ? argv[3] : NULL;
+		if(type[0] == 'r') { entry->attr |= MOUNT_ATTR_RDONLY; }
+	}
+	else if((strcmp(type, "tmpfs") == 0 || strcmp(type, "proc") == 0)
+		&& argc >= 2 && argc <= 3)
+	{
+		entry->type = MOUNT_FS;
+		entry->fs_type = type[0] == 't' ? "tmpfs" : "proc";
+		entry->dest = argv[1];
+		options = argc == 3 ? argv[2] : NULL;
+		if(type[0] == 'p') { entry->attr |= MOUNT_ATTR_NOEXEC; }
+	}
+	else if(strcmp(type, "dev") == 0 && argc == 2)
+	{
+		entry->type = MOUNT_DEV;
+		entry->dest = argv[1];
+		entry->attr = MOUNT_ATTR_NOSUID | MOUNT_ATTR_NOEXEC;
+	}
+	else if(strcmp(type, "hostname") == 0 && argc == 2)
+	{
+		entry->type = MOUNT_HOSTNAME;
+		entry->src = argv[1];
+	}
+	else
+	{
+		return false;
+	}
+
+	if(options != NULL) { parse_mount_flags(options, &entry->attr, &entry->data); }
+
+	// Strings point into the current line
+	char** strs[] = { &entry->src, &entry->dest, &entry->data };
+	for(size_t i = 0; i < sizeof(strs) / sizeof(strs[0]); ++i)
+	{
+		if(*strs[i] != NULL && (*strs[i] = strdup(*strs[i])) == NULL)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void
+cleanup_mount_manifest(struct mount_manifest_s* manifest)
+{
+	for(unsigned int i = 0; i < manifest->num_entries; ++i)
+	{
+		free(manifest->entries[i].src);
+		free(manifest->entries[i].dest);
+		free(manifest->entries[i].data);
+	}
+
+	free(manifest->entries);
+	*manifest = (struct mount_manifest_s){ 0 };
+}
+
+static bool
+load_mount_manifest(const char* sandbox_dir, struct mount_manifest_s* manifest)
+{
+	bool exit_code = true;
+	char path[PATH_MAX];
+	char* line = NULL;
+	size_t line_size = 0;
+	unsigned int line_no = 0;
+	unsigned int capacity = 0;
+
+	*manifest = (struct mount_manifest_s){ 0 };
+	snprintf(path, sizeof(path), "%s/" HAKO_DIR "/mounts", sandbox_dir);
+	FILE* file = fopen(path, "r");
+	manifest->found = file != NULL;
+	if(file == NULL)
+	{
+		if(errno == ENOENT) { quit(true); }
+
+		fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+		quit(false);
+	}
+
+	while(getline(&line, &line_size, file) != -1)
+	{
+		++line_no;
+
+		char* argv[5];
+		unsigned int argc = 0;
+		char* saveptr;
+		for(char* token = strtok_r(line, " \t\r\n", &saveptr);
+			token != NULL && token[0] != '#';
+			token = strtok_r(NULL, " \t\r\n", &saveptr))
+		{
+			if(argc == sizeof(argv) / sizeof(argv[0]))
+			{
+				fprintf(stderr, "%s:%u: too many fields\n", path, line_no);
+				quit(false);
+			}
+
+			argv[argc++] = token;
+		}
+
+		if(argc == 0) { continue; }
+
+		if(manifest->num_entries == capacity)
+		{
+			capacity = capacity * 2 + 8;
+			struct mount_entry_s* entries = realloc(
+				manifest->entries, capacity * sizeof(struct mount_entry_s)
+			);
+			if(entries == NULL)
+			{
+				perror("Could not allocate mount entry");
+				quit(false);
+			}
+
+			manifest->entries = entries;
+		}
+
+		struct mount_entry_s* entry = &manifest->entries[manifest->num_entries];
+		if(!parse_mount_entry(entry, argv, argc))
+		{
+			fprintf(stderr, "%s:%u: invalid entry: %s\n", path, line_no, argv[0]);
+			quit(false);
+		}
+
+		++manifest->num_entries;
+	}
+
+	if(ferror(file))
+	{
+		fprintf(stderr, "Could not read %s: %s\n", path, strerror(errno));
+		quit(false);
+	}
+
+quit:
+	free(line);
+	if(file != NULL) { fclose(file); }
+	if(!exit_code) { cleanup_mount_manifest(manifest); }
+
+	return exit_code;
+}
+
+static bool
+attach_tree(struct sandbox_tree_s* tree)
+{
+	if(sys_move_mount(
+		tree->fd, "", AT_FDCWD, tree->mountpoint, MOVE_MOUNT_F_EMPTY_PATH
+	) == -1)
+	{
+		perror("Could not attach sandbox root");
+		return false;
+	}
+
+	tree->attached = true;
+	return true;
+}
+
+static int
+open_in_tree(const struct sandbox_tree_s* tree, const char* path)
+{
+	// Symlinks inside the sandbox must not lead back to the host
+	struct open_how how = {
+		.flags = O_PATH | O_CLOEXEC,
+		.resolve = RESOLVE_IN_ROOT
+	};
+	int fd = (int)syscall(__NR_openat2, tree->fd, path, &how, sizeof(how));
+	if(fd == -1)
+	{
+		fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+	}
+
+	return fd;
+}
+
+static bool
+mount_in_tree(struct sandbox_tree_s* tree, int mount_fd, const char* dest)
+{
+	int dest_fd = open_in_tree(tree, dest);
+	if(dest_fd == -1) { return false; }
+
+	unsigned int flags = MOVE_MOUNT_F_EMPTY_PATH | MOVE_MOUNT_T_EMPTY_PATH;
+	int result = sys_move_mount(mount_fd, "", dest_fd, "", flags);
+
+	// Older kernels can only mount on attached trees
+	if(result == -1 && errno == EINVAL
+		&& !tree->attached && tree->mountpoint != NULL)
+	{
+		if(!attach_tree(tree))
+		{
+			close(dest_fd);
+			return false;
+		}
+
+		result = sys_move_mount(mount_fd, "", dest_fd, "", flags);
+	}
+
+	int error = errno;
+	close(dest_fd);
+	if(result == -1)
+	{
+		fprintf(stderr, "Could not mount on %s: %s\n", dest, strerror(error));
+		return false;
+	}
+
+	return true;
+}
+
+static int
+create_fs_mount(const char* fs_type, const char* data, uint64_t attr)
+{
+	int exit_code = -1;
+	int mount_fd = -1;
+	char* params = NULL;
+
+	int fs_fd = sys_fsopen(fs_type, FSOPEN_CLOEXEC);
+	if(fs_fd == -1)
+	{
+		fprintf(stderr, "Could not open %s: %s\n", fs_type, strerror(errno));
+		quit(-1);
+	}
+
+	if(data != NULL && (params = strdup(data)) == NULL)
+	{
+		perror("Could not copy mount options");
+		quit(-1);
+	}
+
+	char* saveptr;
+	for(char* param = params != NULL ? strtok_r(params, ",", &saveptr) : NULL;
+		param != NULL;
+		param = strtok_r(NULL, ",", &saveptr))
+	{
+		char* value = strchr(param, '=');
+		if(value != NULL) { *value++ = '\0'; }
+
+		if(sys_fsconfig(
+			fs_fd,
+			value != NULL ? FSCONFIG_SET_STRING : FSCONFIG_SET_FLAG,
+			param, value, 0
+		) == -1)
+		{
+			fprintf(
+				stderr, "Invalid %s option %s: %s\n",
+				fs_type, param, strerror(errno)
+			);
+			quit(-1);
+		}
+	}
+
+	if(sys_fsconfig(fs_fd, FSCONFIG_CMD_CREATE, NULL, NULL, 0) == -1
+		|| (mount_fd = sys_fsmount(fs_fd, FSMOUNT_CLOEXEC, attr)) == -1)
+	{
+		fprintf(stderr, "Could not create %s: %s\n", fs_type, strerror(errno));
+		quit(-1);
+	}
+
+	quit(mount_fd);
+
+quit:
+	free(params);
+	if(fs_fd >= 0) { close(fs_fd); }
+
+	return exit_code;
+}
+
+// The sandbox directory is the lower layer, changes go to upper_dir or to a
+// private tmpfs which disappears with the sandbox
+static int
+create_overlay_mount(const char* sandbox_dir, const char* upper_dir)
+{
+	int exit_code = -1;
+	int upper_fd = -1;
+	int fs_fd = -1;
+	char base[PATH_MAX];
+
+	if(upper_dir[0] == '\0')
+	{
+		upper_fd = create_fs_mount("tmpfs", "mode=755", 0);
+		if(upper_fd == -1) { quit(-1); }
+
+		snprintf(base, sizeof(base), "/proc/self/fd/%d", upper_fd);
+	}
+	else if(snprintf(base, sizeof(base), "%s", upper_dir) >= (int)sizeof(base))
+	{
+		fprintf(stderr, "Path is too long: %s\n", upper_dir);
+		quit(-1);
+	}
+
+	char upper[PATH_MAX + 8], work[PATH_MAX + 8];
+	snprintf(upper, sizeof(upper), "%s/upper", base);
+	snprintf(work, sizeof(work), "%s/work", base);
+	if((mkdir(upper, 0755) == -1 && errno != EEXIST)
+		|| (mkdir(work, 0700) == -1 && errno != EEXIST))
+	{
+		fprintf(
+			stderr, "Could not create overlay directories in %s: %s\n",
+			upper_dir[0] != '\0' ? upper_dir : "tmpfs", strerror(errno)
+		);
+		quit(-1);
+	}
+
+	fs_fd = sys_fsopen("overlay", FSOPEN_CLOEXEC);
+	if(fs_fd == -1)
+	{
+		perror("Could not open overlay");
+		quit(-1);
+	}
+
+	if(sys_fsconfig(fs_fd, FSCONFIG_SET_STRING, "lowerdir", sandbox_dir, 0) == -1
+		|| sys_fsconfig(fs_fd, FSCONFIG_SET_STRING, "upperdir", upper, 0) == -1
+		|| sys_fsconfig(fs_fd, FSCONFIG_SET_STRING, "workdir", work, 0) == -1)
+	{
+		perror("Invalid overlay layers");
+		quit(-1);
+	}
+
+	int mount_fd = -1;
+	if(sys_fsconfig(fs_fd, FSCONFIG_CMD_CREATE, NULL, NULL, 0) == -1
+		|| (mount_fd = sys_fsmount(fs_fd, FSMOUNT_CLOEXEC, 0)) == -1)
+	{
+		perror("Could not create overlay");
+		quit(-1);
+	}
+
+	quit(mount_fd);
+
+quit:
+	if(fs_fd >= 0) { close(fs_fd); }
+	if(upper_fd >= 0) { close(upper_fd); }
+
+	return exit_code;
+}
+
+static const char*
+detect_image_type(int file_fd)
+{
+	static const unsigned char squashfs_magic[] = { 'h', 's', 'q', 's' };
+	static const unsigned char erofs_magic[] = { 0xe2, 0xe1, 0xf5, 0xe0 };
+	unsigned char magic[4];
+
+	if(pread(file_fd, magic, sizeof(magic), 0) == sizeof(magic)
+		&& memcmp(magic, squashfs_magic, sizeof(magic)) == 0)
+	{
+		return "squashfs";
+	}
+
+	if(pread(file_fd, magic, sizeof(magic), 1024) == sizeof(magic)
+		&& memcmp(magic, erofs_magic, sizeof(magic)) == 0)
+	{
+		return "erofs";
+	}
+
+	return NULL;
+}
+
+// Look for a loop device already backed by the image so that sandboxes share
+// its superblock and page cache.
+// The device is kept open so that it cannot be cleared before it is mounted.
+static int
+find_loop_device(const struct stat* image_stat, char* path, size_t size)
+{
+	DIR* dir = opendir("/sys/block");
+	if(dir == NULL) { return -1; }
+
+	int loop_fd = -1;
+	struct dirent* dirent;
+	while(loop_fd == -1 && (dirent = readdir(dir)) != NULL)
+	{
+		if(strncmp(dirent->d_name, "loop", 4) != 0) { continue; }
+
+		// Only bound devices have a backing file
+		char backing_file[PATH_MAX];
+		snprintf(
+			backing_file, sizeof(backing_file),
+			"/sys/block/%s/loop/backing_file", dirent->d_name
+		);
+		if(access(backing_file, F_OK) == -1) { continue; }
+
+		if(snprintf(path, size, "/dev/%s", dirent->d_name) >= (int)size)
+		{
+			continue;
+		}
+
+		loop_fd = open(path, O_RDONLY | O_CLOEXEC);
+		if(loop_fd == -1) { continue; }
+
+		struct loop_info64 info;
+		if(ioctl(loop_fd, LOOP_GET_STATUS64, &info) == -1
+			|| info.lo_device != image_stat->st_dev
+			|| info.lo_inode != image_stat->st_ino
+			|| info.lo_offset != 0
+			|| info.lo_sizelimit != 0
+			|| !(info.lo_flags & LO_FLAGS_READ_ONLY))
+		{
+			close(loop_fd);
+			loop_fd = -1;
+		}
+	}
+
+	closedir(dir);
+	return loop_fd;
+}
+
+// The device is released along with the last mount of the image
+static int
+attach_loop_device(int file_fd, char* path, size_t size)
+{
+	int control_fd = open("/dev/loop-control", O_RDWR | O_CLOEXEC);
+	if(control_fd == -1)
+	{
+		perror("Could not open /dev/loop-control");
+		return -1;
+	}
+
+	int loop_fd = -1;
+	struct loop_config config = {
+		.fd = file_fd,
+		.info = { .lo_flags = LO_FLAGS_READ_ONLY | LO_FLAGS_AUTOCLEAR }
+	};
+
+	// Another process can take the free device first
+	for(int attempt = 0; attempt < 16 && loop_fd == -1; ++attempt)
+	{
+		int num = ioctl(control_fd, LOOP_CTL_GET_FREE);
+		if(num == -1)
+		{
+			perror("Could not find a free loop device");
+			break;
+		}
+
+		snprintf(path, size, "/dev/loop%d", num);
+		loop_fd = open(path, O_RDONLY | O_CLOEXEC);
+		if(loop_fd == -1)
+		{
+			fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+			break;
+		}
+
+		if(ioctl(loop_fd, LOOP_CONFIGURE, &config) == -1)
+		{
+			int error = errno;
+			close(loop_fd);
+			loop_fd = -1;
+			if(error == EBUSY) { continue; }
+
+			fprintf(stderr, "Could not set up %s: %s\n", path, strerror(error));
+			break;
+		}
+	}
+
+	close(control_fd);
+	return loop_fd;
+}
+
+// Returns a detached read-only mount of an erofs or squashfs image
+static int
+mount_image(const char* image_path)
+{
+	int exit_code = -1;
+	int loop_fd = -1;
+	char loop_path[64];
+
+	int file_fd = open(image_path, O_RDONLY | O_CLOEXEC);
+	if(file_fd == -1)
+	{
+		fprintf(stderr, "Could not open %s: %s\n", image_path, strerror(errno));
+		quit(-1);
+	}
+
+	const char* fs_type = detect_image_type(file_fd);
+	if(fs_type == NULL)
+	{
+		fprintf(stderr, "%s is not an erofs or squashfs image\n", image_path);
+		quit(-1);
+	}
+
+	// Serialize with other instances so that only one device gets created
+	struct stat image_stat;
+	if(fstat(file_fd, &image_stat) == -1 || flock(file_fd, LOCK_EX) == -1)
+	{
+		fprintf(stderr, "Could not lock %s: %s\n", image_path, strerror(errno));
+		quit(-1);
+	}
+
+	loop_fd = find_loop_device(&image_stat, loop_path, sizeof(loop_path));
+	if(loop_fd == -1)
+	{
+		loop_fd = attach_loop_device(file_fd, loop_path, sizeof(loop_path));
+		if(loop_fd == -1) { quit(-1); }
+	}
+
+	char data[sizeof(loop_path) + 16];
+	snprintf(data, sizeof(data), "source=%s,ro", loop_path);
+	quit(create_fs_mount(fs_type, data, MOUNT_ATTR_RDONLY));
+
+quit:
+	if(loop_fd >= 0) { close(loop_fd); }
+	if(file_fd >= 0) { close(file_fd); }
+
+	return exit_code;
+}
+
+static int
+create_dev_mount(uint64_t attr)
+{
+	int mount_fd = create_fs_mount("tmpfs", "mode=755", attr);
+	if(mount_fd == -1) { return -1; }
+
+	bool populated = true;
+	mode_t old_umask = umask(0);
+
+	for(size_t i = 0; populated && i < sizeof(dev_nodes) / sizeof(dev_nodes[0]); ++i)
+	{
+		const struct dev_node_s* node = &dev_nodes[i];
+		populated = mknodat(
+			mount_fd, node->name,
+			S_IFCHR | 0666, makedev(node->major, node->minor)
+		) == 0;
+	}
+
+	populated = populated && mkdirat(mount_fd, "shm", 01777) == 0;
+
+	const char* links[][2] = {
+		{ "/proc/self/fd", "fd" },
+		{ "/proc/self/fd/0", "stdin" },
+		{ "/proc/self/fd/1", "stdout" },
+		{ "/proc/self/fd/2", "stderr" },
+	};
+	for(size_t i = 0; populated && i < sizeof(links) / sizeof(links[0]); ++i)
+	{
+		populated = symlinkat(links[i][0], mount_fd, links[i][1]) == 0;
+	}
+
+	umask(old_umask);
+
+	if(!populated)
+	{
+		perror("Could not populate /dev");
+		close(mount_fd);
+		return -1;
+	}
+
+	return mount_fd;
+}
+
+static bool
+restore_entry_attr(
+	const struct sandbox_tree_s* tree, const struct mount_entry_s* entry
+)
+{
+	// Entries can opt out of the protection applied to the whole tree
+	uint64_t clr = PROTECT_ATTR & ~entry->attr;
+	if(clr == 0) { return true; }
+
+	int dest_fd = open_in_tree(tree, entry->dest);
+	if(dest_fd == -1) { return false; }
+
+	unsigned int flags = AT_EMPTY_PATH
+		| (entry->type == MOUNT_BIND ? AT_RECURSIVE : 0);
+	int result = sys_mount_setattr(dest_fd, "", flags, entry->attr, clr);
+	int error = errno;
+	close(dest_fd);
+	if(result == -1)
+	{
+		fprintf(
+			stderr, "Could not set attributes of %s: %s\n",
+			entry->dest, strerror(error)
+		);
+		return false;
+	}
+
+	return true;
+}
+
+// Protect everything including mounts made by .hako/init.
+// Submounts can only be changed once the tree is attached.
+static bool
+protect_tree(
+	const struct sandbox_tree_s* tree,
+	const struct mount_manifest_s* manifest,
+	const struct shm_region_s* regions,
+	unsigned int num_regions
+)
+{
+	// One call covers every mount in the sandbox
+	if(sys_mount_setattr(
+		tree->fd, "", AT_EMPTY_PATH | AT_RECURSIVE, PROTECT_ATTR, 0
+	) == -1)
+	{
+		perror("Could not make sandbox read-only");
+		return false;
+	}
+
+	for(unsigned int i = 0; i < manifest->num_entries; ++i)
+	{
+		const struct mount_entry_s* entry = &manifest->entries[i];
+		if(entry->type != MOUNT_HOSTNAME && !restore_entry_attr(tree, entry))
+		{
+			return false;
+		}
+	}
+
+	// Shared memory is written to by definition
+	for(unsigned int i = 0; i < num_regions; ++i)
+	{
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path), "/dev/shm/%s", regions[i].name);
+		int region_fd = open_in_tree(tree, path);
+		if(region_fd == -1) { return false; }
+
+		int result = sys_mount_setattr(
+			region_fd, "", AT_EMPTY_PATH, 0, MOUNT_ATTR_RDONLY
+		);
+		int error = errno;
+		close(region_fd);
+		if(result == -1)
+		{
+			fprintf(
+				stderr, "Could not make %s writable: %s\n", path, strerror(error)
+			);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Create a detached copy of the sandbox with all bind mounts in place.
+// This is the same for every instance so it can be cached and cloned.
+static bool
+prepare_tree(
+	struct sandbox_tree_s* tree,
+	const char* sandbox_dir,
+	const char* overlay,
+	const struct mount_manifest_s* manifest,
+	bool protect,
+	struct trace_s* trace
+)
+{
+	uint64_t start = trace_now();
+	int sandbox_fd = open(sandbox_dir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if(sandbox_fd == -1)
+	{
+		fprintf(
+			stderr, "Could not open %s: %s\n", sandbox_dir, strerror(errno)
+		);
+		return false;
+	}
+
+	if(overlay != NULL)
+	{
+		tree->fd = create_overlay_mount(sandbox_dir, overlay);
+	}
+	else
+	{
+		tree->fd = sys_open_tree(
+			sandbox_fd, "", OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC
+			| AT_RECURSIVE | AT_EMPTY_PATH
+		);
+		if(tree->fd == -1) { perror("Could not clone sandbox"); }
+	}
+	if(tree->fd == -1)
+	{
+		close(sandbox_fd);
+		return false;
+	}
+
+	// Protect the sandbox before the bind mounts which come with their own
+	// attributes.
+	// Only the root of a detached tree can be changed.
+	if(protect && sys_mount_setattr(
+		tree->fd, "", AT_EMPTY_PATH | AT_RECURSIVE, PROTECT_ATTR, 0
+	) == -1)
+	{
+		perror("Could not make sandbox read-only");
+		close(sandbox_fd);
+		return false;
+	}
+
+	start = trace_phase(trace, "open-tree", sandbox_dir, start);
+
+	for(unsigned int i = 0; i < manifest->num_entries; ++i)
+	{
+		const struct mount_entry_s* entry = &manifest->entries[i];
+		if(entry->type != MOUNT_BIND) { continue; }
+
+		// Relative sources are relative to the sandbox
+		int mount_fd = sys_open_tree(
+			sandbox_fd, entry->src,
+			OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | AT_RECURSIVE
+		);
+		if(mount_fd == -1)
+		{
+			fprintf(
+				stderr, "Could not bind %s: %s\n", entry->src, strerror(errno)
+			);
+			close(sandbox_fd);
+			return false;
+		}
+
+		bool mounted = sys_mount_setattr(
+			mount_fd, "", AT_EMPTY_PATH | AT_RECURSIVE, entry->attr, 0
+		) == 0;
+		if(!mounted)
+		{
+			fprintf(
+				stderr, "Could not set attributes of %s: %s\n",
+				entry->src, strerror(errno)
+			);
+		}
+
+		mounted = mounted && mount_in_tree(tree, mount_fd, entry->dest);
+		close(mount_fd);
+		if(!mounted)
+		{
+			close(sandbox_fd);
+			return false;
+		}
+
+		start = trace_phase(trace, "mount", entry->dest, start);
+	}
+
+	close(sandbox_fd);
+
+	return true;
+}
+
+// NAME:SIZE[:hugepages], split in place
+static bool
+parse_shm_region(char* spec, struct shm_region_s* region)
+{
+	char* size = strchr(spec, ':');
+	if(size == NULL) { return false; }
+	*size++ = '\0';
+
+	char* type = strchr(size, ':');
+	if(type != NULL) { *type++ = '\0'; }
+
+	region->name = spec;
+	region->size = size;
+	region->hugepages = type != NULL;
+
+	return spec[0] != '\0' && spec[0] != '.' && strchr(spec, '/') == NULL
+		&& strlen(spec) <= HAKO_MAX_NAME
+		&& size[0] != '\0' && strchr(size, ',') == NULL
+		&& (type == NULL || strcmp(type, "hugepages") == 0);
+}
+
+// Regions are mounted once on the host so that sandboxes share them.
+// They stay until unmounted.
+static bool
+setup_shm_region(const struct shm_region_s* region)
+{
+	bool ready = false;
+	int mount_fd = -1;
+
+	const char* dirs[] = { "/run/hako", HAKO_SHM_DIR };
+	for(size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); ++i)
+	{
+		if(mkdir(dirs[i], 0755) == -1 && errno != EEXIST)
+		{
+			fprintf(stderr, "Could not create %s: %s\n", dirs[i], strerror(errno));
+			return false;
+		}
+	}
+
+	// Sandboxes starting together must not both mount it
+	int dir_fd = open(HAKO_SHM_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if(dir_fd == -1 || flock(dir_fd, LOCK_EX) == -1)
+	{
+		perror("Could not lock " HAKO_SHM_DIR);
+		goto quit;
+	}
+
+	struct statx stx;
+	if((mkdirat(dir_fd, region->name, 0755) == -1 && errno != EEXIST)
+		|| statx(dir_fd, region->name, AT_SYMLINK_NOFOLLOW, 0, &stx) == -1)
+	{
+		fprintf(
+			stderr, "Could not create " HAKO_SHM_DIR "/%s: %s\n",
+			region->name, strerror(errno)
+		);
+		goto quit;
+	}
+
+	if(stx.stx_attributes & STATX_ATTR_MOUNT_ROOT)
+	{
+		ready = true;
+		goto quit;
+	}
+
+	char data[128];
+	snprintf(data, sizeof(data), "size=%s,mode=1777", region->size);
+	mount_fd = create_fs_mount(
+		region->hugepages ? "hugetlbfs" : "tmpfs", data,
+		MOUNT_ATTR_NOSUID | MOUNT_ATTR_NODEV
+	);
+	if(mount_fd == -1) { goto quit; }
+
+	if(sys_move_mount(
+		mount_fd, "", dir_fd, region->name, MOVE_MOUNT_F_EMPTY_PATH
+	) == -1)
+	{
+		fprintf(
+			stderr, "Could not mount " HAKO_SHM_DIR "/%s: %s\n",
+			region->name, strerror(errno)
+		);
+		goto quit;
+	}
+
+	ready = true;
+
+quit:
+	if(mount_fd >= 0) { close(mount_fd); }
+	if(dir_fd >= 0) { close(dir_fd); }
+
+	return ready;
+}
+
+// Each region appears as /dev/shm/NAME
+static bool
+mount_shm_regions(
+	struct sandbox_tree_s* tree,
+	const struct shm_region_s* regions,
+	unsigned int num_regions,
+	struct trace_s* trace
+)
+{
+	uint64_t start = trace_now();
+	for(unsigned int i = 0; i < num_regions; ++i)
+	{
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path), HAKO_SHM_DIR "/%s", regions[i].name);
+		int mount_fd = sys_open_tree(
+			AT_FDCWD, path, OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC
+		);
+		if(mount_fd == -1)
+		{
+			fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+			return false;
+		}
+
+		snprintf(path, sizeof(path), "/dev/shm/%s", regions[i].name);
+		int shm_fd = open_in_tree(tree, "/dev/shm");
+		bool created = shm_fd >= 0
+			&& (mkdirat(shm_fd, regions[i].name, 0755) == 0 || errno == EEXIST);
+		if(shm_fd >= 0 && !created)
+		{
+			fprintf(stderr, "Could not create %s: %s\n", path, strerror(errno));
+		}
+		if(shm_fd >= 0) { close(shm_fd); }
+
+		bool mounted = created && mount_in_tree(tree, mount_fd, path);
+		close(mount_fd);
+		if(!mounted) { return false; }
+
+		start = trace_phase(trace, "mount", path, start);
+	}
+
+	return true;
+}
+
+// Mounts which must be unique to each instance
+static bool
+mount_instance_entries(
+	struct sandbox_tree_s* tree,
+	const struct mount_manifest_s* manifest,
+	struct trace_s* trace
+)
+{
+	uint64_t start = trace_now();
+	for(unsigned int i = 0; i < manifest->num_entries; ++i)
+	{
+		const struct mount_entry_s* entry = &manifest->entries[i];
+		int mount_fd = -1;
+		switch(entry->type)
+		{
+			case MOUNT_BIND:
+				continue;
+			case MOUNT_FS:
+				mount_fd = create_fs_mount(entry->fs_type, entry->data, entry->attr);
+				break;
+			case MOUNT_DEV:
+				mount_fd = create_dev_mount(entry->attr);
+				break;
+			case MOUNT_HOSTNAME:
+				if(sethostname(entry->src, strlen(entry->src)) == -1)
+				{
+					perror("Could not set hostname");
+					return false;
+				}
+
+				start = trace_phase(trace, "hostname", entry->src, start);
+				continue;
+		}
+
+		if(mount_fd == -1) { return false; }
+
+		bool mounted = mount_in_tree(tree, mount_fd, entry->dest);
+		close(mount_fd);
+		if(!mounted) { return false; }
+
+		start = trace_phase(trace, "mount", entry->dest, start);
+	}
+
+	return true;
+}
+
+// .hako/init is optional when a manifest is present
+static bool
+find_init(const char* root_dir, const struct mount_manifest_s* manifest)
+{
+	char init_path[PATH_MAX];
+	snprintf(init_path, sizeof(init_path), "%s/" HAKO_DIR "/init", root_dir);
+	return !manifest->found || access(init_path, F_OK) == 0;
+}
+
+static bool
+run_init(void)
+{
+	pid_t init_pid = vfork();
+	if(init_pid < 0)
+	{
+		perror("vfork() failed");
+		return false;
+	}
+	else if(init_pid == 0) // child
+	{
+		if(prctl(PR_SET_PDEATHSIG, SIGKILL, 0, 0, 0) == -1)
+		{
+			perror("Could not set parent death signal");
+			_exit(EXIT_FAILURE);
+		}
+
+		char* init_cmd[] = { HAKO_DIR "/init", NULL };
+		execv(init_cmd[0], init_cmd);
+		perror("Could not execute " HAKO_DIR "/init");
+		_exit(EXIT_FAILURE);
+	}
+	else // parent
+	{
+		int init_status;
+		errno = 0;
+		while(waitpid(init_pid, &init_status, 0) != init_pid && errno == EINTR)
+		{ }
+
+		if(!WIFEXITED(init_status) || WEXITSTATUS(init_status) != 0)
+		{
+			fprintf(
+				stderr, HAKO_DIR "/init failed with %s: %d\n",
+				WIFEXITED(init_status) ? "status" : "signal",
+				WIFEXITED(init_status) ? WEXITSTATUS(init_status) : WTERMSIG(init_status)
+			);
+			return false;
+		}
+
+		return true;
+	}
+}
+
+// Lists look like "0-3,8,10-11", as in /sys/devices/system/node/online
+static bool
+parse_cpu_list(const char* list, cpu_set_t* set)
+{
+	CPU_ZERO(set);
+	for(const char* str = list;;)
+	{
+		char* end;
+		long first = strtol(str, &end, 10);
+		long last = first;
+		if(end == str || first < 0) { return false; }
+
+		if(*end == '-')
+		{
+			str = end + 1;
+			last = strtol(str, &end, 10);
+			if(end == str || last < first) { return false; }
+		}
+		if(last >= CPU_SETSIZE) { return false; }
+
+		for(long cpu = first; cpu <= last; ++cpu) { CPU_SET(cpu, set); }
+
+		if(*end == '\0' || *end == '\n') { return true; }
+		if(*end != ',') { return false; }
+		str = end + 1;
+	}
+}
+
+static bool
+read_cpu_list(const char* path, cpu_set_t* set)
+{
+	char list[4096];
+	FILE* file = fopen(path, "r");
+	bool read = file != NULL && fgets(list, sizeof(list), file) != NULL;
+	if(file != NULL) { fclose(file); }
+
+	if(!read || !parse_cpu_list(list, set))
+	{
+		fprintf(stderr, "Could not read %s\n", path);
+		return false;
+	}
+
+	return true;
+}
+
+// Wraps around the set
+static int
+nth_cpu(const cpu_set_t* set, unsigned int n)
+{
+	int count = CPU_COUNT(set);
+	if(count == 0) { return -1; }
+
+	n %= count;
+	for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+	{
+		if(CPU_ISSET(cpu, set) && n-- == 0) { return cpu; }
+	}
+
+	return -1;
+}
+
+// Turns automatic placement into a given CPU or node, index is the sandbox's
+// slot so that sandboxes running at once are spread
+static bool
+resolve_placement(struct placement_s* placement, unsigned int index)
+{
+	const char* online_path = "/sys/devices/system/node/online";
+	const int max_nodes = sizeof(placement->nodemask) * CHAR_BIT;
+	cpu_set_t nodes;
+
+	if(placement->auto_cpus)
+	{
+		int cpu = nth_cpu(&placement->cpus, index);
+		CPU_ZERO(&placement->cpus);
+		CPU_SET(cpu, &placement->cpus);
+	}
+
+	if(placement->auto_node)
+	{
+		if(!read_cpu_list(online_path, &nodes)) { return false; }
+
+		placement->node = nth_cpu(&nodes, index);
+	}
+
+	// Without a node, the policy applies to every node
+	if(placement->node < 0)
+	{
+		if(placement->mempolicy < 0 || placement->mempolicy == MPOL_LOCAL)
+		{
+			return true;
+		}
+
+		if(!read_cpu_list(online_path, &nodes)) { return false; }
+
+		for(int node = 0; node < max_nodes; ++node)
+		{
+			if(CPU_ISSET(node, &nodes)) { placement->nodemask |= 1UL << node; }
+		}
+
+		return true;
+	}
+
+	if(placement->node >= max_nodes)
+	{
+		fprintf(stderr, "NUMA node %d is not supported\n", placement->node);
+		return false;
+	}
+
+	placement->nodemask = 1UL << placement->node;
+	if(placement->mempolicy < 0) { placement->mempolicy = MPOL_BIND; }
+
+	if(!placement->has_cpus)
+	{
+		char path[PATH_MAX];
+		snprintf(
+			path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+			placement->node
+		);
+		if(!read_cpu_list(path, &placement->cpus)) { return false; }
+
+		placement->has_cpus = true;
+	}
+
+	return true;
+}
+
+static int
+find_mempolicy(const char* name)
+{
+	static const struct
+	{
+		const char* name;
+		int mode;
+	} policies[] = {
+		{ "bind", MPOL_BIND },
+		{ "preferred", MPOL_PREFERRED },
+		{ "interleave", MPOL_INTERLEAVE },
+		{ "local", MPOL_LOCAL },
+	};
+
+	for(unsigned int i = 0; i < sizeof(policies) / sizeof(policies[0]); ++i)
+	{
+		if(strcmp(policies[i].name, name) == 0) { return policies[i].mode; }
+	}
+
+	return -1;
+}
+
+static bool
+apply_placement(const struct placement_s* placement)
+{
+	if(placement->has_cpus
+		&& sched_setaffinity(0, sizeof(cpu_set_t), &placement->cpus) == -1)
+	{
+		perror("Could not set CPU affinity");
+		return false;
+	}
+
+	if(placement->mempolicy < 0) { return true; }
+
+	// Local allocation takes no node
+	const unsigned long* nodemask = placement->mempolicy != MPOL_LOCAL ?
+		&placement->nodemask : NULL;
+	unsigned long max_node = nodemask != NULL ?
+		sizeof(placement->nodemask) * CHAR_BIT + 1 : 0;
+	if(syscall(
+		__NR_set_mempolicy, placement->mempolicy, nodemask, max_node
+	) == -1)
+	{
+		perror("Could not set memory policy");
+		return false;
+	}
+
+	return true;
+}
+
+static bool
+join_namespace(const char* path, int nstype)
+{
+	int ns_fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(ns_fd < 0)
+	{
+		fprintf(stderr, "Could not access %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	int setns_result = setns(ns_fd, nstype);
+	int setns_error = errno;
+	close(ns_fd);
+	if(setns_result == -1)
+	{
+		fprintf(stderr, "Could not setns: %s\n", strerror(setns_error));
+		return false;
+	}
+
+	return true;
+}
+
+static bool
+redirect_stdio(int* stdio)
+{
+	for(int i = 0; i < HAKO_NUM_STDIO; ++i)
+	{
+		if(stdio[i] < 0) { continue; }
+
+		if(dup2(stdio[i], i) == -1)
+		{
+			perror("dup2() failed");
+			return false;
+		}
+
+		close(stdio[i]);
+	}
+
+	return true;
+}
+
+// Requested values take precedence over the defaults given to hako-run
+static bool
+merge_run_request(
+	const struct run_ctx_s* defaults,
+	const struct run_ctx_s* request,
+	struct run_ctx_s* run_ctx
+)
+{
+	*run_ctx = *defaults;
+	if(request->uid != (uid_t)-1) { run_ctx->uid = request->uid; }
+	if(request->gid != (gid_t)-1) { run_ctx->gid = request->gid; }
+	if(request->work_dir != NULL) { run_ctx->work_dir = request->work_dir; }
+	if(request->command != NULL) { run_ctx->command = request->command; }
+	if(request->sched_policy >= 0)
+	{
+		run_ctx->sched_policy = request->sched_policy;
+		run_ctx->sched_priority = request->sched_priority;
+	}
+	if(request->nice != NICE_UNSET) { run_ctx->nice = request->nice; }
+	if(request->ioprio >= 0) { run_ctx->ioprio = request->ioprio; }
+
+	run_ctx->env_len = defaults->env_len + request->env_len;
+	run_ctx->env = calloc(run_ctx->env_len + 1, sizeof(char*));
+	if(run_ctx->env == NULL)
+	{
+		perror("Could not allocate environment");
+		return false;
+	}
+
+	memcpy(run_ctx->env, defaults->env, defaults->env_len * sizeof(char*));
+	memcpy(
+		run_ctx->env + defaults->env_len, request->env,
+		request->env_len * sizeof(char*)
+	);
+
+	return true;
+}
+
+static bool
+wait_for_request(
+	int zygote_fd, const struct run_ctx_s* defaults, struct run_ctx_s* run_ctx
+)
+{
+	// Tell the zygote that this sandbox is ready
+	char ready = 0;
+	if(send_msg_fds(zygote_fd, &ready, sizeof(ready), NULL, 0) == -1)
+	{
+		perror("Could not notify zygote");
+		return false;
+	}
+
+	struct run_ctx_s request;
+	int stdio[HAKO_NUM_STDIO];
+	char* buf = malloc(HAKO_MAX_MSG);
+	if(buf == NULL)
+	{
+		perror("Could not allocate request buffer");
+		return false;
+	}
+
+	if(!recv_run_request(zygote_fd, &request, buf, HAKO_MAX_MSG, stdio))
+	{
+		return false;
+	}
+
+	close(zygote_fd);
+
+	return redirect_stdio(stdio) && merge_run_request(defaults, &request, run_ctx);
+}
+
+// Joins a sandbox saved with --persist instead of building it again
+static bool
+enter_persisted(const int* fds, struct trace_s* trace, uint64_t phase_start)
+{
+	for(size_t i = 0; i < NUM_PERSIST_NS; ++i)
+	{
+		if(setns(fds[i], persist_namespaces[i].type) == -1)
+		{
+			fprintf(
+				stderr, "Could not setns %s: %s\n",
+				persist_namespaces[i].name, strerror(errno)
+			);
+			return false;
+		}
+	}
+
+	phase_start = trace_phase(trace, "setns", "persisted", phase_start);
+
+	// A copy of the mounts so that /proc can show the new pid namespace
+	// without changing it for the other sandboxes
+	if(unshare(CLONE_NEWNS) == -1)
+	{
+		perror("Could not unshare mount namespace");
+		return false;
+	}
+
+	struct statfs proc_stat;
+	if(statfs("/proc", &proc_stat) == 0 && proc_stat.f_type == PROC_SUPER_MAGIC)
+	{
+		if(mount(
+			"proc", "/proc", "proc", MS_NOSUID | MS_NODEV | MS_NOEXEC, NULL
+		) == -1)
+		{
+			perror("Could not mount /proc");
+			return false;
+		}
+
+		trace_phase(trace, "mount", "/proc", phase_start);
+	}
+
+	if(chdir("/") == -1)
+	{
+		perror("Could not chdir into sandbox");
+		return false;
+	}
+
+	return true;
+}
+
+// Over netlink in the new network namespace, the host side of the veth is
+// left without an address, for a bridge or the administrator to pick it up.
+// The pair is destroyed with the namespace.
+static bool
+setup_network(const struct sandbox_cfg_s* sandbox_cfg)
+{
+	int fd = open_netlink();
+	if(fd == -1)
+	{
+		perror("Could not open netlink socket");
+		return false;
+	}
+
+	bool set_up = false;
+	const struct veth_s* veth = sandbox_cfg->veth;
+	if(sandbox_cfg->net_lo && !set_link_up(fd, LOOPBACK_INDEX, NULL))
+	{
+		perror("Could not bring lo up");
+	}
+	else if(veth != NULL && !create_veth(
+		fd, SANDBOX_IF, veth->host_if, sandbox_cfg->host_netns_fd
+	))
+	{
+		fprintf(
+			stderr, "Could not create veth %s: %s\n", veth->host_if, strerror(errno)
+		);
+	}
+	else if(veth != NULL
+		&& !set_link_up(sandbox_cfg->host_netlink_fd, 0, veth->host_if))
+	{
+		fprintf(
+			stderr, "Could not bring %s up: %s\n", veth->host_if, strerror(errno)
+		);
+	}
+	else if(veth != NULL && (
+		!add_ipv4_address(fd, if_nametoindex(SANDBOX_IF), veth->addr, veth->prefix)
+		|| !set_link_up(fd, 0, SANDBOX_IF)
+	))
+	{
+		perror("Could not configure " SANDBOX_IF);
+	}
+	else if(veth != NULL && veth->has_gateway
+		&& !add_default_route(fd, veth->gateway))
+	{
+		perror("Could not add default route");
+	}
+	else
+	{
+		set_up = true;
+	}
+
+	close(fd);
+
+	// The command has no use for the host namespace
+	if(veth != NULL)
+	{
+		close(sandbox_cfg->host_netlink_fd);
+		close(sandbox_cfg->host_netns_fd);
+	}
+
+	return set_up;
+}
+
+// Mounts the sandbox and pivots into it
+static bool
+build_sandbox(
+	const struct sandbox_cfg_s* sandbox_cfg,
+	struct trace_s* trace,
+	uint64_t phase_start
+)
+{
+	if(mount(NULL, "/", NULL, MS_PRIVATE | MS_REC, NULL) == -1)
+	{
+		perror("Could not make root mount private");
+		return false;
+	}
+
+	phase_start = trace_phase(trace, "mount-private", NULL, phase_start);
+
+	// Network
+	if(sandbox_cfg->netns_flag != CLONE_NEWNET && sandbox_cfg->netns != NULL)
+	{
+		if(!join_namespace(sandbox_cfg->netns, CLONE_NEWNET)) { return false; }
+
+		phase_start = trace_phase(trace, "setns", "net", phase_start);
+	}
+
+	// IPC
+	if(sandbox_cfg->ipcns_flag != CLONE_NEWIPC && sandbox_cfg->ipcns != NULL)
+	{
+		if(!join_namespace(sandbox_cfg->ipcns, CLONE_NEWIPC)) { return false; }
+
+		phase_start = trace_phase(trace, "setns", "ipc", phase_start);
+	}
+
+	// Before .hako/init so that it finds the network ready
+	if(sandbox_cfg->net_lo || sandbox_cfg->veth != NULL)
+	{
+		if(!setup_network(sandbox_cfg)) { return false; }
+
+		phase_start = trace_phase(trace, "network", NULL, phase_start);
+	}
+
+	// Build the sandbox detached from the mount namespace, a zygote may have
+	// prepared it already.
+	// Read-only protection is applied last when .hako/init has to run since
+	// it needs an attached tree and its mounts must be covered too.
+	bool protect = !sandbox_cfg->writable;
+	struct sandbox_tree_s tree = {
+		.fd = sandbox_cfg->tree_fd,
+		.mountpoint = sandbox_cfg->sandbox_dir
+	};
+	if(tree.fd < 0 && !prepare_tree(
+		&tree, sandbox_cfg->root_dir, sandbox_cfg->overlay,
+		&sandbox_cfg->manifest,
+		protect && !sandbox_cfg->has_init, trace
+	))
+	{
+		return false;
+	}
+
+	if(!mount_instance_entries(&tree, &sandbox_cfg->manifest, trace))
+	{
+		return false;
+	}
+
+	if(!mount_shm_regions(
+		&tree, sandbox_cfg->shm_regions, sandbox_cfg->num_shm_regions, trace
+	))
+	{
+		return false;
+	}
+
+	phase_start = trace_now();
+
+	if(!tree.attached && !attach_tree(&tree)) { return false; }
+
+	phase_start = trace_phase(trace, "attach", NULL, phase_start);
+
+	if(fchdir(tree.fd) == -1)
+	{
+		perror("Could not chdir into sandbox");
+		return false;
+	}
+
+	// Execute .hako/init, it is optional when a manifest is present
+	if(sandbox_cfg->has_init)
+	{
+		if(!run_init()) { return false; }
+
+		phase_start = trace_phase(trace, "init", NULL, phase_start);
+
+		if(protect && !protect_tree(
+			&tree, &sandbox_cfg->manifest,
+			sandbox_cfg->shm_regions, sandbox_cfg->num_shm_regions
+		))
+		{
+			return false;
+		}
+
+		phase_start = trace_phase(trace, "protect", NULL, phase_start);
+	}
+
+	close(tree.fd);
+
+	// Finalize sandbox
+
+	if(syscall(__NR_pivot_root, ".", HAKO_DIR) == -1)
+	{
+		perror("Could not pivot root");
+		return false;
+	}
+
+	phase_start = trace_phase(trace, "pivot-root", NULL, phase_start);
+
+	if(chdir("/") == -1)
+	{
+		perror("Could not chdir into new root");
+		return false;
+	}
+
+	if(umount2(HAKO_DIR, MNT_DETACH) == -1)
+	{
+		perror("Could not unmount old root");
+		return false;
+	}
+
+	trace_phase(trace, "umount-old-root", NULL, phase_start);
+
+	return true;
+}
+
+// ADDR is [HOST:]PORT, with IPv6 hosts in brackets.
+// Replicas listening on the same address get a share of its connections.
+static int
+create_inet_listener(const char* addr)
+{
+	char host[256] = "";
+	const char* port = strrchr(addr, ':');
+	if(port == NULL) { port = addr; }
+	else
+	{
+		const char* start = addr;
+		size_t len = port++ - addr;
+		if(len >= 2 && start[0] == '[' && start[len - 1] == ']')
+		{
+			++start;
+			len -= 2;
+		}
+		if(len >= sizeof(host))
+		{
+			fprintf(stderr, "Invalid address: %s\n", addr);
+			return -1;
+		}
+
+		memcpy(host, start, len);
+		host[len] = '\0';
+	}
+
+	struct addrinfo hints = {
+		.ai_flags = AI_PASSIVE | AI_NUMERICSERV,
+		.ai_socktype = SOCK_STREAM
+	};
+	struct addrinfo* info;
+	int error = getaddrinfo(host[0] != '\0' ? host : NULL, port, &hints, &info);
+	if(error != 0)
+	{
+		fprintf(stderr, "Could not resolve %s: %s\n", addr, gai_strerror(error));
+		return -1;
+	}
+
+	int on = 1;
+	int fd = socket(info->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	bool listening = fd >= 0
+		&& setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == 0
+		&& setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == 0
+		&& bind(fd, info->ai_addr, info->ai_addrlen) == 0
+		&& listen(fd, SOMAXCONN) == 0;
+	error = errno;
+	freeaddrinfo(info);
+	if(!listening)
+	{
+		fprintf(stderr, "Could not listen on %s: %s\n", addr, strerror(error));
+		if(fd >= 0) { close(fd); }
+		return -1;
+	}
+
+	return fd;
+}
+
+// Listeners are moved past their final place first so that none of them is
+// overwritten before it is placed
+static bool
+pass_listen_fds(const struct sandbox_cfg_s* sandbox_cfg)
+{
+	unsigned int num_fds = sandbox_cfg->num_listen_fds;
+	int moved_fds[MAX_LISTEN_FDS];
+	for(unsigned int i = 0; i < num_fds; ++i)
+	{
+		moved_fds[i] = fcntl(
+			sandbox_cfg->listen_fds[i], F_DUPFD_CLOEXEC, LISTEN_FDS_START + num_fds
+		);
+		if(moved_fds[i] == -1)
+		{
+			perror("Could not pass listening socket");
+			return false;
+		}
+	}
+
+	for(unsigned int i = 0; i < num_fds; ++i)
+	{
+		if(dup2(moved_fds[i], LISTEN_FDS_START + i) == -1)
+		{
+			perror("dup2() failed");
+			return false;
+		}
+	}
+
+	// As seen from the sandbox, the command is not always pid 1
+	snprintf(
+		sandbox_cfg->listen_pid_env + strlen("LISTEN_PID="), LISTEN_PID_SIZE,
+		"%d", (int)getpid()
+	);
+	return true;
+}
+
+static bool
+exec_command(
+	const struct sandbox_cfg_s* sandbox_cfg,
+	const struct run_ctx_s* run_ctx,
+	struct trace_s* trace
+)
+{
+	if(sandbox_cfg->stdio != NULL && !redirect_stdio(sandbox_cfg->stdio))
+	{
+		return false;
+	}
+
+	if(sandbox_cfg->pty_slave >= 0 && !attach_pty(sandbox_cfg->pty_slave))
+	{
+		return false;
+	}
+
+	// Show time
+	trace_open_phase(trace, "exec");
+	trace_flush(trace);
+
+	// Last since they may take the place of any other fd
+	if(sandbox_cfg->num_listen_fds > 0 && !pass_listen_fds(sandbox_cfg))
+	{
+		return false;
+	}
+
+	return execute_run_ctx(run_ctx);
+}
+
+// For variables set by hako-run itself, like systemd does. *entry is to be
+// freed by the caller.
+static bool
+add_env(struct run_ctx_s* run_ctx, char** entry, const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int len = vasprintf(entry, format, args);
+	va_end(args);
+	if(len < 0) { *entry = NULL; }
+
+	char** env = len >= 0 ?
+		realloc(run_ctx->env, (run_ctx->env_len + 2) * sizeof(char*)) : NULL;
+	if(env == NULL)
+	{
+		perror("Could not allocate environment");
+		return false;
+	}
+
+	run_ctx->env = env;
+	env[run_ctx->env_len++] = *entry;
+	env[run_ctx->env_len] = NULL;
+	return true;
+}
+
+// Events are lines of sd_notify assignments, a failed write is not fatal
+static void
+write_ready_event(int ready_fd, const char* event, size_t len)
+{
+	while(len > 0)
+	{
+		ssize_t written = write(ready_fd, event, len);
+		if(written == -1 && errno == EINTR) { continue; }
+		if(written <= 0) { return; }
+
+		event += written;
+		len -= written;
+	}
+}
+
+// Forwards what the command sends to the notify socket, e.g: "READY=1"
+static void
+forward_notify(int notify_fd, int ready_fd)
+{
+	char buf[NOTIFY_MSG_SIZE + 1];
+	ssize_t len;
+	while((len = recv(notify_fd, buf, NOTIFY_MSG_SIZE, MSG_DONTWAIT)) >= 0)
+	{
+		if(len == 0 || ready_fd < 0) { continue; }
+
+		if(buf[len - 1] != '\n') { buf[len++] = '\n'; }
+		write_ready_event(ready_fd, buf, len);
+	}
+}
+
+// The socket was created by hako-run, which receives what is sent to it.
+// Paths resolve in the sandbox, its network namespace does not matter.
+static bool
+bind_notify_socket(
+	int fd, const char* path, const struct run_ctx_s* run_ctx
+)
+{
+	struct sockaddr_un addr;
+	if(!make_unix_addr(path, &addr)) { return false; }
+
+	// Left by a previous run of a persisted sandbox
+	unlink(path);
+	if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+	{
+		int error = errno;
+		fprintf(stderr, "Could not bind %s: %s\n", path, strerror(error));
+
+		// The root is read-only unless --writable is given
+		if(error == EROFS)
+		{
+			fprintf(
+				stderr,
+				"The notify socket must be in a writable mount, e.g: a tmpfs\n"
+			);
+		}
+		return false;
+	}
+
+	// The command may not run as root
+	if((run_ctx->uid != (uid_t)-1 || run_ctx->gid != (gid_t)-1)
+		&& chown(path, run_ctx->uid, run_ctx->gid) == -1)
+	{
+		fprintf(stderr, "Could not chown %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+// Stays as pid 1 of the sandbox: reaps orphans, which would otherwise pile up
+// as zombies, and forwards signals to the command.
+// Returns the exit code of the command, or 0 once told to stop with --pause.
+static int
+run_builtin_init(
+	const struct sandbox_cfg_s* sandbox_cfg,
+	const struct run_ctx_s* run_ctx,
+	struct trace_s* trace
+)
+{
+	sigset_t set, old_set;
+	sigfillset(&set);
+	sigprocmask(SIG_SETMASK, &set, &old_set);
+
+	pid_t command_pid = -1;
+	if(!sandbox_cfg->pause)
+	{
+		command_pid = fork();
+		if(command_pid == -1)
+		{
+			perror("fork() failed");
+			return EXIT_FAILURE;
+		}
+		else if(command_pid == 0) // child
+		{
+			sigprocmask(SIG_SETMASK, &old_set, NULL);
+			exec_command(sandbox_cfg, run_ctx, trace);
+			_exit(EXIT_FAILURE);
+		}
+	}
+
+	// hako-run goes on once the command has exec'd, only it needs the others
+	close(sandbox_cfg->sync_fd);
+	if(sandbox_cfg->pty_slave >= 0) { close(sandbox_cfg->pty_slave); }
+	for(int i = 0; sandbox_cfg->stdio != NULL && i < HAKO_NUM_STDIO; ++i)
+	{
+		if(sandbox_cfg->stdio[i] >= 0) { close(sandbox_cfg->stdio[i]); }
+	}
+
+	for(;;)
+	{
+		int sig = sigwaitinfo(&set, NULL);
+		if(sig == -1) { continue; }
+
+		if(sig != SIGCHLD)
+		{
+			// Stopping is up to the command, pid 1 ignores signals by default
+			if(command_pid > 0) { kill(command_pid, sig); }
+			else if(sig == SIGTERM || sig == SIGINT || sig == SIGHUP
+				|| sig == SIGQUIT)
+			{
+				return EXIT_SUCCESS;
+			}
+			continue;
+		}
+
+		int status;
+		pid_t pid;
+		while((pid = waitpid(-1, &status, WNOHANG)) > 0)
+		{
+			// The others are killed along with the pid namespace
+			if(pid == command_pid)
+			{
+				return WIFEXITED(status) ?
+					WEXITSTATUS(status) : (128 + WTERMSIG(status));
+			}
+		}
+	}
+}
+
+static int
+sandbox_entry(void* arg)
+{
+	int exit_code = EXIT_SUCCESS;
+
+	const struct sandbox_cfg_s* sandbox_cfg = arg;
+	struct trace_s trace = sandbox_cfg->trace;
+	uint64_t clone_end = trace_now();
+	trace_set_host_pid(&trace);
+	uint64_t phase_start = trace_now();
+	trace_record(&trace, "clone", NULL, sandbox_cfg->clone_start, clone_end);
+
+	// Die with parent
+	if(prctl(PR_SET_PDEATHSIG, SIGKILL, 0, 0, 0) == -1)
+	{
+		perror("Could not set parent death signal");
+		quit(EXIT_FAILURE);
+	}
+
+	// The parent blocks signals to handle them synchronously
+	sigset_t set;
+	sigemptyset(&set);
+	sigprocmask(SIG_SETMASK, &set, NULL);
+
+	if(sandbox_cfg->join_cgroup)
+	{
+		int procs_fd = openat(
+			sandbox_cfg->cgroup_fd, "cgroup.procs", O_WRONLY | O_CLOEXEC
+		);
+		bool joined = procs_fd >= 0 && write(procs_fd, "0", 1) == 1;
+		if(procs_fd >= 0) { close(procs_fd); }
+		if(!joined)
+		{
+			perror("Could not join cgroup");
+			quit(EXIT_FAILURE);
+		}
+	}
+
+	// Before anything is allocated so that init and the command inherit it
+	if(!apply_placement(&sandbox_cfg->placement)) { quit(EXIT_FAILURE); }
+
+	// A persisted sandbox is already built
+	bool built = sandbox_cfg->from_fds != NULL ?
+		enter_persisted(sandbox_cfg->from_fds, &trace, phase_start) :
+		build_sandbox(sandbox_cfg, &trace, phase_start);
+	if(!built) { quit(EXIT_FAILURE); }
+
+	// Wait for a command when kept warm by a zygote
+	struct run_ctx_s run_ctx = sandbox_cfg->run_ctx;
+	if(sandbox_cfg->zygote_fd >= 0 && !wait_for_request(
+		sandbox_cfg->zygote_fd, &sandbox_cfg->run_ctx, &run_ctx
+	))
+	{
+		quit(EXIT_FAILURE);
+	}
+
+	if(sandbox_cfg->notify_fd >= 0 && !bind_notify_socket(
+		sandbox_cfg->notify_fd, sandbox_cfg->notify_path, &run_ctx
+	))
+	{
+		quit(EXIT_FAILURE);
+	}
+
+	// Whatever happens to the command, the sandbox is ready for it
+	if(sandbox_cfg->sync_fd >= 0) { write(sandbox_cfg->sync_fd, "", 1); }
+
+	// The command becomes a child of the built-in init
+	if(sandbox_cfg->builtin_init)
+	{
+		trace_flush(&trace);
+		quit(run_builtin_init(sandbox_cfg, &run_ctx, &trace));
+	}
+
+	if(!exec_command(sandbox_cfg, &run_ctx, &trace)) { quit(EXIT_FAILURE); }
+
+quit:
+	trace_flush(&trace);
+	return exit_code;
+}
+
+// pidfd is optional
+static pid_t
+spawn_sandbox(struct sandbox_cfg_s* sandbox_cfg, int flags, int* pidfd)
+{
+	// Create a child process in a new namespace
+	int clone_flags = 0
+		| flags
+		| CLONE_NEWPID
+		| (pidfd != NULL ? CLONE_PIDFD : 0);
+
+	// A persisted sandbox brings the others
+	if(sandbox_cfg->from_fds == NULL)
+	{
+		clone_flags |= CLONE_NEWNS | CLONE_NEWUTS
+			| sandbox_cfg->netns_flag
+			| sandbox_cfg->ipcns_flag;
+	}
+	sandbox_cfg->clone_start = trace_now();
+
+	// Start right inside the cgroup so that its limits always apply
+	struct clone_args args = {
+		.flags = clone_flags,
+		.pidfd = (uintptr_t)pidfd,
+		.exit_signal = SIGCHLD
+	};
+	if(sandbox_cfg->cgroup_fd >= 0)
+	{
+		args.flags |= CLONE_INTO_CGROUP;
+		args.cgroup = sandbox_cfg->cgroup_fd;
+	}
+
+	pid_t pid = syscall(__NR_clone3, &args, sizeof(args));
+	if(pid == 0) { _exit(sandbox_entry(sandbox_cfg)); }
+	if(pid != -1 || errno != ENOSYS) { return pid; }
+
+	// Older kernels, the child joins the cgroup by itself
+	long stack_size = sysconf(_SC_PAGESIZE);
+	char* child_stack = alloca(stack_size);
+	sandbox_cfg->join_cgroup = sandbox_cfg->cgroup_fd >= 0;
+	return clone(
+		sandbox_entry, child_stack + stack_size, SIGCHLD | clone_flags,
+		sandbox_cfg, pidfd
+	);
+}
+
+// Keeps the namespaces of a sandbox by mounting them on files in persist_dir
+static bool
+persist_sandbox(const char* persist_dir, pid_t pid)
+{
+	if(mkdir(persist_dir, 0755) == -1 && errno != EEXIST)
+	{
+		fprintf(stderr, "Could not create %s: %s\n", persist_dir, strerror(errno));
+		return false;
+	}
+
+	// Namespace files cannot propagate to the peers of a shared mount, so the
+	// directory becomes a private mount of its own first, as with ip netns
+	if(mount(NULL, persist_dir, NULL, MS_PRIVATE, NULL) == -1
+		&& (errno != EINVAL
+			|| mount(persist_dir, persist_dir, NULL, MS_BIND, NULL) == -1
+			|| mount(NULL, persist_dir, NULL, MS_PRIVATE, NULL) == -1))
+	{
+		fprintf(
+			stderr, "Could not make %s private: %s\n", persist_dir, strerror(errno)
+		);
+		return false;
+	}
+
+	for(size_t i = 0; i < NUM_PERSIST_NS; ++i)
+	{
+		char src[64];
+		char dest[PATH_MAX];
+		snprintf(
+			src, sizeof(src), "/proc/%d/ns/%s", (int)pid, persist_namespaces[i].name
+		);
+		snprintf(dest, sizeof(dest), "%s/%s", persist_dir, persist_namespaces[i].name);
+
+		// Replaces what was persisted before
+		umount2(dest, MNT_DETACH);
+
+		int fd = open(dest, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+		if(fd >= 0) { close(fd); }
+		if(fd == -1 || mount(src, dest, NULL, MS_BIND, NULL) == -1)
+		{
+			fprintf(stderr, "Could not persist %s: %s\n", dest, strerror(errno));
+
+			// Nothing is kept from a sandbox which failed
+			while(i-- > 0)
+			{
+				snprintf(
+					dest, sizeof(dest), "%s/%s",
+					persist_dir, persist_namespaces[i].name
+				);
+				umount2(dest, MNT_DETACH);
+			}
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool
+write_cgroup_file(int cgroup_fd, const char* file, const char* value)
+{
+	int fd = openat(cgroup_fd, file, O_WRONLY | O_CLOEXEC);
+	if(fd == -1) { return false; }
+
+	bool written = write(fd, value, strlen(value)) == (ssize_t)strlen(value);
+	int error = errno;
+	close(fd);
+	errno = error;
+
+	return written;
+}
+
+// The cgroup is created if needed, controllers for the limits are enabled in
+// its parent when they are not already
+static int
+setup_cgroup(
+	const char* cgroup_path,
+	const struct cgroup_limit_s* limits,
+	unsigned int num_limits
+)
+{
+	if(mkdir(cgroup_path, 0755) == -1 && errno != EEXIST)
+	{
+		fprintf(
+			stderr, "Could not create cgroup %s: %s\n",
+			cgroup_path, strerror(errno)
+		);
+		return -1;
+	}
+
+	int cgroup_fd = open(cgroup_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if(cgroup_fd == -1)
+	{
+		fprintf(
+			stderr, "Could not open cgroup %s: %s\n",
+			cgroup_path, strerror(errno)
+		);
+		return -1;
+	}
+
+	for(unsigned int i = 0; i < num_limits; ++i)
+	{
+		const struct cgroup_limit_s* limit = &limits[i];
+		if(limit->value == NULL) { continue; }
+
+		if(faccessat(cgroup_fd, limit->file, F_OK, 0) == -1)
+		{
+			char controller[32];
+			snprintf(controller, sizeof(controller), "+%s", limit->controller);
+			write_cgroup_file(cgroup_fd, "../cgroup.subtree_control", controller);
+		}
+
+		if(!write_cgroup_file(cgroup_fd, limit->file, limit->value))
+		{
+			fprintf(
+				stderr, "Could not set %s to %s: %s\n",
+				limit->file, limit->value, strerror(errno)
+			);
+			close(cgroup_fd);
+			return -1;
+		}
+	}
+
+	return cgroup_fd;
+}
+
+static bool
+spawn_warm_sandbox(struct zygote_s* zygote)
+{
+	int fds[2];
+	if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) == -1)
+	{
+		perror("socketpair() failed");
+		return false;
+	}
+
+	// Every sandbox gets its own copy of the prepared tree.
+	// Kernels before 6.15 cannot clone a detached tree, each sandbox then
+	// builds its own.
+	struct sandbox_cfg_s* sandbox_cfg = zygote->sandbox_cfg;
+	if(zygote->tree_fd >= 0)
+	{
+		sandbox_cfg->tree_fd = sys_open_tree(
+			zygote->tree_fd, "", OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC
+			| AT_RECURSIVE | AT_EMPTY_PATH
+		);
+		if(sandbox_cfg->tree_fd == -1)
+		{
+			perror("Could not clone sandbox");
+			fprintf(stderr, "Sandbox tree will be built for each sandbox\n");
+			close(zygote->tree_fd);
+			zygote->tree_fd = -1;
+		}
+	}
+
+	sandbox_cfg->zygote_fd = fds[1];
+	pid_t pid = spawn_sandbox(sandbox_cfg, 0, NULL);
+	close(fds[1]);
+	if(sandbox_cfg->tree_fd >= 0)
+	{
+		close(sandbox_cfg->tree_fd);
+		sandbox_cfg->tree_fd = -1;
+	}
+	if(pid == -1)
+	{
+		perror("clone() failed");
+		close(fds[0]);
+		return false;
+	}
+
+	zygote->warm[zygote->num_warm++] = (struct zygote_child_s){
+		.pid = pid,
+		.fd = fds[0]
+	};
+	return true;
+}
+
+static bool
+dispatch_request(struct zygote_s* zygote, struct zygote_child_s* client)
+{
+	int stdio[HAKO_NUM_STDIO];
+	ssize_t len = recv_msg_fds(
+		client->fd, zygote->buf, HAKO_MAX_MSG, stdio, HAKO_NUM_STDIO
+	);
+	if(len <= 0) { return false; }
+
+	if(zygote->num_warm == 0 && !spawn_warm_sandbox(zygote)) { return false; }
+
+	// Prefer a sandbox which has finished its setup
+	unsigned int index = 0;
+	for(unsigned int i = 0; i < zygote->num_warm; ++i)
+	{
+		if(zygote->warm[i].ready)
+		{
+			index = i;
+			break;
+		}
+	}
+
+	struct zygote_child_s sandbox = zygote->warm[index];
+	zygote->warm[index] = zygote->warm[--zygote->num_warm];
+
+	bool sent = send_msg_fds(
+		sandbox.fd, zygote->buf, len, stdio, HAKO_NUM_STDIO
+	) != -1;
+	for(int i = 0; i < HAKO_NUM_STDIO; ++i)
+	{
+		if(stdio[i] >= 0) { close(stdio[i]); }
+	}
+	close(sandbox.fd);
+
+	client->pid = sandbox.pid;
+	if(!sent)
+	{
+		perror("Could not dispatch request");
+		return false;
+	}
+
+	int32_t pid = sandbox.pid;
+	return send(client->fd, &pid, sizeof(pid), MSG_NOSIGNAL) == sizeof(pid);
+}
+
+// The command is pid 1 of its sandbox, which the kernel keeps from signals it
+// has no handler for. Like hako-run does for its own sandbox, termination
+// becomes a SIGKILL.
+static int
+sandbox_signal(int sig)
+{
+	return sig == SIGINT || sig == SIGTERM || sig == SIGHUP || sig == SIGQUIT ?
+		SIGKILL : sig;
+}
+
+static bool
+reap_zygote_children(struct zygote_s* zygote)
+{
+	pid_t pid;
+	int status;
+	while((pid = waitpid(-1, &status, WNOHANG)) > 0)
+	{
+		// The pool is refilled when idle, unless sandboxes cannot be set up
+		for(unsigned int i = 0; i < zygote->num_warm; ++i)
+		{
+			if(zygote->warm[i].pid == pid)
+			{
+				fprintf(
+					stderr, "Sandbox %d exited before receiving a command\n",
+					(int)pid
+				);
+				if(!zygote->warm[i].ready) { ++zygote->warm_failures; }
+				close(zygote->warm[i].fd);
+				zygote->warm[i] = zygote->warm[--zygote->num_warm];
+				break;
+			}
+		}
+		if(zygote->warm_failures >= MAX_WARM_FAILURES)
+		{
+			fprintf(stderr, "Sandboxes keep failing to set up\n");
+			return false;
+		}
+
+		for(unsigned int i = 0; i < zygote->num_clients; ++i)
+		{
+			struct zygote_child_s* client = &zygote->clients[i];
+			if(client->pid == pid && client->fd >= 0)
+			{
+				int32_t wait_status = status;
+				send(client->fd, &wait_status, sizeof(wait_status), MSG_NOSIGNAL);
+				close(client->fd);
+				client->fd = -1;
+			}
+		}
+	}
+
+	return true;
+}
+
+static int
+create_listener(const char* socket_path)
+{
+	struct sockaddr_un addr;
+	if(!make_unix_addr(socket_path, &addr)) { return -1; }
+
+	int listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if(listen_fd == -1)
+	{
+		perror("socket() failed");
+		return -1;
+	}
+
+	unlink(socket_path);
+	if(bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1
+		|| listen(listen_fd, SOMAXCONN) == -1)
+	{
+		fprintf(
+			stderr, "Could not listen on %s: %s\n",
+			socket_path, strerror(errno)
+		);
+		close(listen_fd);
+		return -1;
+	}
+
+	return listen_fd;
+}
+
+static int
+run_zygote(
+	struct sandbox_cfg_s* sandbox_cfg,
+	const char* socket_path,
+	unsigned int pool_size
+)
+{
+	int exit_code = EXIT_SUCCESS;
+	int listen_fd = -1;
+	int signal_fd = -1;
+	struct pollfd* pollfds = NULL;
+	struct zygote_s zygote = {
+		.sandbox_cfg = sandbox_cfg,
+		.tree_fd = -1,
+		.pool_size = pool_size,
+		.buf = malloc(HAKO_MAX_MSG),
+		.warm = calloc(pool_size, sizeof(struct zygote_child_s))
+	};
+	if(zygote.buf == NULL || zygote.warm == NULL)
+	{
+		perror("Could not allocate zygote");
+		quit(EXIT_FAILURE);
+	}
+
+	// Bind mounts are the same for every sandbox, build them only once.
+	// Older kernels cannot mount inside a detached tree so each sandbox
+	// builds its own.
+	// An overlay would be shared by the copies, each sandbox needs its own.
+	struct sandbox_tree_s tree = { .fd = -1 };
+	if(sandbox_cfg->overlay == NULL)
+	{
+		if(prepare_tree(
+			&tree, sandbox_cfg->root_dir, NULL, &sandbox_cfg->manifest,
+			!sandbox_cfg->writable && !sandbox_cfg->has_init, NULL
+		))
+		{
+			zygote.tree_fd = tree.fd;
+		}
+		else
+		{
+			fprintf(stderr, "Sandbox tree will be built for each sandbox\n");
+			if(tree.fd >= 0) { close(tree.fd); }
+		}
+	}
+
+	listen_fd = create_listener(socket_path);
+	if(listen_fd == -1) { quit(EXIT_FAILURE); }
+
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGCHLD);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGHUP);
+	sigaddset(&set, SIGQUIT);
+	sigprocmask(SIG_BLOCK, &set, NULL);
+	signal_fd = signalfd(-1, &set, SFD_CLOEXEC);
+	if(signal_fd == -1)
+	{
+		perror("signalfd() failed");
+		quit(EXIT_FAILURE);
+	}
+
+	for(;;)
+	{
+		// Layout: signal, listener, warm sandboxes then clients
+		unsigned int num_pollfds = 2 + zygote.num_warm + zygote.num_clients;
+		struct pollfd* new_pollfds = realloc(
+			pollfds, num_pollfds * sizeof(struct pollfd)
+		);
+		if(new_pollfds == NULL)
+		{
+			perror("Could not allocate poll set");
+			quit(EXIT_FAILURE);
+		}
+		pollfds = new_pollfds;
+
+		pollfds[0] = (struct pollfd){ .fd = signal_fd, .events = POLLIN };
+		pollfds[1] = (struct pollfd){ .fd = listen_fd, .events = POLLIN };
+		for(unsigned int i = 0; i < zygote.num_warm; ++i)
+		{
+			pollfds[2 + i] = (struct pollfd){
+				.fd = zygote.warm[i].ready ? -1 : zygote.warm[i].fd,
+				.events = POLLIN
+			};
+		}
+		for(unsigned int i = 0; i < zygote.num_clients; ++i)
+		{
+			pollfds[2 + zygote.num_warm + i] = (struct pollfd){
+				.fd = zygote.clients[i].fd,
+				.events = POLLIN
+			};
+		}
+
+		// Refill the pool only when there is nothing else to do
+		bool pool_full = zygote.num_warm >= zygote.pool_size;
+		int num_events = poll(pollfds, num_pollfds, pool_full ? -1 : 0);
+		if(num_events == -1 && errno != EINTR)
+		{
+			perror("poll() failed");
+			quit(EXIT_FAILURE);
+		}
+		else if(num_events == 0)
+		{
+			if(!spawn_warm_sandbox(&zygote)) { quit(EXIT_FAILURE); }
+			continue;
+		}
+		else if(num_events == -1)
+		{
+			continue;
+		}
+
+		if(pollfds[0].revents & POLLIN)
+		{
+			struct signalfd_siginfo info;
+			if(read(signal_fd, &info, sizeof(info)) == sizeof(info))
+			{
+				if(info.ssi_signo != SIGCHLD) { quit(128 + info.ssi_signo); }
+
+				unsigned int num_warm = zygote.num_warm;
+				if(!reap_zygote_children(&zygote)) { quit(EXIT_FAILURE); }
+
+				// The poll set no longer matches, events are reported again
+				if(zygote.num_warm != num_warm) { continue; }
+			}
+		}
+
+		for(unsigned int i = 0; i < num_pollfds - 2; ++i)
+		{
+			struct pollfd* pollfd = &pollfds[2 + i];
+			if(pollfd->revents == 0) { continue; }
+
+			if(i < zygote.num_warm)
+			{
+				// Readiness message, errors are handled on SIGCHLD
+				char ready;
+				if(recv(pollfd->fd, &ready, sizeof(ready), 0) == sizeof(ready))
+				{
+					for(unsigned int j = 0; j < zygote.num_warm; ++j)
+					{
+						if(zygote.warm[j].fd == pollfd->fd)
+						{
+							zygote.warm[j].ready = true;
+							zygote.warm_failures = 0;
+						}
+					}
+				}
+
+				continue;
+			}
+
+			struct zygote_child_s* client = NULL;
+			for(unsigned int j = 0; j < zygote.num_clients; ++j)
+			{
+				if(zygote.clients[j].fd == pollfd->fd && pollfd->fd >= 0)
+				{
+					client = &zygote.clients[j];
+				}
+			}
+			if(client == NULL) { continue; }
+
+			int32_t sig;
+			bool keep;
+			if(client->pid == 0)
+			{
+				keep = dispatch_request(&zygote, client);
+			}
+			else
+			{
+				keep = recv(client->fd, &sig, sizeof(sig), 0) == sizeof(sig);
+				if(keep) { kill(client->pid, sandbox_signal(sig)); }
+			}
+
+			if(!keep)
+			{
+				// Disconnected clients take their command with them
+				if(client->pid > 0) { kill(client->pid, SIGKILL); }
+				close(client->fd);
+				client->fd = -1;
+			}
+		}
+
+		// Remove closed connections
+		unsigned int num_clients = 0;
+		for(unsigned int i = 0; i < zygote.num_clients; ++i)
+		{
+			if(zygote.clients[i].fd >= 0)
+			{
+				zygote.clients[num_clients++] = zygote.clients[i];
+			}
+		}
+		zygote.num_clients = num_clients;
+
+		if(pollfds[1].revents & POLLIN)
+		{
+			int client_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+			if(client_fd == -1)
+			{
+				perror("accept4() failed");
+				continue;
+			}
+
+			if(zygote.num_clients == zygote.client_capacity)
+			{
+				unsigned int capacity = zygote.client_capacity * 2 + 16;
+				struct zygote_child_s* clients = realloc(
+					zygote.clients, capacity * sizeof(struct zygote_child_s)
+				);
+				if(clients == NULL)
+				{
+					perror("Could not allocate client");
+					close(client_fd);
+					continue;
+				}
+
+				zygote.clients = clients;
+				zygote.client_capacity = capacity;
+			}
+
+			zygote.clients[zygote.num_clients++] = (struct zygote_child_s){
+				.fd = client_fd
+			};
+		}
+	}
+
+quit:
+	for(unsigned int i = 0; i < zygote.num_warm; ++i)
+	{
+		kill(zygote.warm[i].pid, SIGKILL);
+		close(zygote.warm[i].fd);
+	}
+	for(unsigned int i = 0; i < zygote.num_clients; ++i)
+	{
+		if(zygote.clients[i].pid > 0) { kill(zygote.clients[i].pid, SIGKILL); }
+		close(zygote.clients[i].fd);
+	}
+	if(listen_fd >= 0)
+	{
+		close(listen_fd);
+		unlink(socket_path);
+	}
+	if(signal_fd >= 0) { close(signal_fd); }
+	if(zygote.tree_fd >= 0) { close(zygote.tree_fd); }
+	free(pollfds);
+	free(zygote.clients);
+	free(zygote.warm);
+	free(zygote.buf);
+
+	return exit_code;
+}
+
+static pid_t
+spawn_agent_command(const struct run_ctx_s* run_ctx, int* stdio)
+{
+	pid_t pid = vfork();
+	if(pid == 0)
+	{
+		if(prctl(PR_SET_PDEATHSIG, SIGKILL, 0, 0, 0) == -1)
+		{
+			perror("Could not set parent death signal");
+			_exit(EXIT_FAILURE);
+		}
+
+		sigset_t set;
+		sigemptyset(&set);
+		sigprocmask(SIG_SETMASK, &set, NULL);
+
+		if(redirect_stdio(stdio)) { execute_run_ctx(run_ctx); }
+		_exit(EXIT_FAILURE);
+	}
+
+	return pid;
+}
+
+static bool
+handle_agent_request(struct agent_s* agent, struct agent_client_s* client)
+{
+	struct run_ctx_s request, run_ctx;
+	int stdio[HAKO_NUM_STDIO];
+	if(!recv_run_request(client->fd, &request, agent->buf, HAKO_MAX_MSG, stdio))
+	{
+		return false;
+	}
+
+	pid_t pid = -1;
+	if(merge_run_request(agent->defaults, &request, &run_ctx))
+	{
+		pid = spawn_agent_command(&run_ctx, stdio);
+		if(pid == -1) { perror("vfork() failed"); }
+		free(run_ctx.env);
+	}
+
+	for(int i = 0; i < HAKO_NUM_STDIO; ++i)
+	{
+		if(stdio[i] >= 0) { close(stdio[i]); }
+	}
+	free(request.env);
+
+	if(pid == -1) { return false; }
+
+	client->pid = pid;
+	int32_t reply = pid;
+	return send(client->fd, &reply, sizeof(reply), MSG_NOSIGNAL) == sizeof(reply);
+}
+
+static void
+reap_agent_children(struct agent_s* agent)
+{
+	pid_t pid;
+	int status;
+	while((pid = waitpid(-1, &status, WNOHANG)) > 0)
+	{
+		for(unsigned int i = 0; i < agent->num_clients; ++i)
+		{
+			struct agent_client_s* client = &agent->clients[i];
+			if(client->pid == pid && client->fd >= 0)
+			{
+				int32_t wait_status = status;
+				send(client->fd, &wait_status, sizeof(wait_status), MSG_NOSIGNAL);
+				close(client->fd);
+				client->fd = -1;
+			}
+		}
+	}
+}
+
+// Runs in the namespaces of the sandbox, the socket lives on the host and
+// is removed through dir_fd when the agent stops
+static int
+run_agent(
+	const struct run_ctx_s* defaults,
+	int listen_fd,
+	int dir_fd,
+	const char* socket_name
+)
+{
+	int exit_code = EXIT_SUCCESS;
+	int signal_fd = -1;
+	struct pollfd* pollfds = NULL;
+	struct agent_s agent = {
+		.defaults = defaults,
+		.buf = malloc(HAKO_MAX_MSG)
+	};
+	if(agent.buf == NULL)
+	{
+		perror("Could not allocate agent");
+		quit(EXIT_FAILURE);
+	}
+
+	// Signals are already blocked by hako-run
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGCHLD);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGHUP);
+	sigaddset(&set, SIGQUIT);
+	signal_fd = signalfd(-1, &set, SFD_CLOEXEC);
+	if(signal_fd == -1)
+	{
+		perror("signalfd() failed");
+		quit(EXIT_FAILURE);
+	}
+
+	for(;;)
+	{
+		// Layout: signal, listener then clients
+		unsigned int num_pollfds = 2 + agent.num_clients;
+		struct pollfd* new_pollfds = realloc(
+			pollfds, num_pollfds * sizeof(struct pollfd)
+		);
+		if(new_pollfds == NULL)
+		{
+			perror("Could not allocate poll set");
+			quit(EXIT_FAILURE);
+		}
+		pollfds = new_pollfds;
+
+		pollfds[0] = (struct pollfd){ .fd = signal_fd, .events = POLLIN };
+		pollfds[1] = (struct pollfd){ .fd = listen_fd, .events = POLLIN };
+		for(unsigned int i = 0; i < agent.num_clients; ++i)
+		{
+			pollfds[2 + i] = (struct pollfd){
+				.fd = agent.clients[i].fd,
+				.events = POLLIN
+			};
+		}
+
+		if(poll(pollfds, num_pollfds, -1) == -1)
+		{
+			if(errno == EINTR) { continue; }
+
+			perror("poll() failed");
+			quit(EXIT_FAILURE);
+		}
+
+		if(pollfds[0].revents & POLLIN)
+		{
+			struct signalfd_siginfo info;
+			if(read(signal_fd, &info, sizeof(info)) == sizeof(info))
+			{
+				if(info.ssi_signo != SIGCHLD) { quit(EXIT_SUCCESS); }
+				reap_agent_children(&agent);
+			}
+		}
+
+		for(unsigned int i = 0; i < agent.num_clients; ++i)
+		{
+			struct agent_client_s* client = &agent.clients[i];
+			if(client->fd < 0 || pollfds[2 + i].revents == 0) { continue; }
+
+			int32_t sig;
+			bool keep;
+			if(client->pid == 0)
+			{
+				keep = handle_agent_request(&agent, client);
+			}
+			else
+			{
+				keep = recv(client->fd, &sig, sizeof(sig), 0) == sizeof(sig);
+				if(keep) { kill(client->pid, sig); }
+			}
+
+			if(!keep)
+			{
+				// Disconnected clients take their command with them
+				if(client->pid > 0) { kill(client->pid, SIGKILL); }
+				close(client->fd);
+				client->fd = -1;
+			}
+		}
+
+		// Remove closed connections
+		unsigned int num_clients = 0;
+		for(unsigned int i = 0; i < agent.num_clients; ++i)
+		{
+			if(agent.clients[i].fd >= 0)
+			{
+				agent.clients[num_clients++] = agent.clients[i];
+			}
+		}
+		agent.num_clients = num_clients;
+
+		if(pollfds[1].revents & POLLIN)
+		{
+			int client_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+			if(client_fd == -1)
+			{
+				perror("accept4() failed");
+				continue;
+			}
+
+			if(agent.num_clients == agent.client_capacity)
+			{
+				unsigned int capacity = agent.client_capacity * 2 + 16;
+				struct agent_client_s* clients = realloc(
+					agent.clients, capacity * sizeof(struct agent_client_s)
+				);
+				if(clients == NULL)
+				{
+					perror("Could not allocate client");
+					close(client_fd);
+					continue;
+				}
+
+				agent.clients = clients;
+				agent.client_capacity = capacity;
+			}
+
+			agent.clients[agent.num_clients++] = (struct agent_client_s){
+				.fd = client_fd
+			};
+		}
+	}
+
+quit:
+	for(unsigned int i = 0; i < agent.num_clients; ++i)
+	{
+		if(agent.clients[i].pid > 0) { kill(agent.clients[i].pid, SIGKILL); }
+		close(agent.clients[i].fd);
+	}
+	unlinkat(dir_fd, socket_name, 0);
+	if(signal_fd >= 0) { close(signal_fd); }
+	free(pollfds);
+	free(agent.clients);
+	free(agent.buf);
+
+	return exit_code;
+}
+
+// The agent is a sibling of the sandbox which joins its namespaces once
+// it is set up, commands then start without going through hako-enter
+static pid_t
+spawn_agent(
+	const struct run_ctx_s* defaults,
+	pid_t sandbox_pid,
+	const char* socket_path
+)
+{
+	pid_t pid = -1;
+	int listen_fd = -1;
+	int dir_fd = -1;
+	int pidfd = -1;
+	char path[PATH_MAX];
+
+	if(strlen(socket_path) >= sizeof(path))
+	{
+		fprintf(stderr, "Socket path is too long: %s\n", socket_path);
+		goto quit;
+	}
+
+	strcpy(path, socket_path);
+	dir_fd = open(dirname(path), O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if(dir_fd == -1)
+	{
+		fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+		goto quit;
+	}
+
+	pidfd = syscall(__NR_pidfd_open, sandbox_pid, 0);
+	if(pidfd == -1)
+	{
+		perror("pidfd_open() failed");
+		goto quit;
+	}
+
+	listen_fd = create_listener(socket_path);
+	if(listen_fd == -1) { goto quit; }
+
+	pid_t parent_pid = getpid();
+	pid = fork();
+	if(pid == 0)
+	{
+		// Clean up when hako-run goes away
+		if(prctl(PR_SET_PDEATHSIG, SIGTERM, 0, 0, 0) == -1
+			|| getppid() != parent_pid)
+		{
+			_exit(EXIT_FAILURE);
+		}
+
+		if(setns(
+			pidfd,
+			CLONE_NEWNS | CLONE_NEWPID | CLONE_NEWIPC | CLONE_NEWUTS
+			| CLONE_NEWNET
+		) == -1)
+		{
+			perror("Could not enter sandbox");
+			unlinkat(dir_fd, basename(strcpy(path, socket_path)), 0);
+			_exit(EXIT_FAILURE);
+		}
+		close(pidfd);
+
+		strcpy(path, socket_path);
+		_exit(run_agent(defaults, listen_fd, dir_fd, basename(path)));
+	}
+	else if(pid == -1)
+	{
+		perror("fork() failed");
+		unlink(socket_path);
+	}
+
+quit:
+	if(listen_fd >= 0) { close(listen_fd); }
+	if(dir_fd >= 0) { close(dir_fd); }
+	if(pidfd >= 0) { close(pidfd); }
+
+	return pid;
+}
+
+static void
+cleanup_sandbox_cache(struct sandbox_cache_s* cache)
+{
+	cleanup_mount_manifest(&cache->manifest);
+	free(cache->sandbox_dir);
+	cache->sandbox_dir = NULL;
+}
+
+static bool
+load_sandbox_cache(struct sandbox_cache_s* cache, const char* sandbox_dir)
+{
+	if(cache->sandbox_dir != NULL && strcmp(cache->sandbox_dir, sandbox_dir) == 0)
+	{
+		return true;
+	}
+
+	cleanup_sandbox_cache(cache);
+	if(!load_mount_manifest(sandbox_dir, &cache->manifest)) { return false; }
+
+	cache->sandbox_dir = strdup(sandbox_dir);
+	cache->has_init = find_init(sandbox_dir, &cache->manifest);
+	return true;
+}
+
+// A job is given as "[options] <target> [command] [args]" where options are
+// the run ctx ones, errors are prefixed with context.
+// index picks the CPU or node of automatic placement.
+// Without CLONE_VFORK, the child has its own copy of the configuration and
+// sandboxes are set up in parallel.
+static pid_t
+spawn_job(
+	const struct sandbox_cfg_s* defaults,
+	struct sandbox_cache_s* cache,
+	const char* context,
+	unsigned int index,
+	int argc,
+	char** argv,
+	int* stdio,
+	int* pidfd
+)
+{
+	struct optparse_long opts[] = {
+		RUN_CTX_OPTS,
+		{0}
+	};
+
+	int option;
+	pid_t pid = -1;
+	struct optparse options;
+	struct run_ctx_s run_ctx;
+	init_run_ctx(&run_ctx, argc);
+	optparse_init(&options, argv);
+	options.permute = 0;
+
+	while((option = optparse_long(&options, opts, NULL)) != -1)
+	{
+		if(option == '?')
+		{
+			fprintf(stderr, PROG_NAME ": %s: %s\n", context, options.errmsg);
+			goto quit;
+		}
+
+		if(!parse_run_option(&run_ctx, PROG_NAME, option, options.optarg))
+		{
+			goto quit;
+		}
+	}
+
+	const char* sandbox_dir = parse_run_command(&run_ctx, &options);
+	if(sandbox_dir == NULL)
+	{
+		fprintf(stderr, PROG_NAME ": %s: must provide sandbox dir\n", context);
+		goto quit;
+	}
+
+	if(!load_sandbox_cache(cache, sandbox_dir)) { goto quit; }
+
+	struct sandbox_cfg_s sandbox_cfg = *defaults;
+	sandbox_cfg.sandbox_dir = sandbox_dir;
+	sandbox_cfg.root_dir = sandbox_dir;
+	sandbox_cfg.manifest = cache->manifest;
+	sandbox_cfg.has_init = cache->has_init;
+	sandbox_cfg.stdio = stdio;
+	sandbox_cfg.run_ctx = run_ctx;
+	sandbox_cfg.run_ctx.seccomp = defaults->run_ctx.seccomp;
+	if(!resolve_placement(&sandbox_cfg.placement, index)) { goto quit; }
+
+	pid = spawn_sandbox(&sandbox_cfg, 0, pidfd);
+	if(pid == -1) { perror("clone() failed"); }
+
+quit:
+	cleanup_run_ctx(&run_ctx);
+	return pid;
+}
+
+// Words are separated by blanks, there is no quoting
+static char**
+split_job_line(char* line, int* argc)
+{
+	char** argv = calloc(strlen(line) / 2 + 3, sizeof(char*));
+	if(argv == NULL) { return NULL; }
+
+	*argc = 0;
+	argv[(*argc)++] = PROG_NAME;
+	char* saveptr;
+	for(char* word = strtok_r(line, " \t\r\n", &saveptr);
+		word != NULL;
+		word = strtok_r(NULL, " \t\r\n", &saveptr))
+	{
+		argv[(*argc)++] = word;
+	}
+
+	return argv;
+}
+
+static bool
+start_batch_job(
+	struct batch_s* batch,
+	struct batch_job_s* job,
+	unsigned int slot,
+	int argc,
+	char** argv
+)
+{
+	char context[32];
+	snprintf(context, sizeof(context), "line %u", batch->line);
+
+	job->start = trace_now();
+	job->pid = spawn_job(
+		batch->defaults, &batch->cache, context, slot, argc, argv, NULL,
+		&job->pidfd
+	);
+	if(job->pid == -1)
+	{
+		job->pid = 0;
+		return false;
+	}
+
+	job->line = batch->line;
+	return true;
+}
+
+// Jobs which cannot be started count as failed
+static bool
+fill_batch_slot(struct batch_s* batch, struct batch_job_s* job, unsigned int slot)
+{
+	while(!batch->eof)
+	{
+		if(getline(&batch->line_buf, &batch->line_size, batch->file) == -1)
+		{
+			batch->eof = true;
+			break;
+		}
+
+		++batch->line;
+		char* line = batch->line_buf + strspn(batch->line_buf, " \t\r\n");
+		if(line[0] == '#' || line[0] == '\0') { continue; }
+
+		++batch->num_jobs;
+		int argc;
+		char** argv = split_job_line(line, &argc);
+		bool started = argv != NULL
+			&& start_batch_job(batch, job, slot, argc, argv);
+		free(argv);
+		if(started) { return true; }
+
+		fprintf(
+			stderr, PROG_NAME ": line %u: could not start job\n", batch->line
+		);
+		++batch->num_failed;
+	}
+
+	return false;
+}
+
+// Children share the pidfds of their siblings until they exec, closing one
+// does not remove it from the epoll set
+static void
+finish_batch_job(struct batch_s* batch, struct batch_job_s* job, int epoll_fd)
+{
+	int status = 0;
+	struct rusage rusage = { 0 };
+	while(wait4(job->pid, &status, 0, &rusage) == -1 && errno == EINTR) { }
+	uint64_t time = trace_now() - job->start;
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, job->pidfd, NULL);
+	close(job->pidfd);
+
+	int exit_code = WIFEXITED(status) ?
+		WEXITSTATUS(status) : (128 + WTERMSIG(status));
+
+	// Jobs share the cgroup, only their own usage tells them apart
+	if(batch->stats_fd >= 0)
+	{
+		char id[64];
+		snprintf(
+			id, sizeof(id), "\"job\":%u,\"pid\":%" PRIdMAX,
+			job->line, (intmax_t)job->pid
+		);
+		write_usage(batch->stats_fd, id, exit_code, time, &rusage, -1, -1, NULL);
+	}
+
+	job->pid = 0;
+	if(exit_code != 0)
+	{
+		fprintf(
+			stderr, PROG_NAME ": line %u: exited with %d\n", job->line, exit_code
+		);
+		++batch->num_failed;
+	}
+
+	if(batch->min_time == 0 || time < batch->min_time) { batch->min_time = time; }
+	if(time > batch->max_time) { batch->max_time = time; }
+	batch->total_time += time;
+	++batch->num_finished;
+}
+
+// Every job is supervised from a single epoll loop through its pidfd
+static int
+run_batch(
+	const struct sandbox_cfg_s* defaults,
+	const char* batch_path,
+	unsigned int max_jobs,
+	int stats_fd
+)
+{
+	int exit_code = EXIT_SUCCESS;
+	int epoll_fd = -1;
+	int signal_fd = -1;
+	int null_fd = -1;
+	unsigned int num_running = 0;
+	uint64_t batch_start = trace_now();
+	struct epoll_event* events = calloc(
+		max_jobs + 1, sizeof(struct epoll_event)
+	);
+	struct batch_job_s* jobs = calloc(max_jobs, sizeof(struct batch_job_s));
+	struct batch_s batch = { .defaults = defaults, .stats_fd = stats_fd };
+	if(events == NULL || jobs == NULL)
+	{
+		perror("Could not allocate jobs");
+		quit(EXIT_FAILURE);
+	}
+
+	batch.file = strcmp(batch_path, "-") == 0 ?
+		fdopen(dup(STDIN_FILENO), "r") : fopen(batch_path, "re");
+	if(batch.file == NULL)
+	{
+		fprintf(stderr, "Could not open %s: %s\n", batch_path, strerror(errno));
+		quit(EXIT_FAILURE);
+	}
+
+	// Jobs run concurrently, none of them gets the terminal
+	null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	if(null_fd == -1 || dup2(null_fd, STDIN_FILENO) == -1)
+	{
+		perror("Could not redirect stdin");
+		quit(EXIT_FAILURE);
+	}
+
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGHUP);
+	sigaddset(&set, SIGQUIT);
+	sigprocmask(SIG_BLOCK, &set, NULL);
+	signal_fd = signalfd(-1, &set, SFD_CLOEXEC);
+	if(signal_fd == -1)
+	{
+		perror("signalfd() failed");
+		quit(EXIT_FAILURE);
+	}
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if(epoll_fd == -1)
+	{
+		perror("epoll_create1() failed");
+		quit(EXIT_FAILURE);
+	}
+
+	// Slot indices identify jobs, the signalfd comes after the last one
+	struct epoll_event event = { .events = EPOLLIN, .data.u32 = max_jobs };
+	if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &event) == -1)
+	{
+		perror("epoll_ctl() failed");
+		quit(EXIT_FAILURE);
+	}
+
+	for(;;)
+	{
+		// Keep every slot busy while there are jobs left
+		for(unsigned int slot = 0; slot < max_jobs && !batch.eof; ++slot)
+		{
+			struct batch_job_s* job = &jobs[slot];
+			if(job->pid != 0 || !fill_batch_slot(&batch, job, slot)) { continue; }
+
+			event = (struct epoll_event){ .events = EPOLLIN, .data.u32 = slot };
+			if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, job->pidfd, &event) == -1)
+			{
+				perror("epoll_ctl() failed");
+				quit(EXIT_FAILURE);
+			}
+
+			++num_running;
+		}
+
+		if(num_running == 0) { break; }
+
+		int num_events = epoll_wait(epoll_fd, events, max_jobs + 1, -1);
+		if(num_events == -1 && errno != EINTR)
+		{
+			perror("epoll_wait() failed");
+			quit(EXIT_FAILURE);
+		}
+
+		for(int i = 0; i < num_events; ++i)
+		{
+			if(events[i].data.u32 < max_jobs)
+			{
+				finish_batch_job(&batch, &jobs[events[i].data.u32], epoll_fd);
+				--num_running;
+				continue;
+			}
+
+			struct signalfd_siginfo info;
+			if(read(signal_fd, &info, sizeof(info)) == sizeof(info))
+			{
+				quit(128 + info.ssi_signo);
+			}
+		}
+	}
+
+	uint64_t elapsed = trace_now() - batch_start;
+	fprintf(
+		stderr, PROG_NAME ": %u jobs, %u succeeded, %u failed in %.3f s\n",
+		batch.num_jobs, batch.num_jobs - batch.num_failed, batch.num_failed,
+		elapsed / 1e9
+	);
+	if(batch.num_finished > 0)
+	{
+		fprintf(
+			stderr, PROG_NAME ": wall time (ms): min %.3f, avg %.3f, max %.3f\n",
+			batch.min_time / 1e6, batch.total_time / 1e6 / batch.num_finished,
+			batch.max_time / 1e6
+		);
+	}
+
+	exit_code = batch.num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+quit:
+	for(unsigned int i = 0; jobs != NULL && i < max_jobs; ++i)
+	{
+		if(jobs[i].pid == 0) { continue; }
+
+		kill(jobs[i].pid, SIGKILL);
+		waitpid(jobs[i].pid, NULL, 0);
+		close(jobs[i].pidfd);
+	}
+	if(batch.file != NULL) { fclose(batch.file); }
+	if(null_fd >= 0) { close(null_fd); }
+	if(signal_fd >= 0) { close(signal_fd); }
+	if(epoll_fd >= 0) { close(epoll_fd); }
+	cleanup_sandbox_cache(&batch.cache);
+	free(batch.line_buf);
+	free(jobs);
+	free(events);
+
+	return exit_code;
+}
+
+static __attribute__((format(printf, 2, 3))) bool
+daemon_reply(int fd, const char* format, ...)
+{
+	char reply[256];
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(reply, sizeof(reply), format, args);
+	va_end(args);
+	if(len >= (int)sizeof(reply)) { len = sizeof(reply) - 1; }
+
+	return send(fd, reply, len, MSG_NOSIGNAL) == len;
+}
+
+static bool
+watch_daemon_fd(
+	struct daemon_s* daemon, int op, int fd, uint32_t events, void* watch
+)
+{
+	struct epoll_event event = { .events = events, .data.ptr = watch };
+	if(epoll_ctl(daemon->epoll_fd, op, fd, &event) == -1)
+	{
+		perror("epoll_ctl() failed");
+		return false;
+	}
+
+	return true;
+}
+
+static struct daemon_sandbox_s*
+find_daemon_sandbox(struct daemon_s* daemon, const char* name)
+{
+	for(struct daemon_sandbox_s* sandbox = daemon->sandboxes;
+		sandbox != NULL;
+		sandbox = sandbox->next)
+	{
+		if(strcmp(sandbox->name, name) == 0) { return sandbox; }
+	}
+
+	return NULL;
+}
+
+static void
+remove_daemon_sandbox(struct daemon_s* daemon, struct daemon_sandbox_s* sandbox)
+{
+	struct daemon_sandbox_s** link = &daemon->sandboxes;
+	while(*link != sandbox) { link = &(*link)->next; }
+	*link = sandbox->next;
+
+	if(sandbox->pidfd >= 0)
+	{
+		kill(sandbox->pid, SIGKILL);
+		waitpid(sandbox->pid, NULL, 0);
+		epoll_ctl(daemon->epoll_fd, EPOLL_CTL_DEL, sandbox->pidfd, NULL);
+		close(sandbox->pidfd);
+	}
+	free(sandbox);
+}
+
+static void
+remove_daemon_client(struct daemon_s* daemon, struct daemon_client_s* client)
+{
+	struct daemon_client_s** link = &daemon->clients;
+	while(*link != client) { link = &(*link)->next; }
+	*link = client->next;
+
+	epoll_ctl(daemon->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+	close(client->fd);
+	free(client);
+}
+
+static bool
+handle_start_request(
+	struct daemon_s* daemon,
+	struct daemon_client_s* client,
+	int num_words,
+	char** words,
+	int* stdio
+)
+{
+	const char* name = words[1];
+	if(name == NULL || name[0] == '\0' || strlen(name) >= HAKO_MAX_NAME
+		|| strpbrk(name, " \t\n") != NULL)
+	{
+		return daemon_reply(client->fd, "error invalid name");
+	}
+
+	if(find_daemon_sandbox(daemon, name) != NULL)
+	{
+		return daemon_reply(client->fd, "error %s already exists", name);
+	}
+
+	struct daemon_sandbox_s* sandbox = calloc(1, sizeof(struct daemon_sandbox_s));
+	if(sandbox == NULL)
+	{
+		perror("Could not allocate sandbox");
+		return daemon_reply(client->fd, "error out of memory");
+	}
+
+	sandbox->watch = WATCH_SANDBOX;
+	strcpy(sandbox->name, name);
+
+	// The job's arguments start after the name, which stands for argv[0]
+	words[1] = PROG_NAME;
+	sandbox->pid = spawn_job(
+		daemon->defaults, &daemon->cache, sandbox->name, daemon->num_started++,
+		num_words - 1, words + 1, stdio, &sandbox->pidfd
+	);
+	if(sandbox->pid == -1)
+	{
+		free(sandbox);
+		return daemon_reply(client->fd, "error could not start %s", name);
+	}
+
+	sandbox->next = daemon->sandboxes;
+	daemon->sandboxes = sandbox;
+	if(!watch_daemon_fd(daemon, EPOLL_CTL_ADD, sandbox->pidfd, EPOLLIN, sandbox))
+	{
+		remove_daemon_sandbox(daemon, sandbox);
+		return daemon_reply(client->fd, "error could not watch %s", name);
+	}
+
+	return daemon_reply(client->fd, "ok %d", (int)sandbox->pid);
+}
+
+static bool
+handle_stop_request(
+	struct daemon_s* daemon, struct daemon_client_s* client, char** words
+)
+{
+	// The command is pid 1 of its sandbox, SIGTERM only works with a handler
+	long sig = SIGKILL;
+	struct daemon_sandbox_s* sandbox = find_daemon_sandbox(daemon, words[1]);
+	if(sandbox == NULL || sandbox->pidfd < 0)
+	{
+		return daemon_reply(client->fd, "error %s is not running", words[1]);
+	}
+
+	if(words[2] != NULL && (!strtonum(words[2], &sig) || sig <= 0 || sig >= NSIG))
+	{
+		return daemon_reply(client->fd, "error invalid signal %s", words[2]);
+	}
+
+	if(kill(sandbox->pid, sig) == -1)
+	{
+		return daemon_reply(client->fd, "error %s", strerror(errno));
+	}
+
+	return daemon_reply(client->fd, "ok");
+}
+
+// Long lists are split on line boundaries
+static bool
+handle_list_request(struct daemon_s* daemon, struct daemon_client_s* client)
+{
+	unsigned int num_sandboxes = 0;
+	for(struct daemon_sandbox_s* sandbox = daemon->sandboxes;
+		sandbox != NULL;
+		sandbox = sandbox->next)
+	{
+		++num_sandboxes;
+	}
+
+	char* buf = daemon->buf;
+	int len = snprintf(buf, HAKO_MAX_MSG, "ok %u\n", num_sandboxes);
+	for(struct daemon_sandbox_s* sandbox = daemon->sandboxes;
+		sandbox != NULL;
+		sandbox = sandbox->next)
+	{
+		char line[HAKO_MAX_NAME + 64];
+		int line_len = sandbox->pidfd >= 0 ?
+			snprintf(
+				line, sizeof(line), "%s %d running\n",
+				sandbox->name, (int)sandbox->pid
+			) :
+			snprintf(
+				line, sizeof(line), "%s %d exited %d\n",
+				sandbox->name, (int)sandbox->pid, sandbox->exit_code
+			);
+
+		if(len + line_len > HAKO_MAX_MSG)
+		{
+			if(send(client->fd, buf, len, MSG_NOSIGNAL) != len) { return false; }
+			len = 0;
+		}
+
+		memcpy(buf + len, line, line_len);
+		len += line_len;
+	}
+
+	return send(client->fd, buf, len, MSG_NOSIGNAL) == len;
+}
+
+static bool
+handle_wait_request(
+	struct daemon_s* daemon, struct daemon_client_s* client, char** words
+)
+{
+	struct daemon_sandbox_s* sandbox = find_daemon_sandbox(daemon, words[1]);
+	if(sandbox == NULL)
+	{
+		return daemon_reply(client->fd, "error %s does not exist", words[1]);
+	}
+
+	if(sandbox->pidfd < 0)
+	{
+		int exit_code = sandbox->exit_code;
+		remove_daemon_sandbox(daemon, sandbox);
+		return daemon_reply(client->fd, "ok %d", exit_code);
+	}
+
+	// Only a hangup can come until the sandbox exits
+	client->waiting = sandbox;
+	return watch_daemon_fd(daemon, EPOLL_CTL_MOD, client->fd, EPOLLRDHUP, client);
+}
+
+static bool
+handle_daemon_request(struct daemon_s* daemon, struct daemon_client_s* client)
+{
+	int stdio[HAKO_NUM_STDIO];
+	char* buf = daemon->buf;
+	ssize_t len = recv_msg_fds(
+		client->fd, buf, HAKO_MAX_MSG, stdio, HAKO_NUM_STDIO
+	);
+	if(len == -1 && errno == EAGAIN) { return true; }
+	if(len <= 0) { return false; }
+
+	bool keep = true;
+	char** words = NULL;
+	int num_words = 0;
+	if(buf[len - 1] != '\0')
+	{
+		keep = daemon_reply(client->fd, "error invalid request");
+		goto quit;
+	}
+
+	for(ssize_t i = 0; i < len; ++i) { num_words += buf[i] == '\0'; }
+	words = calloc(num_words + 1, sizeof(char*));
+	if(words == NULL)
+	{
+		perror("Could not allocate request");
+		keep = daemon_reply(client->fd, "error out of memory");
+		goto quit;
+	}
+
+	num_words = 0;
+	for(char* word = buf; word < buf + len; word += strlen(word) + 1)
+	{
+		words[num_words++] = word;
+	}
+
+	// Sandboxes get their own copy of the descriptors
+	if(strcmp(words[0], "start") == 0 && num_words >= 3)
+	{
+		keep = handle_start_request(daemon, client, num_words, words, stdio);
+	}
+	else if(strcmp(words[0], "stop") == 0 && (num_words == 2 || num_words == 3))
+	{
+		keep = handle_stop_request(daemon, client, words);
+	}
+	else if(strcmp(words[0], "list") == 0 && num_words == 1)
+	{
+		keep = handle_list_request(daemon, client);
+	}
+	else if(strcmp(words[0], "wait") == 0 && num_words == 2)
+	{
+		keep = handle_wait_request(daemon, client, words);
+	}
+	else
+	{
+		keep = daemon_reply(client->fd, "error invalid request");
+	}
+
+quit:
+	for(unsigned int i = 0; i < HAKO_NUM_STDIO; ++i)
+	{
+		if(stdio[i] >= 0) { close(stdio[i]); }
+	}
+	free(words);
+
+	return keep;
+}
+
+// Waiting clients get the exit code, the sandbox is forgotten if there was any
+static void
+finish_daemon_sandbox(struct daemon_s* daemon, struct daemon_sandbox_s* sandbox)
+{
+	int status = 0;
+	while(waitpid(sandbox->pid, &status, 0) == -1 && errno == EINTR) { }
+	epoll_ctl(daemon->epoll_fd, EPOLL_CTL_DEL, sandbox->pidfd, NULL);
+	close(sandbox->pidfd);
+	sandbox->pidfd = -1;
+	sandbox->exit_code = WIFEXITED(status) ?
+		WEXITSTATUS(status) : (128 + WTERMSIG(status));
+
+	bool waited = false;
+	for(struct daemon_client_s* client = daemon->clients;
+		client != NULL;
+		client = client->next)
+	{
+		if(client->waiting != sandbox) { continue; }
+
+		client->waiting = NULL;
+		daemon_reply(client->fd, "ok %d", sandbox->exit_code);
+		watch_daemon_fd(daemon, EPOLL_CTL_MOD, client->fd, EPOLLIN, client);
+		waited = true;
+	}
+
+	if(waited) { remove_daemon_sandbox(daemon, sandbox); }
+}
+
+// Children share the descriptors of the daemon until they exec, so every
+// descriptor is explicitly removed from the epoll set before being closed
+static int
+run_daemon(const struct sandbox_cfg_s* defaults, const char* socket_path)
+{
+	int exit_code = EXIT_SUCCESS;
+	int listen_fd = -1;
+	int signal_fd = -1;
+	enum daemon_watch_e listener_watch = WATCH_LISTENER;
+	enum daemon_watch_e signal_watch = WATCH_SIGNAL;
+	struct epoll_event events[64];
+	struct daemon_s daemon = {
+		.defaults = defaults,
+		.epoll_fd = -1,
+		.buf = malloc(HAKO_MAX_MSG)
+	};
+	if(daemon.buf == NULL)
+	{
+		perror("Could not allocate daemon");
+		quit(EXIT_FAILURE);
+	}
+
+	listen_fd = create_listener(socket_path);
+	if(listen_fd == -1) { quit(EXIT_FAILURE); }
+
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGHUP);
+	sigaddset(&set, SIGQUIT);
+	sigprocmask(SIG_BLOCK, &set, NULL);
+	signal_fd = signalfd(-1, &set, SFD_CLOEXEC);
+	if(signal_fd == -1)
+	{
+		perror("signalfd() failed");
+		quit(EXIT_FAILURE);
+	}
+
+	daemon.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if(daemon.epoll_fd == -1)
+	{
+		perror("epoll_create1() failed");
+		quit(EXIT_FAILURE);
+	}
+
+	if(!watch_daemon_fd(
+			&daemon, EPOLL_CTL_ADD, listen_fd, EPOLLIN, &listener_watch
+		)
+		|| !watch_daemon_fd(
+			&daemon, EPOLL_CTL_ADD, signal_fd, EPOLLIN, &signal_watch
+		))
+	{
+		quit(EXIT_FAILURE);
+	}
+
+	for(;;)
+	{
+		int num_events = epoll_wait(
+			daemon.epoll_fd, events, sizeof(events) / sizeof(events[0]), -1
+		);
+		if(num_events == -1 && errno != EINTR)
+		{
+			perror("epoll_wait() failed");
+			quit(EXIT_FAILURE);
+		}
+
+		for(int i = 0; i < num_events; ++i)
+		{
+			void* watch = events[i].data.ptr;
+			struct daemon_client_s* client = watch;
+			switch(*(enum daemon_watch_e*)watch)
+			{
+				case WATCH_LISTENER:
+					client = calloc(1, sizeof(struct daemon_client_s));
+					if(client == NULL)
+					{
+						perror("Could not allocate client");
+						break;
+					}
+
+					client->watch = WATCH_CLIENT;
+					client->fd = accept4(
+						listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC
+					);
+					if(client->fd == -1)
+					{
+						perror("accept4() failed");
+						free(client);
+						break;
+					}
+
+					client->next = daemon.clients;
+					daemon.clients = client;
+					if(!watch_daemon_fd(
+						&daemon, EPOLL_CTL_ADD, client->fd, EPOLLIN, client
+					))
+					{
+						remove_daemon_client(&daemon, client);
+					}
+					break;
+				case WATCH_SIGNAL:
+				{
+					// Like hako-run, take every sandbox down
+					struct signalfd_siginfo info;
+					if(read(signal_fd, &info, sizeof(info)) == sizeof(info))
+					{
+						quit(128 + info.ssi_signo);
+					}
+					break;
+				}
+				case WATCH_SANDBOX:
+					finish_daemon_sandbox(&daemon, watch);
+					break;
+				case WATCH_CLIENT:
+					if(client->waiting != NULL
+						|| !handle_daemon_request(&daemon, client))
+					{
+						remove_daemon_client(&daemon, client);
+					}
+					break;
+			}
+		}
+	}
+
+quit:
+	while(daemon.clients != NULL)
+	{
+		remove_daemon_client(&daemon, daemon.clients);
+	}
+	while(daemon.sandboxes != NULL)
+	{
+		remove_daemon_sandbox(&daemon, daemon.sandboxes);
+	}
+	if(listen_fd >= 0)
+	{
+		close(listen_fd);
+		unlink(socket_path);
+	}
+	if(signal_fd >= 0) { close(signal_fd); }
+	if(daemon.epoll_fd >= 0) { close(daemon.epoll_fd); }
+	cleanup_sandbox_cache(&daemon.cache);
+	free(daemon.buf);
+
+	return exit_code;
+}
+
+static bool
+setup_logs(
+	const char* log_dir, uint64_t size, struct log_stream_s* logs, int* stdio
+)
+{
+	const char* names[LOG_NUM_STREAMS] = { "stdout", "stderr" };
+
+	if(mkdir(log_dir, 0755) == -1 && errno != EEXIST)
+	{
+		fprintf(stderr, "Could not create %s: %s\n", log_dir, strerror(errno));
+		return false;
+	}
+
+	int dir_fd = open(log_dir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if(dir_fd == -1)
+	{
+		fprintf(stderr, "Could not open %s: %s\n", log_dir, strerror(errno));
+		return false;
+	}
+
+	bool ready = true;
+	for(int i = 0; i < LOG_NUM_STREAMS && ready; ++i)
+	{
+		int fds[2];
+		ready = create_log_ring(&logs[i].ring, dir_fd, names[i], size);
+		if(ready && pipe2(fds, O_CLOEXEC) == -1)
+		{
+			perror("pipe2() failed");
+			ready = false;
+		}
+		if(!ready) { break; }
+
+		// The command blocks only when the supervisor falls behind
+		fcntl(fds[0], F_SETPIPE_SZ, LOG_PIPE_SIZE);
+		fcntl(fds[0], F_SETFL, O_NONBLOCK);
+		logs[i].fd = fds[0];
+		logs[i].line_start = true;
+		stdio[STDOUT_FILENO + i] = fds[1];
+	}
+
+	close(dir_fd);
+	return ready;
+}
+
+// Takes all that is in the pipe
+static void
+drain_log(struct log_stream_s* log)
+{
+	char buf[LOG_CHUNK];
+	for(;;)
+	{
+		ssize_t len = read(log->fd, buf, sizeof(buf));
+		if(len > 0)
+		{
+			append_log(&log->ring, &log->line_start, buf, len);
+			continue;
+		}
+		if(len == -1 && errno == EINTR) { continue; }
+		if(len == -1 && errno == EAGAIN) { return; }
+
+		close(log->fd);
+		log->fd = -1;
+		return;
+	}
+}
+
+static void
+cleanup_log(struct log_stream_s* log)
+{
+	if(log->fd >= 0) { close(log->fd); }
+	if(log->ring.header != NULL)
+	{
+		__atomic_store_n(&log->ring.header->closed, 1, __ATOMIC_RELEASE);
+	}
+	cleanup_log_ring(&log->ring);
+}
+
+int
+main(int argc, char* argv[])
+{
+	(void)argc;
+
+	int exit_code = EXIT_SUCCESS;
+
+	struct optparse_long opts[] = {
+		{"help", 'h', OPTPARSE_NONE},
+		{"writable", 'W', OPTPARSE_NONE},
+		{"network", 'N', OPTPARSE_OPTIONAL},
+		{"ipc", 'I', OPTPARSE_OPTIONAL},
+		{"shm", 'H', OPTPARSE_REQUIRED},
+		{"pid-file", 'p', OPTPARSE_REQUIRED},
+		{"zygote", 'z', OPTPARSE_REQUIRED},
+		{"pool", 'P', OPTPARSE_REQUIRED},
+		{"agent", 'a', OPTPARSE_REQUIRED},
+		{"overlay", 'o', OPTPARSE_OPTIONAL},
+		{"image", 'i', OPTPARSE_REQUIRED},
+		{"cgroup", 'C', OPTPARSE_REQUIRED},
+		{"memory-max", 'm', OPTPARSE_REQUIRED},
+		{"cpu-max", 'q', OPTPARSE_REQUIRED},
+		{"pids-max", 'L', OPTPARSE_REQUIRED},
+		{"batch", 'b', OPTPARSE_REQUIRED},
+		{"jobs", 'j', OPTPARSE_REQUIRED},
+		{"daemon", 'D', OPTPARSE_REQUIRED},
+		{"cpus", 'U', OPTPARSE_REQUIRED},
+		{"numa-node", 'M', OPTPARSE_REQUIRED},
+		{"mempolicy", 'Y', OPTPARSE_REQUIRED},
+		{"seccomp", 's', OPTPARSE_REQUIRED},
+		{"pty", 't', OPTPARSE_NONE},
+		{"log", 'l', OPTPARSE_REQUIRED},
+		{"log-size", 'R', OPTPARSE_REQUIRED},
+		{"persist", 'k', OPTPARSE_REQUIRED},
+		{"from", 'f', OPTPARSE_REQUIRED},
+		{"stats", 'x', OPTPARSE_REQUIRED},
+		{"init", 'n', OPTPARSE_NONE},
+		{"pause", 'w', OPTPARSE_NONE},
+		{"ready-fd", 'r', OPTPARSE_REQUIRED},
+		{"notify-socket", 'y', OPTPARSE_REQUIRED},
+		{"listen", 'B', OPTPARSE_REQUIRED},
+		{"pass-fd", 'd', OPTPARSE_REQUIRED},
+		{"net-lo", 'E', OPTPARSE_NONE},
+		{"veth", 'v', OPTPARSE_REQUIRED},
+		TRACE_OPTS,
+		RUN_CTX_OPTS,
+		{0}
+	};
+
+	const char* help[] = {
+		NULL, "Print this message",
+		NULL, "Make sandbox root filesystem writable",
+		"FILE", "Set sandbox's network namespace (default: host)",
+		"FILE", "Set sandbox's IPC namespace (default: host)",
+		"NAME:SIZE[:hugepages]", "Mount a shared memory region on /dev/shm/NAME",
+		"FILE", "Write pid of sandbox to this file",
+		"SOCKET", "Serve commands from a pool of warm sandboxes",
+		"N", "Number of warm sandboxes in zygote mode (default: 4)",
+		"SOCKET", "Serve commands inside the running sandbox",
+		"UPPER", "Write to an overlay on top of the sandbox (default: tmpfs)",
+		"FILE", "Use an erofs or squashfs image as root, mounted on <target>",
+		"DIR", "Run sandbox in this cgroup v2, created if needed",
+		"BYTES", "Set memory.max of the cgroup",
+		"QUOTA PERIOD", "Set cpu.max of the cgroup (e.g: \"50000 100000\")",
+		"N", "Set pids.max of the cgroup",
+		"FILE", "Run the jobs listed in this file, one per line (- for stdin)",
+		"N", "Number of jobs running at once in batch mode (default: CPUs)",
+		"SOCKET", "Start and supervise sandboxes on requests from hako-ctl",
+		"LIST", "Run on these CPUs (e.g: 0-3,8), auto gives each job its own",
+		"N", "Run on this NUMA node, auto spreads jobs across nodes",
+		"POLICY", "Memory policy: bind, preferred, interleave or local",
+		"FILE", "Filter syscalls of the command with this seccomp policy",
+		NULL, "Run the command in a new pseudo-terminal",
+		"DIR", "Keep the output of the command in ring files in this directory",
+		"SIZE", "Size of each log ring, with a K, M or G suffix (default: 1M)",
+		"DIR", "Keep the namespaces of the sandbox in this directory",
+		"DIR", "Run in the namespaces kept by --persist instead of a <target>",
+		"FILE|fd:N", "Append resource usage as JSON once the command exits",
+		NULL, "Run a built-in init as pid 1 to reap orphans and forward signals",
+		NULL, "Run only the built-in init, to keep the sandbox for hako-enter",
+		"N", "Write the pid and readiness events of the sandbox to this fd",
+		"PATH", "Receive sd_notify messages on this socket in the sandbox",
+		"[HOST:]PORT", "Pass a TCP listener to the command, as in LISTEN_FDS",
+		"N", "Pass this listening socket to the command, as in LISTEN_FDS",
+		NULL, "Bring the loopback of the sandbox's network namespace up",
+		"HOSTIF:ADDR/PREFIX[:GW]", "Link the sandbox to the host with a veth pair",
+		TRACE_HELP,
+		RUN_CTX_HELP,
+	};
+
+	const char* usage =
+		"Usage: " PROG_NAME " [options] <target> [command] [args]\n"
+		"       " PROG_NAME " [options] --from <dir> [command] [args]\n"
+		"       " PROG_NAME " [options] --batch <file>\n"
+		"       " PROG_NAME " [options] --daemon <socket>";
+
+	int option;
+	long num;
+	const char* pid_file = NULL;
+	const char* zygote_socket = NULL;
+	const char* agent_socket = NULL;
+	pid_t agent_pid = -1;
+	const char* image = NULL;
+	int image_fd = -1;
+	char image_root[64];
+	const char* cgroup = NULL;
+	struct cgroup_limit_s limits[] = {
+		{ "memory.max", "memory", NULL },
+		{ "cpu.max", "cpu", NULL },
+		{ "pids.max", "pids", NULL },
+	};
+	unsigned int num_limits = sizeof(limits) / sizeof(limits[0]);
+	unsigned int pool_size = 4;
+	const char* batch_file = NULL;
+	const char* daemon_socket = NULL;
+	const char* seccomp_policy = NULL;
+	struct sock_fprog seccomp = { 0 };
+	bool use_pty = false;
+	struct pty_s pty = { .master = -1, .slave = -1 };
+	int signal_fd = -1;
+	const char* log_dir = NULL;
+	uint64_t log_size = LOG_DEFAULT_SIZE;
+	struct log_stream_s logs[LOG_NUM_STREAMS] = { { .fd = -1 }, { .fd = -1 } };
+	struct shm_region_s shm_regions[MAX_SHM_REGIONS];
+	const char* persist_dir = NULL;
+	const char* from_dir = NULL;
+	int from_fds[NUM_PERSIST_NS];
+	unsigned int num_from_fds = 0;
+	const char* stats_output = NULL;
+	int stats_fd = -1;
+	struct usage_s cgroup_start = { 0 };
+	int peak_fd = -1;
+	int sync_pipe[2] = { -1, -1 };
+	long ready_fd_num = -1;
+	int ready_fd = -1;
+	char* notify_env = NULL;
+	struct listener_s listeners[MAX_LISTEN_FDS];
+	unsigned int num_listeners = 0;
+	int listen_fds[MAX_LISTEN_FDS];
+	char* listen_env[2] = { NULL, NULL };
+	struct veth_s veth;
+	int log_stdio[HAKO_NUM_STDIO] = { -1, -1, -1 };
+	long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int max_jobs = num_cpus > 0 ? (unsigned int)num_cpus : 1;
+	struct optparse options;
+	struct sandbox_cfg_s sandbox_cfg = {
+		.netns_flag = CLONE_NEWNET,
+		.ipcns_flag = CLONE_NEWIPC,
+		.shm_regions = shm_regions,
+		.tree_fd = -1,
+		.zygote_fd = -1,
+		.cgroup_fd = -1,
+		.pty_slave = -1,
+		.sync_fd = -1,
+		.notify_fd = -1,
+		.host_netns_fd = -1,
+		.host_netlink_fd = -1,
+		.placement = { .node = -1, .mempolicy = -1 },
+		.trace = { .fd = -1 }
+	};
+	struct placement_s* placement = &sandbox_cfg.placement;
+	init_run_ctx(&sandbox_cfg.run_ctx, argc);
+	optparse_init(&options, argv);
+	options.permute = 0;
+
+	while((option = optparse_long(&options, opts, NULL)) != -1)
+	{
+		switch(option)
+		{
+			case 'h':
+				optparse_help(usage, opts, help);
+				quit(EXIT_SUCCESS);
+				break;
+			case 'W':
+				sandbox_cfg.writable = true;
+				break;
+			case 'N':
+				sandbox_cfg.netns = options.optarg;
+				sandbox_cfg.netns_flag = 0;
+				break;
+			case 'I':
+				sandbox_cfg.ipcns = options.optarg;
+				sandbox_cfg.ipcns_flag = 0;
+				break;
+			case 'H':
+				if(sandbox_cfg.num_shm_regions == MAX_SHM_REGIONS)
+				{
+					fprintf(stderr, PROG_NAME ": too many shared memory regions\n");
+					quit(EXIT_FAILURE);
+				}
+
+				if(!parse_shm_region(
+					options.optarg, &shm_regions[sandbox_cfg.num_shm_regions++]
+				))
+				{
+					fprintf(
+						stderr, PROG_NAME ": invalid shared memory region: %s\n",
+						options.optarg
+					);
+					quit(EXIT_FAILURE);
+				}
+				break;
+			case 'p':
+				pid_file = options.optarg;
+				break;
+			case 'z':
+				zygote_socket = options.optarg;
+				break;
+			case 'a':
+				agent_socket = options.optarg;
+				break;
+			case 'i':
+				image = options.optarg;
+				break;
+			case 'C':
+				cgroup = options.optarg;
+				break;
+			case 'm':
+				limits[0].value = options.optarg;
+				break;
+			case 'q':
+				limits[1].value = options.optarg;
+				break;
+			case 'L':
+				limits[2].value = options.optarg;
+				break;
+			case 'o':
+				sandbox_cfg.overlay = options.optarg != NULL ? options.optarg : "";
+				sandbox_cfg.writable = true;
+				break;
+			case 'b':
+				batch_file = options.optarg;
+				break;
+			case 'D':
+				daemon_socket = options.optarg;
+				break;
+			case 's':
+				seccomp_policy = options.optarg;
+				break;
+			case 't':
+				use_pty = true;
+				break;
+			case 'k':
+				persist_dir = options.optarg;
+				break;
+			case 'f':
+				from_dir = options.optarg;
+				break;
+			case 'x':
+				stats_output = options.optarg;
+				break;
+			case 'n':
+				sandbox_cfg.builtin_init = true;
+				break;
+			case 'w':
+				sandbox_cfg.builtin_init = true;
+				sandbox_cfg.pause = true;
+				break;
+			case 'r':
+				if(strtonum(options.optarg, &num) && num >= 0 && num <= INT_MAX)
+				{
+					ready_fd_num = num;
+				}
+				else
+				{
+					fprintf(
+						stderr, PROG_NAME ": invalid ready fd: %s\n", options.optarg
+					);
+					quit(EXIT_FAILURE);
+				}
+				break;
+			case 'y':
+				if(options.optarg[0] != '/')
+				{
+					fprintf(
+						stderr, PROG_NAME ": notify socket must be an absolute path\n"
+					);
+					quit(EXIT_FAILURE);
+				}
+
+				sandbox_cfg.notify_path = options.optarg;
+				break;
+			case 'B':
+			case 'd':
+				if(num_listeners == MAX_LISTEN_FDS)
+				{
+					fprintf(stderr, PROG_NAME ": too many listening sockets\n");
+					quit(EXIT_FAILURE);
+				}
+
+				listeners[num_listeners] = (struct listener_s){
+					.addr = option == 'B' ? options.optarg : NULL,
+					.pass_fd = -1
+				};
+				if(option == 'd' && !(strtonum(options.optarg, &num)
+					&& num > STDERR_FILENO && num <= INT_MAX))
+				{
+					fprintf(
+						stderr, PROG_NAME ": invalid fd to pass: %s\n", options.optarg
+					);
+					quit(EXIT_FAILURE);
+				}
+				if(option == 'd') { listeners[num_listeners].pass_fd = num; }
+				++num_listeners;
+				break;
+			case 'E':
+				sandbox_cfg.net_lo = true;
+				break;
+			case 'v':
+				if(!parse_veth(options.optarg, &veth))
+				{
+					fprintf(stderr, PROG_NAME ": invalid veth: %s\n", options.optarg);
+					quit(EXIT_FAILURE);
+				}
+
+				sandbox_cfg.veth = &veth;
+				break;
+			case 'l':
+				log_dir = options.optarg;
+				break;
+			case 'R':
+				if(!parse_log_size(options.optarg, &log_size))
+				{
+					fprintf(
+						stderr, PROG_NAME ": invalid log size: %s\n",
+						options.optarg
+					);
+					quit(EXIT_FAILURE);
+				}
+				break;
+			case 'U':
+				placement->auto_cpus = strcmp(options.optarg, "auto") == 0;
+				placement->has_cpus = placement->auto_cpus
+					|| parse_cpu_list(options.optarg, &placement->cpus);
+				if(!placement->has_cpus)
+				{
+					fprintf(
+						stderr, PROG_NAME ": invalid CPU list: %s\n",
+						options.optarg
+					);
+					quit(EXIT_FAILURE);
+				}
+				break;
+			case 'M':
+				placement->auto_node = strcmp(options.optarg, "auto") == 0;
+				if(placement->auto_node) { break; }
+
+				if(strtonum(options.optarg, &num) && num >= 0)
+				{
+					placement->node = (int)num;
+				}
+				else
+				{
+					fprintf(
+						stderr, PROG_NAME ": invalid NUMA node: %s\n",
+						options.optarg
+					);
+					quit(EXIT_FAILURE);
+				}
+				break;
+			case 'Y':
+				placement->mempolicy = find_mempolicy(options.optarg);
+				if(placement->mempolicy < 0)
+				{
+					fprintf(
+						stderr, PROG_NAME ": invalid memory policy: %s\n",
+						options.optarg
+					);
+					quit(EXIT_FAILURE);
+				}
+				break;
+			case 'j':
+				if(strtonum(options.optarg, &num) && num > 0)
+				{
+					max_jobs = (unsigned int)num;
+				}
+				else
+				{
+					fprintf(
+						stderr, PROG_NAME ": invalid number of jobs: %s\n",
+						options.optarg
+					);
+					quit(EXIT_FAILURE);
+				}
+				break;
+			case 'P':
+				if(strtonum(options.optarg, &num) && num > 0)
+				{
+					pool_size = (unsigned int)num;
+				}
+				else
+				{
+					fprintf(
+						stderr, PROG_NAME ": invalid pool size: %s\n",
+						options.optarg
+					);
+					quit(EXIT_FAILURE);
+				}
+				break;
+			CASE_TRACE_OPT:
+				if(!parse_trace_option(
+					&sandbox_cfg.trace, PROG_NAME, option, options.optarg
+				))
+				{
+					quit(EXIT_FAILURE);
+				}
+				break;
+			CASE_RUN_OPT:
+				if(!parse_run_option(
+					&sandbox_cfg.run_ctx, PROG_NAME, option, options.optarg
+				))
+				{
+					quit(EXIT_FAILURE);
+				}
+				break;
+			case '?':
+				fprintf(stderr, PROG_NAME ": %s\n", options.errmsg);
+				quit(EXIT_FAILURE);
+				break;
+			default:
+				fprintf(stderr, "Unimplemented option\n");
+				quit(EXIT_FAILURE);
+				break;
+		}
+	}
+
+	// The command comes right after the options when there is no target
+	if(from_dir != NULL && options.argv[options.optind] != NULL)
+	{
+		sandbox_cfg.run_ctx.command = &options.argv[options.optind];
+	}
+	else
+	{
+		sandbox_cfg.sandbox_dir = parse_run_command(&sandbox_cfg.run_ctx, &options);
+	}
+
+	// Each job names its own sandbox
+	const char* job_mode = batch_file != NULL ? "--batch"
+		: daemon_socket != NULL ? "--daemon" : NULL;
+	if(batch_file != NULL && daemon_socket != NULL)
+	{
+		fprintf(stderr, PROG_NAME ": --batch cannot be used with --daemon\n");
+		quit(EXIT_FAILURE);
+	}
+
+	if(job_mode != NULL)
+	{
+		if(sandbox_cfg.sandbox_dir != NULL)
+		{
+			fprintf(stderr, PROG_NAME ": %s does not take a target\n", job_mode);
+			quit(EXIT_FAILURE);
+		}
+
+		if(pid_file != NULL || zygote_socket != NULL || agent_socket != NULL
+			|| image != NULL || use_pty || log_dir != NULL
+			|| persist_dir != NULL || from_dir != NULL
+			|| sandbox_cfg.builtin_init || ready_fd_num >= 0
+			|| sandbox_cfg.notify_path != NULL || num_listeners > 0
+			|| sandbox_cfg.veth != NULL)
+		{
+			fprintf(
+				stderr,
+				PROG_NAME ": %s cannot be used with --pid-file, --zygote,"
+				" --agent, --image, --pty, --log, --persist, --from, --init,"
+				" --pause, --ready-fd, --notify-socket, --listen, --pass-fd"
+				" or --veth\n",
+				job_mode
+			);
+			quit(EXIT_FAILURE);
+		}
+
+		// Concurrent overlays cannot share an upper directory
+		if(sandbox_cfg.overlay != NULL && sandbox_cfg.overlay[0] != '\0')
+		{
+			fprintf(
+				stderr, PROG_NAME ": %s only works with a tmpfs overlay\n", job_mode
+			);
+			quit(EXIT_FAILURE);
+		}
+
+		const struct run_ctx_s* run_ctx = &sandbox_cfg.run_ctx;
+		if(run_ctx->env_len > 0 || run_ctx->work_dir != NULL
+			|| run_ctx->uid != (uid_t)-1 || run_ctx->gid != (gid_t)-1
+			|| run_ctx->sched_policy >= 0 || run_ctx->nice != NICE_UNSET
+			|| run_ctx->ioprio >= 0)
+		{
+			fprintf(stderr, PROG_NAME ": run options belong to each job\n");
+			quit(EXIT_FAILURE);
+		}
+	}
+	else if(sandbox_cfg.sandbox_dir == NULL && from_dir == NULL)
+	{
+		fprintf(stderr, PROG_NAME ": must provide sandbox dir\n");
+		quit(EXIT_FAILURE);
+	}
+
+	// A shared network namespace is left alone
+	if(sandbox_cfg.netns_flag != CLONE_NEWNET
+		&& (sandbox_cfg.net_lo || sandbox_cfg.veth != NULL))
+	{
+		fprintf(
+			stderr, PROG_NAME ": --network cannot be used with --net-lo or --veth\n"
+		);
+		quit(EXIT_FAILURE);
+	}
+
+	if(from_dir != NULL)
+	{
+		if(image != NULL || sandbox_cfg.overlay != NULL || zygote_socket != NULL
+			|| sandbox_cfg.netns_flag != CLONE_NEWNET
+			|| sandbox_cfg.ipcns_flag != CLONE_NEWIPC
+			|| sandbox_cfg.num_shm_regions > 0
+			|| sandbox_cfg.net_lo || sandbox_cfg.veth != NULL)
+		{
+			fprintf(
+				stderr,
+				PROG_NAME ": --from cannot be used with --image, --overlay,"
+				" --zygote, --network, --ipc, --shm, --net-lo or --veth\n"
+			);
+			quit(EXIT_FAILURE);
+		}
+
+		for(; num_from_fds < NUM_PERSIST_NS; ++num_from_fds)
+		{
+			char path[PATH_MAX];
+			snprintf(
+				path, sizeof(path), "%s/%s",
+				from_dir, persist_namespaces[num_from_fds].name
+			);
+			from_fds[num_from_fds] = open(path, O_RDONLY | O_CLOEXEC);
+			if(from_fds[num_from_fds] == -1)
+			{
+				fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+				quit(EXIT_FAILURE);
+			}
+		}
+
+		sandbox_cfg.from_fds = from_fds;
+	}
 
-	const struct sandbox_cfg_s* sandbox_cfg = arg;
+	for(unsigned int i = 0; i < sandbox_cfg.num_shm_regions; ++i)
+	{
+		if(!setup_shm_region(&shm_regions[i])) { quit(EXIT_FAILURE); }
+	}
 
-	// Die with parent
-	if(prctl(PR_SET_PDEATHSIG, SIGKILL, 0, 0, 0) == -1)
+	// Compiled once, every sandbox gets a copy
+	if(seccomp_policy != NULL)
 	{
-		perror("Could not set parent death signal");
+		if(!load_seccomp_filter(seccomp_policy, &seccomp)) { quit(EXIT_FAILURE); }
+
+		sandbox_cfg.run_ctx.seccomp = &seccomp;
+	}
+
+	if(placement->auto_cpus && placement->auto_node)
+	{
+		fprintf(
+			stderr, PROG_NAME ": --cpus auto cannot be used with --numa-node auto\n"
+		);
 		quit(EXIT_FAILURE);
 	}
 
-	// Prepare sandbox dir
+	// Jobs are placed as they start, automatic placement spreads them
+	if((placement->auto_cpus || placement->auto_node) && job_mode == NULL)
+	{
+		fprintf(stderr, PROG_NAME ": auto placement needs --batch or --daemon\n");
+		quit(EXIT_FAILURE);
+	}
 
-	if(mount(NULL, "/", NULL, MS_PRIVATE | MS_REC, NULL) == -1)
+	if(placement->auto_cpus
+		&& sched_getaffinity(0, sizeof(cpu_set_t), &placement->cpus) == -1)
 	{
-		perror("Could not make root mount private");
+		perror("Could not get CPU affinity");
 		quit(EXIT_FAILURE);
 	}
 
-	if(mount(
-		sandbox_cfg->sandbox_dir, sandbox_cfg->sandbox_dir,
-		NULL, MS_BIND | MS_REC, NULL
-	) == -1)
+	if(job_mode == NULL && !resolve_placement(placement, 0)) { quit(EXIT_FAILURE); }
+
+	if(cgroup != NULL)
+	{
+		sandbox_cfg.cgroup_fd = setup_cgroup(cgroup, limits, num_limits);
+		if(sandbox_cfg.cgroup_fd == -1) { quit(EXIT_FAILURE); }
+	}
+	else if(limits[0].value != NULL || limits[1].value != NULL
+		|| limits[2].value != NULL)
 	{
-		perror("Could not turn sandbox into a mountpoint");
+		fprintf(stderr, PROG_NAME ": resource limits require --cgroup\n");
 		quit(EXIT_FAILURE);
 	}
 
-	if(chdir(sandbox_cfg->sandbox_dir) == -1)
+	// Sandboxes of the daemon report to hako-ctl instead
+	if(stats_output != NULL && (daemon_socket != NULL || zygote_socket != NULL))
 	{
-		perror("Could not chdir into sandbox");
+		fprintf(
+			stderr, PROG_NAME ": --stats cannot be used with --daemon or --zygote\n"
+		);
 		quit(EXIT_FAILURE);
 	}
 
-	// Network
-	if(sandbox_cfg->netns_flag != CLONE_NEWNET && sandbox_cfg->netns != NULL)
+	if(stats_output != NULL)
 	{
-		int netns = open(sandbox_cfg->netns, O_RDONLY);
-		if(netns < 0)
-		{
-			fprintf(
-				stderr, "Could not access %s: %s\n",
-				sandbox_cfg->netns, strerror(errno)
-			);
-			quit(EXIT_FAILURE);
-		}
+		stats_fd = open_stats_output(PROG_NAME, stats_output);
+		if(stats_fd == -1) { quit(EXIT_FAILURE); }
+	}
+
+	if(batch_file != NULL)
+	{
+		quit(run_batch(&sandbox_cfg, batch_file, max_jobs, stats_fd));
+	}
 
-		int setns_result = setns(netns, CLONE_NEWNET);
-		int setns_error = errno;
-		close(netns);
-		if(setns_result == -1)
+	if(daemon_socket != NULL) { quit(run_daemon(&sandbox_cfg, daemon_socket)); }
+
+	// Images are mounted once, sandboxes get a copy of that mount
+	sandbox_cfg.root_dir = sandbox_cfg.sandbox_dir;
+	if(image != NULL)
+	{
+		image_fd = mount_image(image);
+		if(image_fd == -1) { quit(EXIT_FAILURE); }
+
+		snprintf(image_root, sizeof(image_root), "/proc/self/fd/%d", image_fd);
+		sandbox_cfg.root_dir = image_root;
+	}
+
+	// A persisted sandbox has nothing left to set up
+	uint64_t manifest_start = trace_now();
+	if(from_dir == NULL)
+	{
+		if(!load_mount_manifest(sandbox_cfg.root_dir, &sandbox_cfg.manifest))
 		{
-			fprintf(stderr, "Could not setns: %s\n", strerror(setns_error));
 			quit(EXIT_FAILURE);
 		}
+
+		sandbox_cfg.has_init = find_init(
+			sandbox_cfg.root_dir, &sandbox_cfg.manifest
+		);
 	}
+	uint64_t manifest_end = trace_now();
 
-	// Execute .hako/init
-	pid_t init_pid = vfork();
-	if(init_pid < 0)
+	if(zygote_socket != NULL && agent_socket != NULL)
 	{
-		perror("vfork() failed");
+		fprintf(stderr, PROG_NAME ": --agent cannot be used with --zygote\n");
 		quit(EXIT_FAILURE);
 	}
-	else if(init_pid == 0) // child
+
+	if(zygote_socket != NULL && (use_pty || log_dir != NULL
+		|| persist_dir != NULL || sandbox_cfg.builtin_init
+		|| ready_fd_num >= 0 || sandbox_cfg.notify_path != NULL
+		|| num_listeners > 0 || sandbox_cfg.veth != NULL))
 	{
-		if(prctl(PR_SET_PDEATHSIG, SIGKILL, 0, 0, 0) == -1)
+		fprintf(
+			stderr,
+			PROG_NAME ": --pty, --log, --persist, --init, --pause, --ready-fd,"
+			" --notify-socket, --listen, --pass-fd and --veth cannot be used"
+			" with --zygote\n"
+		);
+		quit(EXIT_FAILURE);
+	}
+
+	// Nothing is left to talk to the terminal or the logs
+	if(sandbox_cfg.pause && (use_pty || log_dir != NULL
+		|| sandbox_cfg.run_ctx.command != sandbox_cfg.run_ctx.default_cmd))
+	{
+		fprintf(
+			stderr, PROG_NAME ": --pause takes no command, --pty or --log\n"
+		);
+		quit(EXIT_FAILURE);
+	}
+
+	if(use_pty && log_dir != NULL)
+	{
+		fprintf(stderr, PROG_NAME ": --pty cannot be used with --log\n");
+		quit(EXIT_FAILURE);
+	}
+
+	// Sandboxes cannot share an upper directory
+	if(zygote_socket != NULL && sandbox_cfg.overlay != NULL
+		&& sandbox_cfg.overlay[0] != '\0')
+	{
+		fprintf(stderr, PROG_NAME ": --zygote only works with a tmpfs overlay\n");
+		quit(EXIT_FAILURE);
+	}
+
+	if(zygote_socket != NULL)
+	{
+		quit(run_zygote(&sandbox_cfg, zygote_socket, pool_size));
+	}
+
+	// Mounts of other namespaces cannot be copied from inside the sandbox
+	if(image_fd >= 0)
+	{
+		struct sandbox_tree_s tree = { .fd = -1 };
+		if(!prepare_tree(
+			&tree, sandbox_cfg.root_dir, sandbox_cfg.overlay,
+			&sandbox_cfg.manifest,
+			!sandbox_cfg.writable && !sandbox_cfg.has_init, NULL
+		))
 		{
-			perror("Could not set parent death signal");
+			if(tree.fd >= 0) { close(tree.fd); }
 			quit(EXIT_FAILURE);
 		}
 
-		char* init_cmd[] = { HAKO_DIR "/init", NULL };
-		if(execv(init_cmd[0], init_cmd) == -1)
+		sandbox_cfg.tree_fd = tree.fd;
+	}
+
+	if(use_pty)
+	{
+		if(!open_pty(&pty)) { quit(EXIT_FAILURE); }
+
+		sandbox_cfg.pty_slave = pty.slave;
+	}
+
+	if(log_dir != NULL)
+	{
+		if(!setup_logs(log_dir, log_size, logs, log_stdio)) { quit(EXIT_FAILURE); }
+
+		sandbox_cfg.stdio = log_stdio;
+	}
+
+	// A copy which the sandbox does not inherit
+	if(ready_fd_num >= 0)
+	{
+		ready_fd = fcntl(ready_fd_num, F_DUPFD_CLOEXEC, STDERR_FILENO + 1);
+		if(ready_fd == -1)
 		{
-			perror("Could not execute " HAKO_DIR "/init");
+			fprintf(stderr, PROG_NAME ": invalid ready fd: %ld\n", ready_fd_num);
 			quit(EXIT_FAILURE);
 		}
+		if(ready_fd_num > STDERR_FILENO) { close(ready_fd_num); }
 	}
-	else // parent
+
+	if(sandbox_cfg.notify_path != NULL)
 	{
-		int init_status;
-		errno = 0;
-		while(waitpid(init_pid, &init_status, 0) != init_pid && errno == EINTR)
-		{ }
+		sandbox_cfg.notify_fd = socket(
+			AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0
+		);
+		if(sandbox_cfg.notify_fd == -1)
+		{
+			perror("socket() failed");
+			quit(EXIT_FAILURE);
+		}
 
-		if(!WIFEXITED(init_status) || WEXITSTATUS(init_status) != 0)
+		if(!add_env(
+			&sandbox_cfg.run_ctx, &notify_env, "NOTIFY_SOCKET=%s",
+			sandbox_cfg.notify_path
+		))
 		{
-			fprintf(
-				stderr, HAKO_DIR "/init failed with %s: %d\n",
-				WIFEXITED(init_status) ? "status" : "signal",
-				WIFEXITED(init_status) ? WEXITSTATUS(init_status) : WTERMSIG(init_status)
-			);
 			quit(EXIT_FAILURE);
 		}
 	}
 
-	// Finalize sandbox
-
-	if(!sandbox_cfg->writable
-		&& mount(NULL, ".", NULL, MS_REMOUNT | MS_BIND | MS_RDONLY, NULL) == -1)
+	// In the network namespace of hako-run, kept in the order they were given
+	for(; sandbox_cfg.num_listen_fds < num_listeners; ++sandbox_cfg.num_listen_fds)
 	{
-		perror("Could not make sandbox read-only");
-		quit(EXIT_FAILURE);
+		const struct listener_s* listener = &listeners[sandbox_cfg.num_listen_fds];
+		int fd = listener->addr != NULL ? create_inet_listener(listener->addr)
+			: fcntl(listener->pass_fd, F_DUPFD_CLOEXEC, STDERR_FILENO + 1);
+		if(fd == -1)
+		{
+			if(listener->addr == NULL)
+			{
+				fprintf(
+					stderr, PROG_NAME ": invalid fd to pass: %d\n", listener->pass_fd
+				);
+			}
+			quit(EXIT_FAILURE);
+		}
+
+		// Only the copy goes to the sandbox
+		if(listener->addr == NULL) { close(listener->pass_fd); }
+		listen_fds[sandbox_cfg.num_listen_fds] = fd;
 	}
 
-	if(syscall(__NR_pivot_root, ".", HAKO_DIR) == -1)
+	if(num_listeners > 0)
 	{
-		perror("Could not pivot root");
-		quit(EXIT_FAILURE);
+		if(!add_env(
+				&sandbox_cfg.run_ctx, &listen_env[0], "LISTEN_FDS=%u", num_listeners
+			)
+			|| !add_env(
+				&sandbox_cfg.run_ctx, &listen_env[1], "LISTEN_PID=%*s",
+				LISTEN_PID_SIZE - 1, ""
+			))
+		{
+			quit(EXIT_FAILURE);
+		}
+
+		sandbox_cfg.listen_fds = listen_fds;
+		sandbox_cfg.listen_pid_env = listen_env[1];
 	}
 
-	if(chdir("/") == -1)
+	// The sandbox sends the host side of the veth back here
+	if(sandbox_cfg.veth != NULL)
 	{
-		perror("Could not chdir into new root");
-		quit(EXIT_FAILURE);
+		sandbox_cfg.host_netns_fd = open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC);
+		if(sandbox_cfg.host_netns_fd == -1)
+		{
+			perror("Could not open network namespace");
+			quit(EXIT_FAILURE);
+		}
+
+		sandbox_cfg.host_netlink_fd = open_netlink();
+		if(sandbox_cfg.host_netlink_fd == -1)
+		{
+			perror("Could not open netlink socket");
+			quit(EXIT_FAILURE);
+		}
 	}
 
-	if(umount2(HAKO_DIR, MNT_DETACH) == -1)
+	// Block signals first so that an early exit of the child is not missed
+	sigset_t set;
+	sigfillset(&set);
+	sigprocmask(SIG_BLOCK, &set, NULL);
+
+	signal_fd = signalfd(-1, &set, SFD_CLOEXEC);
+	if(signal_fd == -1)
 	{
-		perror("Could not unmount old root");
+		perror("signalfd() failed");
 		quit(EXIT_FAILURE);
 	}
 
-	// Show time
-	if(!execute_run_ctx(&sandbox_cfg->run_ctx))
+	// The cgroup may have been used before, only what happens next counts
+	if(stats_fd >= 0 && sandbox_cfg.cgroup_fd >= 0)
 	{
-		quit(EXIT_FAILURE);
+		peak_fd = reset_cgroup_peak(sandbox_cfg.cgroup_fd);
+		read_cgroup_usage(sandbox_cfg.cgroup_fd, -1, &cgroup_start);
 	}
 
-quit:
-	return exit_code;
-}
-
-int
-main(int argc, char* argv[])
-{
-	(void)argc;
-
-	int exit_code = EXIT_SUCCESS;
-
-	struct optparse_long opts[] = {
-		{"help", 'h', OPTPARSE_NONE},
-		{"writable", 'W', OPTPARSE_NONE},
-		{"network", 'N', OPTPARSE_OPTIONAL},
-		{"pid-file", 'p', OPTPARSE_REQUIRED},
-		RUN_CTX_OPTS,
-		{0}
-	};
-
-	const char* help[] = {
-		NULL, "Print this message",
-		NULL, "Make sandbox root filesystem writable",
-		"FILE", "Set sandbox's network namespace (default: host)",
-		"FILE", "Write pid of sandbox to this file",
-		RUN_CTX_HELP,
-	};
+	// Tells when the sandbox is set up, and when the command has exec'd since
+	// the built-in init never does
+	if(sandbox_cfg.builtin_init || ready_fd >= 0)
+	{
+		if(pipe2(sync_pipe, O_CLOEXEC) == -1)
+		{
+			perror("pipe2() failed");
+			quit(EXIT_FAILURE);
+		}
 
-	const char* usage = "Usage: " PROG_NAME " [options] <target> [command] [args]";
+		sandbox_cfg.sync_fd = sync_pipe[1];
+	}
 
-	int option;
-	const char* pid_file = NULL;
-	struct optparse options;
-	struct sandbox_cfg_s sandbox_cfg = { .netns_flag = CLONE_NEWNET };
-	init_run_ctx(&sandbox_cfg.run_ctx, argc);
-	optparse_init(&options, argv);
-	options.permute = 0;
+	pid_t child_pid = spawn_sandbox(
+		&sandbox_cfg,
+		sandbox_cfg.builtin_init ? 0 : CLONE_VFORK, // wait until child execs away
+		NULL
+	);
+	if(child_pid == -1)
+	{
+		perror("clone() failed");
+		quit(EXIT_FAILURE);
+	}
 
-	while((option = optparse_long(&options, opts, NULL)) != -1)
+	// Every write end is closed once the command has exec'd or failed to
+	bool set_up = false;
+	if(sync_pipe[1] >= 0)
 	{
-		switch(option)
+		close(sync_pipe[1]);
+		sync_pipe[1] = -1;
+		char byte;
+		ssize_t len;
+		while((len = read(sync_pipe[0], &byte, 1)) != 0)
 		{
-			case 'h':
-				optparse_help(usage, opts, help);
-				quit(EXIT_SUCCESS);
-				break;
-			case 'W':
-				sandbox_cfg.writable = true;
-				break;
-			case 'N':
-				sandbox_cfg.netns = options.optarg;
-				sandbox_cfg.netns_flag = 0;
-				break;
-			case 'p':
-				pid_file = options.optarg;
-				break;
-			CASE_RUN_OPT:
-				if(!parse_run_option(
-					&sandbox_cfg.run_ctx, PROG_NAME, option, options.optarg
-				))
-				{
-					quit(EXIT_FAILURE);
-				}
-				break;
-			case '?':
-				fprintf(stderr, PROG_NAME ": %s\n", options.errmsg);
-				quit(EXIT_FAILURE);
-				break;
-			default:
-				fprintf(stderr, "Unimplemented option\n");
-				quit(EXIT_FAILURE);
-				break;
+			if(len == 1) { set_up = true; }
+			else if(errno != EINTR) { break; }
 		}
 	}
 
-	sandbox_cfg.sandbox_dir = parse_run_command(&sandbox_cfg.run_ctx, &options);
+	if(use_pty) { start_pty_relay(&pty); }
 
-	if(sandbox_cfg.sandbox_dir == NULL)
+	// The child has exec'd, its setup is done
+	if(persist_dir != NULL && !persist_sandbox(persist_dir, child_pid))
 	{
-		fprintf(stderr, PROG_NAME ": must provide sandbox dir\n");
+		kill(child_pid, SIGKILL);
 		quit(EXIT_FAILURE);
 	}
 
-	// Create a child process in a new namespace
-	long stack_size = sysconf(_SC_PAGESIZE);
-	char* child_stack = alloca(stack_size);
-	int clone_flags = 0
-		| SIGCHLD
-		| CLONE_VFORK // wait until child execs away
-		| CLONE_NEWPID | CLONE_NEWIPC | CLONE_NEWNS | CLONE_NEWUTS
-		| sandbox_cfg.netns_flag;
-	pid_t child_pid = clone(
-		sandbox_entry, child_stack + stack_size, clone_flags, &sandbox_cfg
+	// Only the command writes to the logs
+	for(int i = 0; i < HAKO_NUM_STDIO; ++i)
+	{
+		if(log_stdio[i] >= 0) { close(log_stdio[i]); }
+		log_stdio[i] = -1;
+	}
+
+	// The child has its own records, the parent's come once its pid is known
+	sandbox_cfg.trace.pid = child_pid;
+	trace_record(
+		&sandbox_cfg.trace, "manifest", sandbox_cfg.sandbox_dir,
+		manifest_start, manifest_end
 	);
-	if(child_pid == -1)
+	trace_record(
+		&sandbox_cfg.trace, "spawn", NULL,
+		sandbox_cfg.clone_start, trace_now()
+	);
+	trace_flush(&sandbox_cfg.trace);
+
+	// The agent needs privileges to join the sandbox and switch users
+	if(agent_socket != NULL)
 	{
-		perror("clone() failed");
-		quit(EXIT_FAILURE);
+		agent_pid = spawn_agent(&sandbox_cfg.run_ctx, child_pid, agent_socket);
+		if(agent_pid == -1)
+		{
+			kill(child_pid, SIGKILL);
+			quit(EXIT_FAILURE);
+		}
 	}
 
 	if(!drop_privileges(&sandbox_cfg.run_ctx)) { quit(EXIT_FAILURE); }
@@ -285,38 +5002,131 @@ main(int argc, char* argv[])
 		}
 	}
 
-	sigset_t set;
-	sigfillset(&set);
-	sigprocmask(SIG_BLOCK, &set, NULL);
+	// Failures are reported by the exit of the child
+	if(ready_fd >= 0 && set_up)
+	{
+		char event[64];
+		int len = snprintf(
+			event, sizeof(event), "PID=%" PRIdMAX "\nSETUP=1\n", (intmax_t)child_pid
+		);
+		write_ready_event(ready_fd, event, len);
+	}
+
 	for(;;)
 	{
-		int sig, status;
-		sigwait(&set, &sig);
+		int status;
+		struct rusage rusage;
+		struct pollfd log_fds[LOG_NUM_STREAMS + 1];
+		for(int i = 0; i < LOG_NUM_STREAMS; ++i)
+		{
+			log_fds[i] = (struct pollfd){ .fd = logs[i].fd, .events = POLLIN };
+		}
+		log_fds[LOG_NUM_STREAMS] = (struct pollfd){
+			.fd = sandbox_cfg.notify_fd, .events = POLLIN
+		};
+
+		int sig = wait_pty_signal(
+			signal_fd, use_pty ? &pty : NULL, log_fds, LOG_NUM_STREAMS + 1
+		);
 		switch(sig)
 		{
+			case -1:
+				kill(child_pid, SIGKILL);
+				quit(EXIT_FAILURE);
+				break;
+			case 0:
+				for(int i = 0; i < LOG_NUM_STREAMS; ++i)
+				{
+					if(log_fds[i].revents != 0) { drain_log(&logs[i]); }
+				}
+				if(log_fds[LOG_NUM_STREAMS].revents != 0)
+				{
+					forward_notify(sandbox_cfg.notify_fd, ready_fd);
+				}
+				break;
 			case SIGINT:
 			case SIGTERM:
 			case SIGHUP:
 			case SIGQUIT:
+				// The built-in init passes it on and exits with the command
+				if(sandbox_cfg.builtin_init)
+				{
+					kill(child_pid, sig);
+					break;
+				}
+
 				// Kill child manualy because SIGKILL from PR_SET_PDEATHSIG can
 				// be handled (and ignored) by child.
 				kill(child_pid, SIGKILL);
 				quit(128 + sig);
 				break;
 			case SIGCHLD:
-				if(waitpid(child_pid, &status, WNOHANG) > 0)
+				if(agent_pid > 0 && waitpid(agent_pid, NULL, WNOHANG) > 0)
 				{
-					quit(
-						WIFEXITED(status) ?
-						WEXITSTATUS(status) : (128 + WTERMSIG(status))
-					);
+					fprintf(stderr, "Agent exited\n");
+					agent_pid = -1;
+				}
+
+				if(wait4(child_pid, &status, WNOHANG, &rusage) > 0)
+				{
+					uint64_t wall_time = trace_now() - sandbox_cfg.clone_start;
+					int child_code = WIFEXITED(status) ?
+						WEXITSTATUS(status) : (128 + WTERMSIG(status));
+					if(use_pty) { drain_pty(&pty); }
+					for(int i = 0; i < LOG_NUM_STREAMS; ++i)
+					{
+						if(logs[i].fd >= 0) { drain_log(&logs[i]); }
+					}
+
+					if(stats_fd >= 0)
+					{
+						char id[32];
+						snprintf(
+							id, sizeof(id), "\"pid\":%" PRIdMAX, (intmax_t)child_pid
+						);
+						write_usage(
+							stats_fd, id, child_code, wall_time, &rusage,
+							sandbox_cfg.cgroup_fd, peak_fd, &cgroup_start
+						);
+					}
+					quit(child_code);
 				}
 				break;
 		}
 	}
 
 quit:
+	if(sandbox_cfg.tree_fd >= 0) { close(sandbox_cfg.tree_fd); }
+	if(image_fd >= 0) { close(image_fd); }
+	if(sandbox_cfg.cgroup_fd >= 0) { close(sandbox_cfg.cgroup_fd); }
+	cleanup_mount_manifest(&sandbox_cfg.manifest);
+	cleanup_trace(&sandbox_cfg.trace);
 	cleanup_run_ctx(&sandbox_cfg.run_ctx);
+	cleanup_seccomp_filter(&seccomp);
+	cleanup_pty(&pty);
+	if(signal_fd >= 0) { close(signal_fd); }
+	for(int i = 0; i < LOG_NUM_STREAMS; ++i) { cleanup_log(&logs[i]); }
+	for(unsigned int i = 0; i < num_from_fds; ++i) { close(from_fds[i]); }
+	if(stats_fd >= 0) { close(stats_fd); }
+	if(peak_fd >= 0) { close(peak_fd); }
+	if(ready_fd >= 0) { close(ready_fd); }
+	if(sandbox_cfg.notify_fd >= 0) { close(sandbox_cfg.notify_fd); }
+	free(notify_env);
+	if(sandbox_cfg.host_netns_fd >= 0) { close(sandbox_cfg.host_netns_fd); }
+	if(sandbox_cfg.host_netlink_fd >= 0) { close(sandbox_cfg.host_netlink_fd); }
+	for(unsigned int i = 0; i < sandbox_cfg.num_listen_fds; ++i)
+	{
+		close(listen_fds[i]);
+	}
+	for(int i = 0; i < 2; ++i) { free(listen_env[i]); }
+	for(int i = 0; i < 2; ++i)
+	{
+		if(sync_pipe[i] >= 0) { close(sync_pipe[i]); }
+	}
+	for(int i = 0; i < HAKO_NUM_STDIO; ++i)
+	{
+		if(log_stdio[i] >= 0) { close(log_stdio[i]); }
+	}
 
 	return exit_code;
 }
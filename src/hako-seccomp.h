@@ -0,0 +1,340 @@
+#ifndef HAKO_SECCOMP_H
+#define HAKO_SECCOMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include "hako-common.h"
+#include "hako-syscalls.h"
+
+// A policy has one rule per line, '#' starts a comment:
+//
+//   default errno EPERM
+//   allow read write openat close execve exit_group
+//   kill ptrace
+//
+// Actions are allow, kill, trap, log and errno (followed by a name or a
+// number). Syscalls are given by name or number, default sets the action of
+// the others (kill if not given).
+//
+// The policy is compiled into a binary search over syscall numbers so that
+// each syscall goes through O(log n) comparisons.
+
+#if defined(__x86_64__)
+#define SECCOMP_AUDIT_ARCH AUDIT_ARCH_X86_64
+#elif defined(__i386__)
+#define SECCOMP_AUDIT_ARCH AUDIT_ARCH_I386
+#elif defined(__aarch64__)
+#define SECCOMP_AUDIT_ARCH AUDIT_ARCH_AARCH64
+#elif defined(__arm__)
+#define SECCOMP_AUDIT_ARCH AUDIT_ARCH_ARM
+#elif defined(__riscv) && __riscv_xlen == 64
+#define SECCOMP_AUDIT_ARCH AUDIT_ARCH_RISCV64
+#elif defined(__powerpc64__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define SECCOMP_AUDIT_ARCH AUDIT_ARCH_PPC64LE
+#elif defined(__s390x__)
+#define SECCOMP_AUDIT_ARCH AUDIT_ARCH_S390X
+#else
+#error "Unsupported architecture for seccomp"
+#endif
+
+// Below this, comparing each syscall is cheaper than splitting further
+#define SECCOMP_LEAF_SIZE 4
+
+struct seccomp_rule_s
+{
+	uint32_t nr;
+	uint32_t action;
+};
+
+static const struct
+{
+	const char* name;
+	int value;
+} seccomp_errnos[] = {
+	{ "EPERM", EPERM },
+	{ "ENOENT", ENOENT },
+	{ "EIO", EIO },
+	{ "EAGAIN", EAGAIN },
+	{ "ENOMEM", ENOMEM },
+	{ "EACCES", EACCES },
+	{ "EFAULT", EFAULT },
+	{ "EINVAL", EINVAL },
+	{ "ENOSYS", ENOSYS },
+	{ "EOPNOTSUPP", EOPNOTSUPP },
+};
+
+static HAKO_UNUSED bool
+parse_seccomp_action(char** token, char** saveptr, uint32_t* action)
+{
+	long num;
+	if(strcmp(*token, "allow") == 0) { *action = SECCOMP_RET_ALLOW; }
+	else if(strcmp(*token, "kill") == 0) { *action = SECCOMP_RET_KILL_PROCESS; }
+	else if(strcmp(*token, "trap") == 0) { *action = SECCOMP_RET_TRAP; }
+	else if(strcmp(*token, "log") == 0) { *action = SECCOMP_RET_LOG; }
+	else if(strcmp(*token, "errno") == 0)
+	{
+		const char* value = strtok_r(NULL, " \t\r\n", saveptr);
+		if(value == NULL) { return false; }
+
+		num = -1;
+		for(unsigned int i = 0;
+			i < sizeof(seccomp_errnos) / sizeof(seccomp_errnos[0]);
+			++i)
+		{
+			if(strcmp(seccomp_errnos[i].name, value) == 0)
+			{
+				num = seccomp_errnos[i].value;
+			}
+		}
+		if(num == -1 && !(strtonum(value, &num) && num >= 0 && num <= 4095))
+		{
+			return false;
+		}
+
+		*action = SECCOMP_RET_ERRNO | (uint32_t)num;
+	}
+	else
+	{
+		return false;
+	}
+
+	*token = strtok_r(NULL, " \t\r\n", saveptr);
+	return true;
+}
+
+static HAKO_UNUSED bool
+find_syscall(const char* name, uint32_t* nr)
+{
+	long num;
+	if(strtonum(name, &num) && num >= 0)
+	{
+		*nr = (uint32_t)num;
+		return true;
+	}
+
+	unsigned int num_syscalls = sizeof(syscall_names) / sizeof(syscall_names[0]);
+	for(unsigned int i = 0; i < num_syscalls; ++i)
+	{
+		if(strcmp(syscall_names[i].name, name) == 0)
+		{
+			*nr = syscall_names[i].nr;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static HAKO_UNUSED int
+compare_seccomp_rules(const void* lhs, const void* rhs)
+{
+	uint32_t lhs_nr = ((const struct seccomp_rule_s*)lhs)->nr;
+	uint32_t rhs_nr = ((const struct seccomp_rule_s*)rhs)->nr;
+	return lhs_nr < rhs_nr ? -1 : lhs_nr > rhs_nr;
+}
+
+static HAKO_UNUSED void
+emit_bpf(
+	struct sock_fprog* prog,
+	uint16_t code,
+	uint32_t k,
+	uint8_t jt,
+	uint8_t jf
+)
+{
+	prog->filter[prog->len++] = (struct sock_filter){
+		.code = code, .jt = jt, .jf = jf, .k = k
+	};
+}
+
+// rules are sorted, a node jumps to its upper half when the syscall number is
+// at least the first one of that half
+static HAKO_UNUSED void
+emit_seccomp_tree(
+	struct sock_fprog* prog,
+	const struct seccomp_rule_s* rules,
+	unsigned int num_rules,
+	uint32_t default_action
+)
+{
+	if(num_rules <= SECCOMP_LEAF_SIZE)
+	{
+		for(unsigned int i = 0; i < num_rules; ++i)
+		{
+			emit_bpf(prog, BPF_JMP | BPF_JEQ | BPF_K, rules[i].nr, 0, 1);
+			emit_bpf(prog, BPF_RET | BPF_K, rules[i].action, 0, 0);
+		}
+		emit_bpf(prog, BPF_RET | BPF_K, default_action, 0, 0);
+		return;
+	}
+
+	// Conditional jumps are limited to 255 instructions, the upper half is
+	// reached through an unconditional one
+	unsigned int half = num_rules / 2;
+	emit_bpf(prog, BPF_JMP | BPF_JGE | BPF_K, rules[half].nr, 0, 1);
+	unsigned int jump = prog->len;
+	emit_bpf(prog, BPF_JMP | BPF_JA, 0, 0, 0);
+	emit_seccomp_tree(prog, rules, half, default_action);
+	prog->filter[jump].k = prog->len - jump - 1;
+	emit_seccomp_tree(prog, rules + half, num_rules - half, default_action);
+}
+
+static HAKO_UNUSED bool
+compile_seccomp_policy(
+	struct sock_fprog* prog,
+	struct seccomp_rule_s* rules,
+	unsigned int num_rules,
+	uint32_t default_action
+)
+{
+	// Header, then at most 2 instructions per rule and 3 per tree node
+	size_t max_len = 8 + 5 * (size_t)num_rules;
+	if(max_len > BPF_MAXINSNS)
+	{
+		fprintf(stderr, "Seccomp policy is too large\n");
+		return false;
+	}
+
+	prog->len = 0;
+	prog->filter = calloc(max_len, sizeof(struct sock_filter));
+	if(prog->filter == NULL)
+	{
+		perror("Could not allocate seccomp filter");
+		return false;
+	}
+
+	qsort(
+		rules, num_rules, sizeof(struct seccomp_rule_s), compare_seccomp_rules
+	);
+
+	// Syscall numbers of other architectures mean other syscalls
+	emit_bpf(
+		prog, BPF_LD | BPF_W | BPF_ABS,
+		offsetof(struct seccomp_data, arch), 0, 0
+	);
+	emit_bpf(prog, BPF_JMP | BPF_JEQ | BPF_K, SECCOMP_AUDIT_ARCH, 1, 0);
+	emit_bpf(prog, BPF_RET | BPF_K, SECCOMP_RET_KILL_PROCESS, 0, 0);
+	emit_bpf(
+		prog, BPF_LD | BPF_W | BPF_ABS,
+		offsetof(struct seccomp_data, nr), 0, 0
+	);
+#ifdef __x86_64__
+	// So are x32 ones
+	emit_bpf(prog, BPF_JMP | BPF_JGE | BPF_K, 0x40000000, 0, 1);
+	emit_bpf(prog, BPF_RET | BPF_K, SECCOMP_RET_KILL_PROCESS, 0, 0);
+#endif
+
+	emit_seccomp_tree(prog, rules, num_rules, default_action);
+
+	return true;
+}
+
+static HAKO_UNUSED void
+cleanup_seccomp_filter(struct sock_fprog* prog)
+{
+	free(prog->filter);
+	prog->filter = NULL;
+	prog->len = 0;
+}
+
+static HAKO_UNUSED bool
+load_seccomp_filter(const char* path, struct sock_fprog* prog)
+{
+	bool loaded = false;
+	char* line = NULL;
+	size_t line_size = 0;
+	unsigned int line_no = 0;
+	unsigned int num_rules = 0;
+	unsigned int capacity = 0;
+	struct seccomp_rule_s* rules = NULL;
+	uint32_t default_action = SECCOMP_RET_KILL_PROCESS;
+
+	FILE* file = fopen(path, "r");
+	if(file == NULL)
+	{
+		fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+		goto quit;
+	}
+
+	while(getline(&line, &line_size, file) != -1)
+	{
+		++line_no;
+
+		char* saveptr;
+		char* token = strtok_r(line, " \t\r\n", &saveptr);
+		if(token == NULL || token[0] == '#') { continue; }
+
+		bool is_default = strcmp(token, "default") == 0;
+		if(is_default) { token = strtok_r(NULL, " \t\r\n", &saveptr); }
+
+		uint32_t action;
+		if(token == NULL || !parse_seccomp_action(&token, &saveptr, &action))
+		{
+			fprintf(stderr, "%s:%u: invalid action\n", path, line_no);
+			goto quit;
+		}
+
+		if(is_default)
+		{
+			default_action = action;
+			continue;
+		}
+
+		for(; token != NULL && token[0] != '#';
+			token = strtok_r(NULL, " \t\r\n", &saveptr))
+		{
+			uint32_t nr;
+			if(!find_syscall(token, &nr))
+			{
+				fprintf(
+					stderr, "%s:%u: unknown syscall %s\n", path, line_no, token
+				);
+				goto quit;
+			}
+
+			for(unsigned int i = 0; i < num_rules; ++i)
+			{
+				if(rules[i].nr == nr)
+				{
+					fprintf(
+						stderr, "%s:%u: %s is listed twice\n", path, line_no, token
+					);
+					goto quit;
+				}
+			}
+
+			if(num_rules == capacity)
+			{
+				capacity = capacity * 2 + 64;
+				struct seccomp_rule_s* new_rules = realloc(
+					rules, capacity * sizeof(struct seccomp_rule_s)
+				);
+				if(new_rules == NULL)
+				{
+					perror("Could not allocate seccomp rules");
+					goto quit;
+				}
+				rules = new_rules;
+			}
+
+			rules[num_rules++] = (struct seccomp_rule_s){
+				.nr = nr,
+				.action = action
+			};
+		}
+	}
+
+	loaded = compile_seccomp_policy(prog, rules, num_rules, default_action);
+
+quit:
+	if(file != NULL) { fclose(file); }
+	free(line);
+	free(rules);
+
+	return loaded;
+}
+
+#endif
@@ -0,0 +1,566 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#define OPTPARSE_IMPLEMENTATION
+#define OPTPARSE_API static __attribute__((unused))
+#include "optparse.h"
+#define OPTPARSE_HELP_IMPLEMENTATION
+#define OPTPARSE_HELP_API static
+#include "optparse-help.h"
+#include "hako-common.h"
+#include "hako-stats.h"
+
+#define PROG_NAME "hako-stat"
+#define quit(code) exit_code = code; goto quit;
+
+#define DEFAULT_INTERVAL_MS 1000
+
+// Every file is opened once and read again with pread() on each sample.
+// Files of /proc stay bound to the process they were opened for, they fail
+// with ESRCH once it is gone even if its pid is reused.
+
+enum source_e
+{
+	SOURCE_STAT,
+	SOURCE_STATM,
+	SOURCE_CPU_STAT,
+	SOURCE_MEMORY,
+	SOURCE_PIDS,
+	SOURCE_CPU_PRESSURE,
+	SOURCE_MEMORY_PRESSURE,
+	SOURCE_IO_PRESSURE,
+	NUM_SOURCES
+};
+
+#define FIRST_CGROUP_SOURCE SOURCE_CPU_STAT
+
+static const char* const source_files[NUM_SOURCES] = {
+	[SOURCE_STAT] = "stat",
+	[SOURCE_STATM] = "statm",
+	[SOURCE_CPU_STAT] = "cpu.stat",
+	[SOURCE_MEMORY] = "memory.current",
+	[SOURCE_PIDS] = "pids.current",
+	[SOURCE_CPU_PRESSURE] = "cpu.pressure",
+	[SOURCE_MEMORY_PRESSURE] = "memory.pressure",
+	[SOURCE_IO_PRESSURE] = "io.pressure",
+};
+
+enum metric_e
+{
+	METRIC_CPU,
+	METRIC_CPU_PERCENT,
+	METRIC_RSS,
+	METRIC_MEMORY,
+	METRIC_FDS,
+	METRIC_THREADS,
+	METRIC_TASKS,
+	METRIC_CPU_PRESSURE,
+	METRIC_MEMORY_PRESSURE,
+	METRIC_IO_PRESSURE,
+	NUM_METRICS
+};
+
+struct metric_s
+{
+	const char* name;
+	const char* help;
+	bool counter;
+	bool ratio; // printed with 2 decimals
+};
+
+static const struct metric_s metrics[NUM_METRICS] = {
+	[METRIC_CPU] = { "cpu_usec", "CPU time used by the sandbox", true, false },
+	[METRIC_CPU_PERCENT] = {
+		"cpu_percent", "CPU usage since the previous sample", false, true
+	},
+	[METRIC_RSS] = {
+		"rss_bytes", "Resident memory of the sandbox's process", false, false
+	},
+	[METRIC_MEMORY] = {
+		"memory_bytes", "Memory charged to the sandbox's cgroup", false, false
+	},
+	[METRIC_FDS] = {
+		"open_fds", "Open files of the sandbox's process", false, false
+	},
+	[METRIC_THREADS] = {
+		"threads", "Threads of the sandbox's process", false, false
+	},
+	[METRIC_TASKS] = {
+		"tasks", "Processes and threads in the sandbox's cgroup", false, false
+	},
+	[METRIC_CPU_PRESSURE] = {
+		"cpu_pressure", "Share of time stalled on CPU over 10s", false, true
+	},
+	[METRIC_MEMORY_PRESSURE] = {
+		"memory_pressure", "Share of time stalled on memory over 10s", false, true
+	},
+	[METRIC_IO_PRESSURE] = {
+		"io_pressure", "Share of time stalled on I/O over 10s", false, true
+	},
+};
+
+struct sandbox_s
+{
+	pid_t pid;
+	int fds[NUM_SOURCES]; // -1 when missing
+	DIR* fd_dir;
+	bool exited;
+	uint64_t cpu_usec;
+	uint64_t sample_time;
+	double values[NUM_METRICS]; // NAN when missing
+};
+
+enum format_e
+{
+	FORMAT_JSON,
+	FORMAT_PROMETHEUS
+};
+
+static long clock_ticks;
+static long page_size;
+
+// Only a cgroup of its own tells about the sandbox, like in hako-enter
+static int
+open_sandbox_cgroup(pid_t pid)
+{
+	char target[PATH_MAX], own[PATH_MAX], mount_point[PATH_MAX];
+	if(!read_cgroup_path(pid, target, sizeof(target))
+		|| !find_cgroup2_mount(mount_point, sizeof(mount_point))
+		|| (read_cgroup_path(getpid(), own, sizeof(own))
+			&& strcmp(own, target) == 0))
+	{
+		return -1;
+	}
+
+	char path[2 * PATH_MAX];
+	snprintf(path, sizeof(path), "%s%s", mount_point, target);
+	return open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+static bool
+open_sandbox(struct sandbox_s* sandbox, pid_t pid)
+{
+	*sandbox = (struct sandbox_s){ .pid = pid };
+	for(int i = 0; i < NUM_SOURCES; ++i) { sandbox->fds[i] = -1; }
+
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d", (int)pid);
+	int proc_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if(proc_fd == -1)
+	{
+		fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	// The cgroup is looked up first, it must be the sandbox's one
+	int cgroup_fd = open_sandbox_cgroup(pid);
+	for(int i = 0; i < NUM_SOURCES; ++i)
+	{
+		int dir_fd = i < FIRST_CGROUP_SOURCE ? proc_fd : cgroup_fd;
+		if(dir_fd < 0) { continue; }
+
+		sandbox->fds[i] = openat(dir_fd, source_files[i], O_RDONLY | O_CLOEXEC);
+	}
+
+	// Listing open files needs the same rights as ptrace
+	int fd_dir_fd = openat(proc_fd, "fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if(fd_dir_fd >= 0)
+	{
+		sandbox->fd_dir = fdopendir(fd_dir_fd);
+		if(sandbox->fd_dir == NULL) { close(fd_dir_fd); }
+	}
+
+	bool opened = sandbox->fds[SOURCE_STAT] >= 0;
+	if(!opened) { fprintf(stderr, "Could not open %s/stat\n", path); }
+
+	close(proc_fd);
+	if(cgroup_fd >= 0) { close(cgroup_fd); }
+	return opened;
+}
+
+static void
+cleanup_sandbox(struct sandbox_s* sandbox)
+{
+	for(int i = 0; i < NUM_SOURCES; ++i)
+	{
+		if(sandbox->fds[i] >= 0) { close(sandbox->fds[i]); }
+		sandbox->fds[i] = -1;
+	}
+
+	if(sandbox->fd_dir != NULL) { closedir(sandbox->fd_dir); }
+	sandbox->fd_dir = NULL;
+}
+
+static bool
+read_source(const struct sandbox_s* sandbox, int source, char* buf, size_t size)
+{
+	int fd = sandbox->fds[source];
+	if(fd < 0) { return false; }
+
+	ssize_t len = pread(fd, buf, size - 1, 0);
+	if(len < 0) { return false; }
+
+	buf[len] = '\0';
+	return true;
+}
+
+// Since 6.2, the size of /proc/PID/fd is the number of open files
+static long
+count_open_fds(DIR* fd_dir)
+{
+	struct stat dir_stat;
+	if(fstat(dirfd(fd_dir), &dir_stat) == 0 && dir_stat.st_size > 0)
+	{
+		return dir_stat.st_size;
+	}
+
+	long count = 0;
+	rewinddir(fd_dir);
+	errno = 0;
+	for(struct dirent* entry; (entry = readdir(fd_dir)) != NULL;)
+	{
+		count += entry->d_name[0] != '.';
+	}
+
+	return errno == 0 ? count : -1;
+}
+
+static double
+read_pressure(const struct sandbox_s* sandbox, int source)
+{
+	char buf[256];
+	if(!read_source(sandbox, source, buf, sizeof(buf))) { return NAN; }
+
+	const char* avg10 = strstr(buf, "some avg10=");
+	return avg10 != NULL ? strtod(avg10 + 11, NULL) : NAN;
+}
+
+// Returns false once the sandbox's process is gone
+static bool
+sample_sandbox(struct sandbox_s* sandbox, uint64_t now)
+{
+	char buf[STATS_BUF_SIZE];
+	double* values = sandbox->values;
+	for(int i = 0; i < NUM_METRICS; ++i) { values[i] = NAN; }
+
+	// The command may have a parenthesis in its name
+	unsigned long long utime, stime;
+	long long cutime, cstime, num_threads;
+	const char* fields;
+	if(!read_source(sandbox, SOURCE_STAT, buf, sizeof(buf))
+		|| (fields = strrchr(buf, ')')) == NULL
+		|| sscanf(
+			fields + 1,
+			" %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %lld %lld"
+			" %*d %*d %lld",
+			&utime, &stime, &cutime, &cstime, &num_threads
+		) != 5)
+	{
+		return false;
+	}
+
+	values[METRIC_THREADS] = num_threads;
+
+	// The cgroup also counts children which were not waited for
+	uint64_t cpu_usec = 0;
+	if(!read_source(sandbox, SOURCE_CPU_STAT, buf, sizeof(buf))
+		|| !find_stat_value(buf, "usage_usec", &cpu_usec))
+	{
+		cpu_usec = (utime + stime + cutime + cstime) * 1000000 / clock_ticks;
+	}
+	values[METRIC_CPU] = cpu_usec;
+	if(sandbox->sample_time > 0 && now > sandbox->sample_time)
+	{
+		values[METRIC_CPU_PERCENT] = (double)(cpu_usec - sandbox->cpu_usec)
+			* 100.0 / (now - sandbox->sample_time);
+	}
+	sandbox->cpu_usec = cpu_usec;
+	sandbox->sample_time = now;
+
+	unsigned long long size, resident;
+	if(read_source(sandbox, SOURCE_STATM, buf, sizeof(buf))
+		&& sscanf(buf, "%llu %llu", &size, &resident) == 2)
+	{
+		values[METRIC_RSS] = (double)resident * page_size;
+	}
+
+	if(sandbox->fd_dir != NULL)
+	{
+		long num_fds = count_open_fds(sandbox->fd_dir);
+		if(num_fds >= 0) { values[METRIC_FDS] = num_fds; }
+	}
+
+	if(read_source(sandbox, SOURCE_MEMORY, buf, sizeof(buf)))
+	{
+		values[METRIC_MEMORY] = strtoull(buf, NULL, 10);
+	}
+	if(read_source(sandbox, SOURCE_PIDS, buf, sizeof(buf)))
+	{
+		values[METRIC_TASKS] = strtoull(buf, NULL, 10);
+	}
+
+	values[METRIC_CPU_PRESSURE] = read_pressure(sandbox, SOURCE_CPU_PRESSURE);
+	values[METRIC_MEMORY_PRESSURE] = read_pressure(
+		sandbox, SOURCE_MEMORY_PRESSURE
+	);
+	values[METRIC_IO_PRESSURE] = read_pressure(sandbox, SOURCE_IO_PRESSURE);
+
+	return true;
+}
+
+static void
+print_value(const struct metric_s* metric, double value)
+{
+	printf(metric->ratio ? "%.2f" : "%.0f", value);
+}
+
+// One line per sandbox
+static void
+print_json(const struct sandbox_s* sandbox, uint64_t time_ms)
+{
+	printf("{\"pid\":%d,\"time\":%" PRIu64, (int)sandbox->pid, time_ms);
+	for(int i = 0; i < NUM_METRICS; ++i)
+	{
+		if(isnan(sandbox->values[i])) { continue; }
+
+		printf(",\"%s\":", metrics[i].name);
+		print_value(&metrics[i], sandbox->values[i]);
+	}
+	printf("}\n");
+}
+
+// One block per sample, separated by an empty line
+static void
+print_prometheus(const struct sandbox_s* sandboxes, unsigned int num_sandboxes)
+{
+	for(int i = 0; i < NUM_METRICS; ++i)
+	{
+		const struct metric_s* metric = &metrics[i];
+		const char* suffix = metric->counter ? "_total" : "";
+		bool has_header = false;
+		for(unsigned int j = 0; j < num_sandboxes; ++j)
+		{
+			const struct sandbox_s* sandbox = &sandboxes[j];
+			if(sandbox->exited || isnan(sandbox->values[i])) { continue; }
+
+			if(!has_header)
+			{
+				printf(
+					"# HELP hako_%s%s %s\n# TYPE hako_%s%s %s\n",
+					metric->name, suffix, metric->help, metric->name, suffix,
+					metric->counter ? "counter" : "gauge"
+				);
+				has_header = true;
+			}
+
+			printf(
+				"hako_%s%s{pid=\"%d\"} ", metric->name, suffix, (int)sandbox->pid
+			);
+			print_value(metric, sandbox->values[i]);
+			printf("\n");
+		}
+	}
+	printf("\n");
+}
+
+int
+main(int argc, char* argv[])
+{
+	(void)argc;
+
+	int exit_code = EXIT_SUCCESS;
+	struct sandbox_s* sandboxes = NULL;
+	unsigned int num_sandboxes = 0;
+
+	struct optparse_long opts[] = {
+		{"help", 'h', OPTPARSE_NONE},
+		{"interval", 'i', OPTPARSE_REQUIRED},
+		{"count", 'n', OPTPARSE_REQUIRED},
+		{"format", 'f', OPTPARSE_REQUIRED},
+		{0}
+	};
+
+	const char* help[] = {
+		NULL, "Print this message",
+		"MS", "Time between samples (default: 1000)",
+		"N", "Stop after this many samples (default: until all sandboxes exit)",
+		"NAME", "Output format: json or prometheus (default: json)",
+	};
+
+	const char* usage = "Usage: " PROG_NAME " [options] <pid> [pid...]";
+
+	int option;
+	long num;
+	long interval_ms = DEFAULT_INTERVAL_MS;
+	long count = 0;
+	enum format_e format = FORMAT_JSON;
+	struct optparse options;
+	optparse_init(&options, argv);
+
+	while((option = optparse_long(&options, opts, NULL)) != -1)
+	{
+		switch(option)
+		{
+			case 'h':
+				optparse_help(usage, opts, help);
+				quit(EXIT_SUCCESS);
+				break;
+			case 'i':
+				if(strtonum(options.optarg, &num) && num > 0)
+				{
+					interval_ms = num;
+				}
+				else
+				{
+					fprintf(
+						stderr, PROG_NAME ": invalid interval: %s\n", options.optarg
+					);
+					quit(EXIT_FAILURE);
+				}
+				break;
+			case 'n':
+				if(strtonum(options.optarg, &num) && num > 0)
+				{
+					count = num;
+				}
+				else
+				{
+					fprintf(
+						stderr, PROG_NAME ": invalid count: %s\n", options.optarg
+					);
+					quit(EXIT_FAILURE);
+				}
+				break;
+			case 'f':
+				if(strcmp(options.optarg, "json") == 0)
+				{
+					format = FORMAT_JSON;
+				}
+				else if(strcmp(options.optarg, "prometheus") == 0)
+				{
+					format = FORMAT_PROMETHEUS;
+				}
+				else
+				{
+					fprintf(
+						stderr, PROG_NAME ": invalid format: %s\n", options.optarg
+					);
+					quit(EXIT_FAILURE);
+				}
+				break;
+			case '?':
+				fprintf(stderr, PROG_NAME ": %s\n", options.errmsg);
+				quit(EXIT_FAILURE);
+				break;
+			default:
+				fprintf(stderr, "Unimplemented option\n");
+				quit(EXIT_FAILURE);
+				break;
+		}
+	}
+
+	char** pids = &options.argv[options.optind];
+	unsigned int num_pids = 0;
+	while(pids[num_pids] != NULL) { ++num_pids; }
+	if(num_pids == 0)
+	{
+		fprintf(stderr, PROG_NAME ": must provide sandbox pid\n");
+		quit(EXIT_FAILURE);
+	}
+
+	sandboxes = calloc(num_pids, sizeof(struct sandbox_s));
+	if(sandboxes == NULL)
+	{
+		perror("Could not allocate sandboxes");
+		quit(EXIT_FAILURE);
+	}
+
+	clock_ticks = sysconf(_SC_CLK_TCK);
+	page_size = sysconf(_SC_PAGESIZE);
+	for(; num_sandboxes < num_pids; ++num_sandboxes)
+	{
+		if(!strtonum(pids[num_sandboxes], &num) || num <= 0)
+		{
+			fprintf(stderr, PROG_NAME ": invalid pid: %s\n", pids[num_sandboxes]);
+			quit(EXIT_FAILURE);
+		}
+
+		if(!open_sandbox(&sandboxes[num_sandboxes], num))
+		{
+			cleanup_sandbox(&sandboxes[num_sandboxes]);
+			quit(EXIT_FAILURE);
+		}
+	}
+
+	// Samples are taken at a fixed rate, however long printing takes
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for(long sample = 0; count == 0 || sample < count; ++sample)
+	{
+		struct timespec now, real_now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		clock_gettime(CLOCK_REALTIME, &real_now);
+		uint64_t now_us = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+		uint64_t time_ms = (uint64_t)real_now.tv_sec * 1000
+			+ real_now.tv_nsec / 1000000;
+
+		unsigned int num_running = 0;
+		for(unsigned int i = 0; i < num_sandboxes; ++i)
+		{
+			struct sandbox_s* sandbox = &sandboxes[i];
+			if(sandbox->exited) { continue; }
+
+			if(!sample_sandbox(sandbox, now_us))
+			{
+				sandbox->exited = true;
+				cleanup_sandbox(sandbox);
+				continue;
+			}
+
+			++num_running;
+			if(format == FORMAT_JSON) { print_json(sandbox, time_ms); }
+		}
+
+		if(num_running == 0) { break; }
+
+		if(format == FORMAT_PROMETHEUS)
+		{
+			print_prometheus(sandboxes, num_sandboxes);
+		}
+		if(fflush(stdout) != 0)
+		{
+			perror("Could not write samples");
+			quit(EXIT_FAILURE);
+		}
+		if(count > 0 && sample + 1 == count) { break; }
+
+		next.tv_sec += interval_ms / 1000;
+		next.tv_nsec += interval_ms % 1000 * 1000000;
+		if(next.tv_nsec >= 1000000000)
+		{
+			++next.tv_sec;
+			next.tv_nsec -= 1000000000;
+		}
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+		{
+		}
+	}
+
+quit:
+	for(unsigned int i = 0; i < num_sandboxes; ++i)
+	{
+		cleanup_sandbox(&sandboxes[i]);
+	}
+	free(sandboxes);
+
+	return exit_code;
+}
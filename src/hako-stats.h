@@ -0,0 +1,260 @@
+#ifndef HAKO_STATS_H
+#define HAKO_STATS_H
+
+#include <inttypes.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include "hako-common.h"
+
+// Resource usage of a sandbox once it has exited, one JSON object per line:
+// {"pid":42,"exit_code":0,"wall_us":1200,"user_us":800,"sys_us":300,
+//  "max_rss_kb":2048,"major_faults":0,"minor_faults":120,
+//  "voluntary_switches":3,"involuntary_switches":1,"read_bytes":0,
+//  "write_bytes":4096,"source":"cgroup"}
+// CPU time, faults, peak memory and I/O come from the cgroup when the sandbox
+// has one with these controllers, covering processes the command did not wait
+// for. Otherwise they come from wait4() and I/O is counted in 512 byte blocks.
+
+#define STATS_BUF_SIZE 4096
+
+// Controllers of a cgroup, the others are left to wait4()
+#define USAGE_FAULTS 1
+#define USAGE_PEAK 2
+#define USAGE_IO 4
+
+struct usage_s
+{
+	uint64_t user_us;
+	uint64_t sys_us;
+	uint64_t max_rss_kb;
+	uint64_t major_faults;
+	uint64_t minor_faults;
+	uint64_t voluntary_switches;
+	uint64_t involuntary_switches;
+	uint64_t read_bytes;
+	uint64_t write_bytes;
+	int from_cgroup; // USAGE_* flags
+};
+
+// For files made of "key value" lines
+static HAKO_UNUSED bool
+find_stat_value(const char* buf, const char* key, uint64_t* value)
+{
+	size_t key_len = strlen(key);
+	for(const char* line = buf; line != NULL && *line != '\0';)
+	{
+		if(strncmp(line, key, key_len) == 0 && line[key_len] == ' ')
+		{
+			*value = strtoull(line + key_len + 1, NULL, 10);
+			return true;
+		}
+
+		line = strchr(line, '\n');
+		if(line != NULL) { ++line; }
+	}
+
+	return false;
+}
+
+// Sums a field of io.stat over all devices
+static HAKO_UNUSED uint64_t
+sum_io_stat(const char* buf, const char* field)
+{
+	uint64_t total = 0;
+	size_t field_len = strlen(field);
+	for(const char* c = buf; (c = strstr(c, field)) != NULL; c += field_len)
+	{
+		if((c == buf || c[-1] == ' ') && c[field_len] == '=')
+		{
+			total += strtoull(c + field_len + 1, NULL, 10);
+		}
+	}
+
+	return total;
+}
+
+static HAKO_UNUSED bool
+read_cgroup_stat(int cgroup_fd, const char* file, char* buf, size_t size)
+{
+	int fd = openat(cgroup_fd, file, O_RDONLY | O_CLOEXEC);
+	if(fd == -1) { return false; }
+
+	ssize_t len = read(fd, buf, size - 1);
+	close(fd);
+	if(len < 0) { return false; }
+
+	buf[len] = '\0';
+	return true;
+}
+
+// The peak of a cgroup covers all its life, it may come from an earlier
+// sandbox. Since 6.12, a write resets it for reads through the same file.
+// Returns -1 on older kernels, the peak then comes from wait4().
+static HAKO_UNUSED int
+reset_cgroup_peak(int cgroup_fd)
+{
+	int fd = openat(cgroup_fd, "memory.peak", O_RDWR | O_CLOEXEC);
+	if(fd == -1) { return -1; }
+
+	if(write(fd, "0", 1) != 1)
+	{
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+// Counters only, context switches are not tracked by cgroups.
+// peak_fd comes from reset_cgroup_peak(), -1 for none.
+static HAKO_UNUSED bool
+read_cgroup_usage(int cgroup_fd, int peak_fd, struct usage_s* usage)
+{
+	char buf[STATS_BUF_SIZE];
+	if(!read_cgroup_stat(cgroup_fd, "cpu.stat", buf, sizeof(buf))
+		|| !find_stat_value(buf, "user_usec", &usage->user_us)
+		|| !find_stat_value(buf, "system_usec", &usage->sys_us))
+	{
+		return false;
+	}
+
+	// Each controller is optional
+	uint64_t faults = 0;
+	if(read_cgroup_stat(cgroup_fd, "memory.stat", buf, sizeof(buf))
+		&& find_stat_value(buf, "pgfault", &faults)
+		&& find_stat_value(buf, "pgmajfault", &usage->major_faults))
+	{
+		usage->minor_faults = faults - usage->major_faults;
+		usage->from_cgroup |= USAGE_FAULTS;
+	}
+
+	ssize_t len = peak_fd >= 0 ? pread(peak_fd, buf, sizeof(buf) - 1, 0) : -1;
+	if(len > 0)
+	{
+		buf[len] = '\0';
+		usage->max_rss_kb = strtoull(buf, NULL, 10) / 1024;
+		usage->from_cgroup |= USAGE_PEAK;
+	}
+
+	if(read_cgroup_stat(cgroup_fd, "io.stat", buf, sizeof(buf)))
+	{
+		usage->read_bytes = sum_io_stat(buf, "rbytes");
+		usage->write_bytes = sum_io_stat(buf, "wbytes");
+		usage->from_cgroup |= USAGE_IO;
+	}
+
+	return true;
+}
+
+static HAKO_UNUSED void
+read_rusage(const struct rusage* rusage, struct usage_s* usage)
+{
+	usage->user_us = (uint64_t)rusage->ru_utime.tv_sec * 1000000
+		+ rusage->ru_utime.tv_usec;
+	usage->sys_us = (uint64_t)rusage->ru_stime.tv_sec * 1000000
+		+ rusage->ru_stime.tv_usec;
+	usage->max_rss_kb = rusage->ru_maxrss;
+	usage->major_faults = rusage->ru_majflt;
+	usage->minor_faults = rusage->ru_minflt;
+	usage->voluntary_switches = rusage->ru_nvcsw;
+	usage->involuntary_switches = rusage->ru_nivcsw;
+	usage->read_bytes = (uint64_t)rusage->ru_inblock * 512;
+	usage->write_bytes = (uint64_t)rusage->ru_oublock * 512;
+}
+
+// cgroup_start holds the counters of the cgroup when the sandbox started,
+// cgroup_fd is -1 without a cgroup
+static HAKO_UNUSED void
+write_usage(
+	int fd,
+	const char* id,
+	int exit_code,
+	uint64_t wall_ns,
+	const struct rusage* rusage,
+	int cgroup_fd,
+	int peak_fd,
+	const struct usage_s* cgroup_start
+)
+{
+	struct usage_s usage;
+	read_rusage(rusage, &usage);
+
+	struct usage_s cgroup_usage = { 0 };
+	bool from_cgroup = cgroup_fd >= 0
+		&& read_cgroup_usage(cgroup_fd, peak_fd, &cgroup_usage);
+	const struct usage_s* start = cgroup_start;
+	if(from_cgroup)
+	{
+		usage.user_us = cgroup_usage.user_us - start->user_us;
+		usage.sys_us = cgroup_usage.sys_us - start->sys_us;
+	}
+	if(from_cgroup && (cgroup_usage.from_cgroup & USAGE_FAULTS))
+	{
+		usage.major_faults = cgroup_usage.major_faults - start->major_faults;
+		usage.minor_faults = cgroup_usage.minor_faults - start->minor_faults;
+	}
+	if(from_cgroup && (cgroup_usage.from_cgroup & USAGE_PEAK))
+	{
+		usage.max_rss_kb = cgroup_usage.max_rss_kb;
+	}
+	if(from_cgroup && (cgroup_usage.from_cgroup & USAGE_IO))
+	{
+		usage.read_bytes = cgroup_usage.read_bytes - start->read_bytes;
+		usage.write_bytes = cgroup_usage.write_bytes - start->write_bytes;
+	}
+
+	char record[512];
+	int len = snprintf(
+		record, sizeof(record),
+		"{%s,\"exit_code\":%d,\"wall_us\":%" PRIu64
+		",\"user_us\":%" PRIu64 ",\"sys_us\":%" PRIu64
+		",\"max_rss_kb\":%" PRIu64
+		",\"major_faults\":%" PRIu64 ",\"minor_faults\":%" PRIu64
+		",\"voluntary_switches\":%" PRIu64
+		",\"involuntary_switches\":%" PRIu64
+		",\"read_bytes\":%" PRIu64 ",\"write_bytes\":%" PRIu64
+		",\"source\":\"%s\"}\n",
+		id, exit_code, wall_ns / 1000, usage.user_us, usage.sys_us,
+		usage.max_rss_kb, usage.major_faults, usage.minor_faults,
+		usage.voluntary_switches, usage.involuntary_switches,
+		usage.read_bytes, usage.write_bytes,
+		from_cgroup ? "cgroup" : "rusage"
+	);
+	if(len >= (int)sizeof(record)) { return; }
+
+	// A single write so that concurrent sandboxes can share a file
+	while(write(fd, record, len) == -1 && errno == EINTR) { }
+}
+
+// FILE is appended to, fd:N is duplicated so that the command keeps N
+static HAKO_UNUSED int
+open_stats_output(const char* prog_name, const char* spec)
+{
+	long num;
+	int fd;
+	if(strncmp(spec, "fd:", 3) == 0)
+	{
+		fd = strtonum(spec + 3, &num) && num >= 0 && num <= INT_MAX ?
+			fcntl(num, F_DUPFD_CLOEXEC, STDERR_FILENO + 1) : -1;
+		if(fd < 0)
+		{
+			fprintf(stderr, "%s: invalid stats fd: %s\n", prog_name, spec + 3);
+			return -1;
+		}
+
+		return fd;
+	}
+
+	fd = open(spec, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if(fd < 0)
+	{
+		fprintf(
+			stderr, "%s: could not open %s: %s\n", prog_name, spec, strerror(errno)
+		);
+	}
+
+	return fd;
+}
+
+#endif
@@ -0,0 +1,1376 @@
+#ifndef HAKO_SYSCALLS_H
+#define HAKO_SYSCALLS_H
+
+#include <sys/syscall.h>
+
+// Names of the syscalls known to the kernel headers, the ones which do not
+// exist on the target architecture are left out.
+// Generated from the x86-64, i386 and generic asm/unistd.h.
+
+struct syscall_name_s
+{
+	const char* name;
+	int nr;
+};
+
+#define SYSCALL_NAME(name) { #name, __NR_##name },
+
+static const struct syscall_name_s syscall_names[] = {
+#ifdef __NR__llseek
+	SYSCALL_NAME(_llseek)
+#endif
+#ifdef __NR__newselect
+	SYSCALL_NAME(_newselect)
+#endif
+#ifdef __NR__sysctl
+	SYSCALL_NAME(_sysctl)
+#endif
+#ifdef __NR_accept
+	SYSCALL_NAME(accept)
+#endif
+#ifdef __NR_accept4
+	SYSCALL_NAME(accept4)
+#endif
+#ifdef __NR_access
+	SYSCALL_NAME(access)
+#endif
+#ifdef __NR_acct
+	SYSCALL_NAME(acct)
+#endif
+#ifdef __NR_add_key
+	SYSCALL_NAME(add_key)
+#endif
+#ifdef __NR_adjtimex
+	SYSCALL_NAME(adjtimex)
+#endif
+#ifdef __NR_afs_syscall
+	SYSCALL_NAME(afs_syscall)
+#endif
+#ifdef __NR_alarm
+	SYSCALL_NAME(alarm)
+#endif
+#ifdef __NR_arch_prctl
+	SYSCALL_NAME(arch_prctl)
+#endif
+#ifdef __NR_bdflush
+	SYSCALL_NAME(bdflush)
+#endif
+#ifdef __NR_bind
+	SYSCALL_NAME(bind)
+#endif
+#ifdef __NR_bpf
+	SYSCALL_NAME(bpf)
+#endif
+#ifdef __NR_break
+	SYSCALL_NAME(break)
+#endif
+#ifdef __NR_brk
+	SYSCALL_NAME(brk)
+#endif
+#ifdef __NR_capget
+	SYSCALL_NAME(capget)
+#endif
+#ifdef __NR_capset
+	SYSCALL_NAME(capset)
+#endif
+#ifdef __NR_chdir
+	SYSCALL_NAME(chdir)
+#endif
+#ifdef __NR_chmod
+	SYSCALL_NAME(chmod)
+#endif
+#ifdef __NR_chown
+	SYSCALL_NAME(chown)
+#endif
+#ifdef __NR_chown32
+	SYSCALL_NAME(chown32)
+#endif
+#ifdef __NR_chroot
+	SYSCALL_NAME(chroot)
+#endif
+#ifdef __NR_clock_adjtime
+	SYSCALL_NAME(clock_adjtime)
+#endif
+#ifdef __NR_clock_adjtime64
+	SYSCALL_NAME(clock_adjtime64)
+#endif
+#ifdef __NR_clock_getres
+	SYSCALL_NAME(clock_getres)
+#endif
+#ifdef __NR_clock_getres_time64
+	SYSCALL_NAME(clock_getres_time64)
+#endif
+#ifdef __NR_clock_gettime
+	SYSCALL_NAME(clock_gettime)
+#endif
+#ifdef __NR_clock_gettime64
+	SYSCALL_NAME(clock_gettime64)
+#endif
+#ifdef __NR_clock_nanosleep
+	SYSCALL_NAME(clock_nanosleep)
+#endif
+#ifdef __NR_clock_nanosleep_time64
+	SYSCALL_NAME(clock_nanosleep_time64)
+#endif
+#ifdef __NR_clock_settime
+	SYSCALL_NAME(clock_settime)
+#endif
+#ifdef __NR_clock_settime64
+	SYSCALL_NAME(clock_settime64)
+#endif
+#ifdef __NR_clone
+	SYSCALL_NAME(clone)
+#endif
+#ifdef __NR_clone3
+	SYSCALL_NAME(clone3)
+#endif
+#ifdef __NR_close
+	SYSCALL_NAME(close)
+#endif
+#ifdef __NR_close_range
+	SYSCALL_NAME(close_range)
+#endif
+#ifdef __NR_connect
+	SYSCALL_NAME(connect)
+#endif
+#ifdef __NR_copy_file_range
+	SYSCALL_NAME(copy_file_range)
+#endif
+#ifdef __NR_creat
+	SYSCALL_NAME(creat)
+#endif
+#ifdef __NR_create_module
+	SYSCALL_NAME(create_module)
+#endif
+#ifdef __NR_delete_module
+	SYSCALL_NAME(delete_module)
+#endif
+#ifdef __NR_dup
+	SYSCALL_NAME(dup)
+#endif
+#ifdef __NR_dup2
+	SYSCALL_NAME(dup2)
+#endif
+#ifdef __NR_dup3
+	SYSCALL_NAME(dup3)
+#endif
+#ifdef __NR_epoll_create
+	SYSCALL_NAME(epoll_create)
+#endif
+#ifdef __NR_epoll_create1
+	SYSCALL_NAME(epoll_create1)
+#endif
+#ifdef __NR_epoll_ctl
+	SYSCALL_NAME(epoll_ctl)
+#endif
+#ifdef __NR_epoll_ctl_old
+	SYSCALL_NAME(epoll_ctl_old)
+#endif
+#ifdef __NR_epoll_pwait
+	SYSCALL_NAME(epoll_pwait)
+#endif
+#ifdef __NR_epoll_pwait2
+	SYSCALL_NAME(epoll_pwait2)
+#endif
+#ifdef __NR_epoll_wait
+	SYSCALL_NAME(epoll_wait)
+#endif
+#ifdef __NR_epoll_wait_old
+	SYSCALL_NAME(epoll_wait_old)
+#endif
+#ifdef __NR_eventfd
+	SYSCALL_NAME(eventfd)
+#endif
+#ifdef __NR_eventfd2
+	SYSCALL_NAME(eventfd2)
+#endif
+#ifdef __NR_execve
+	SYSCALL_NAME(execve)
+#endif
+#ifdef __NR_execveat
+	SYSCALL_NAME(execveat)
+#endif
+#ifdef __NR_exit
+	SYSCALL_NAME(exit)
+#endif
+#ifdef __NR_exit_group
+	SYSCALL_NAME(exit_group)
+#endif
+#ifdef __NR_faccessat
+	SYSCALL_NAME(faccessat)
+#endif
+#ifdef __NR_faccessat2
+	SYSCALL_NAME(faccessat2)
+#endif
+#ifdef __NR_fadvise64
+	SYSCALL_NAME(fadvise64)
+#endif
+#ifdef __NR_fadvise64_64
+	SYSCALL_NAME(fadvise64_64)
+#endif
+#ifdef __NR_fallocate
+	SYSCALL_NAME(fallocate)
+#endif
+#ifdef __NR_fanotify_init
+	SYSCALL_NAME(fanotify_init)
+#endif
+#ifdef __NR_fanotify_mark
+	SYSCALL_NAME(fanotify_mark)
+#endif
+#ifdef __NR_fchdir
+	SYSCALL_NAME(fchdir)
+#endif
+#ifdef __NR_fchmod
+	SYSCALL_NAME(fchmod)
+#endif
+#ifdef __NR_fchmodat
+	SYSCALL_NAME(fchmodat)
+#endif
+#ifdef __NR_fchown
+	SYSCALL_NAME(fchown)
+#endif
+#ifdef __NR_fchown32
+	SYSCALL_NAME(fchown32)
+#endif
+#ifdef __NR_fchownat
+	SYSCALL_NAME(fchownat)
+#endif
+#ifdef __NR_fcntl
+	SYSCALL_NAME(fcntl)
+#endif
+#ifdef __NR_fcntl64
+	SYSCALL_NAME(fcntl64)
+#endif
+#ifdef __NR_fdatasync
+	SYSCALL_NAME(fdatasync)
+#endif
+#ifdef __NR_fgetxattr
+	SYSCALL_NAME(fgetxattr)
+#endif
+#ifdef __NR_finit_module
+	SYSCALL_NAME(finit_module)
+#endif
+#ifdef __NR_flistxattr
+	SYSCALL_NAME(flistxattr)
+#endif
+#ifdef __NR_flock
+	SYSCALL_NAME(flock)
+#endif
+#ifdef __NR_fork
+	SYSCALL_NAME(fork)
+#endif
+#ifdef __NR_fremovexattr
+	SYSCALL_NAME(fremovexattr)
+#endif
+#ifdef __NR_fsconfig
+	SYSCALL_NAME(fsconfig)
+#endif
+#ifdef __NR_fsetxattr
+	SYSCALL_NAME(fsetxattr)
+#endif
+#ifdef __NR_fsmount
+	SYSCALL_NAME(fsmount)
+#endif
+#ifdef __NR_fsopen
+	SYSCALL_NAME(fsopen)
+#endif
+#ifdef __NR_fspick
+	SYSCALL_NAME(fspick)
+#endif
+#ifdef __NR_fstat
+	SYSCALL_NAME(fstat)
+#endif
+#ifdef __NR_fstat64
+	SYSCALL_NAME(fstat64)
+#endif
+#ifdef __NR_fstatat64
+	SYSCALL_NAME(fstatat64)
+#endif
+#ifdef __NR_fstatfs
+	SYSCALL_NAME(fstatfs)
+#endif
+#ifdef __NR_fstatfs64
+	SYSCALL_NAME(fstatfs64)
+#endif
+#ifdef __NR_fsync
+	SYSCALL_NAME(fsync)
+#endif
+#ifdef __NR_ftime
+	SYSCALL_NAME(ftime)
+#endif
+#ifdef __NR_ftruncate
+	SYSCALL_NAME(ftruncate)
+#endif
+#ifdef __NR_ftruncate64
+	SYSCALL_NAME(ftruncate64)
+#endif
+#ifdef __NR_futex
+	SYSCALL_NAME(futex)
+#endif
+#ifdef __NR_futex_time64
+	SYSCALL_NAME(futex_time64)
+#endif
+#ifdef __NR_futex_waitv
+	SYSCALL_NAME(futex_waitv)
+#endif
+#ifdef __NR_futimesat
+	SYSCALL_NAME(futimesat)
+#endif
+#ifdef __NR_get_kernel_syms
+	SYSCALL_NAME(get_kernel_syms)
+#endif
+#ifdef __NR_get_mempolicy
+	SYSCALL_NAME(get_mempolicy)
+#endif
+#ifdef __NR_get_robust_list
+	SYSCALL_NAME(get_robust_list)
+#endif
+#ifdef __NR_get_thread_area
+	SYSCALL_NAME(get_thread_area)
+#endif
+#ifdef __NR_getcpu
+	SYSCALL_NAME(getcpu)
+#endif
+#ifdef __NR_getcwd
+	SYSCALL_NAME(getcwd)
+#endif
+#ifdef __NR_getdents
+	SYSCALL_NAME(getdents)
+#endif
+#ifdef __NR_getdents64
+	SYSCALL_NAME(getdents64)
+#endif
+#ifdef __NR_getegid
+	SYSCALL_NAME(getegid)
+#endif
+#ifdef __NR_getegid32
+	SYSCALL_NAME(getegid32)
+#endif
+#ifdef __NR_geteuid
+	SYSCALL_NAME(geteuid)
+#endif
+#ifdef __NR_geteuid32
+	SYSCALL_NAME(geteuid32)
+#endif
+#ifdef __NR_getgid
+	SYSCALL_NAME(getgid)
+#endif
+#ifdef __NR_getgid32
+	SYSCALL_NAME(getgid32)
+#endif
+#ifdef __NR_getgroups
+	SYSCALL_NAME(getgroups)
+#endif
+#ifdef __NR_getgroups32
+	SYSCALL_NAME(getgroups32)
+#endif
+#ifdef __NR_getitimer
+	SYSCALL_NAME(getitimer)
+#endif
+#ifdef __NR_getpeername
+	SYSCALL_NAME(getpeername)
+#endif
+#ifdef __NR_getpgid
+	SYSCALL_NAME(getpgid)
+#endif
+#ifdef __NR_getpgrp
+	SYSCALL_NAME(getpgrp)
+#endif
+#ifdef __NR_getpid
+	SYSCALL_NAME(getpid)
+#endif
+#ifdef __NR_getpmsg
+	SYSCALL_NAME(getpmsg)
+#endif
+#ifdef __NR_getppid
+	SYSCALL_NAME(getppid)
+#endif
+#ifdef __NR_getpriority
+	SYSCALL_NAME(getpriority)
+#endif
+#ifdef __NR_getrandom
+	SYSCALL_NAME(getrandom)
+#endif
+#ifdef __NR_getresgid
+	SYSCALL_NAME(getresgid)
+#endif
+#ifdef __NR_getresgid32
+	SYSCALL_NAME(getresgid32)
+#endif
+#ifdef __NR_getresuid
+	SYSCALL_NAME(getresuid)
+#endif
+#ifdef __NR_getresuid32
+	SYSCALL_NAME(getresuid32)
+#endif
+#ifdef __NR_getrlimit
+	SYSCALL_NAME(getrlimit)
+#endif
+#ifdef __NR_getrusage
+	SYSCALL_NAME(getrusage)
+#endif
+#ifdef __NR_getsid
+	SYSCALL_NAME(getsid)
+#endif
+#ifdef __NR_getsockname
+	SYSCALL_NAME(getsockname)
+#endif
+#ifdef __NR_getsockopt
+	SYSCALL_NAME(getsockopt)
+#endif
+#ifdef __NR_gettid
+	SYSCALL_NAME(gettid)
+#endif
+#ifdef __NR_gettimeofday
+	SYSCALL_NAME(gettimeofday)
+#endif
+#ifdef __NR_getuid
+	SYSCALL_NAME(getuid)
+#endif
+#ifdef __NR_getuid32
+	SYSCALL_NAME(getuid32)
+#endif
+#ifdef __NR_getxattr
+	SYSCALL_NAME(getxattr)
+#endif
+#ifdef __NR_gtty
+	SYSCALL_NAME(gtty)
+#endif
+#ifdef __NR_idle
+	SYSCALL_NAME(idle)
+#endif
+#ifdef __NR_init_module
+	SYSCALL_NAME(init_module)
+#endif
+#ifdef __NR_inotify_add_watch
+	SYSCALL_NAME(inotify_add_watch)
+#endif
+#ifdef __NR_inotify_init
+	SYSCALL_NAME(inotify_init)
+#endif
+#ifdef __NR_inotify_init1
+	SYSCALL_NAME(inotify_init1)
+#endif
+#ifdef __NR_inotify_rm_watch
+	SYSCALL_NAME(inotify_rm_watch)
+#endif
+#ifdef __NR_io_cancel
+	SYSCALL_NAME(io_cancel)
+#endif
+#ifdef __NR_io_destroy
+	SYSCALL_NAME(io_destroy)
+#endif
+#ifdef __NR_io_getevents
+	SYSCALL_NAME(io_getevents)
+#endif
+#ifdef __NR_io_pgetevents
+	SYSCALL_NAME(io_pgetevents)
+#endif
+#ifdef __NR_io_pgetevents_time64
+	SYSCALL_NAME(io_pgetevents_time64)
+#endif
+#ifdef __NR_io_setup
+	SYSCALL_NAME(io_setup)
+#endif
+#ifdef __NR_io_submit
+	SYSCALL_NAME(io_submit)
+#endif
+#ifdef __NR_io_uring_enter
+	SYSCALL_NAME(io_uring_enter)
+#endif
+#ifdef __NR_io_uring_register
+	SYSCALL_NAME(io_uring_register)
+#endif
+#ifdef __NR_io_uring_setup
+	SYSCALL_NAME(io_uring_setup)
+#endif
+#ifdef __NR_ioctl
+	SYSCALL_NAME(ioctl)
+#endif
+#ifdef __NR_ioperm
+	SYSCALL_NAME(ioperm)
+#endif
+#ifdef __NR_iopl
+	SYSCALL_NAME(iopl)
+#endif
+#ifdef __NR_ioprio_get
+	SYSCALL_NAME(ioprio_get)
+#endif
+#ifdef __NR_ioprio_set
+	SYSCALL_NAME(ioprio_set)
+#endif
+#ifdef __NR_ipc
+	SYSCALL_NAME(ipc)
+#endif
+#ifdef __NR_kcmp
+	SYSCALL_NAME(kcmp)
+#endif
+#ifdef __NR_kexec_file_load
+	SYSCALL_NAME(kexec_file_load)
+#endif
+#ifdef __NR_kexec_load
+	SYSCALL_NAME(kexec_load)
+#endif
+#ifdef __NR_keyctl
+	SYSCALL_NAME(keyctl)
+#endif
+#ifdef __NR_kill
+	SYSCALL_NAME(kill)
+#endif
+#ifdef __NR_landlock_add_rule
+	SYSCALL_NAME(landlock_add_rule)
+#endif
+#ifdef __NR_landlock_create_ruleset
+	SYSCALL_NAME(landlock_create_ruleset)
+#endif
+#ifdef __NR_landlock_restrict_self
+	SYSCALL_NAME(landlock_restrict_self)
+#endif
+#ifdef __NR_lchown
+	SYSCALL_NAME(lchown)
+#endif
+#ifdef __NR_lchown32
+	SYSCALL_NAME(lchown32)
+#endif
+#ifdef __NR_lgetxattr
+	SYSCALL_NAME(lgetxattr)
+#endif
+#ifdef __NR_link
+	SYSCALL_NAME(link)
+#endif
+#ifdef __NR_linkat
+	SYSCALL_NAME(linkat)
+#endif
+#ifdef __NR_listen
+	SYSCALL_NAME(listen)
+#endif
+#ifdef __NR_listxattr
+	SYSCALL_NAME(listxattr)
+#endif
+#ifdef __NR_llistxattr
+	SYSCALL_NAME(llistxattr)
+#endif
+#ifdef __NR_llseek
+	SYSCALL_NAME(llseek)
+#endif
+#ifdef __NR_lock
+	SYSCALL_NAME(lock)
+#endif
+#ifdef __NR_lookup_dcookie
+	SYSCALL_NAME(lookup_dcookie)
+#endif
+#ifdef __NR_lremovexattr
+	SYSCALL_NAME(lremovexattr)
+#endif
+#ifdef __NR_lseek
+	SYSCALL_NAME(lseek)
+#endif
+#ifdef __NR_lsetxattr
+	SYSCALL_NAME(lsetxattr)
+#endif
+#ifdef __NR_lstat
+	SYSCALL_NAME(lstat)
+#endif
+#ifdef __NR_lstat64
+	SYSCALL_NAME(lstat64)
+#endif
+#ifdef __NR_madvise
+	SYSCALL_NAME(madvise)
+#endif
+#ifdef __NR_mbind
+	SYSCALL_NAME(mbind)
+#endif
+#ifdef __NR_membarrier
+	SYSCALL_NAME(membarrier)
+#endif
+#ifdef __NR_memfd_create
+	SYSCALL_NAME(memfd_create)
+#endif
+#ifdef __NR_memfd_secret
+	SYSCALL_NAME(memfd_secret)
+#endif
+#ifdef __NR_migrate_pages
+	SYSCALL_NAME(migrate_pages)
+#endif
+#ifdef __NR_mincore
+	SYSCALL_NAME(mincore)
+#endif
+#ifdef __NR_mkdir
+	SYSCALL_NAME(mkdir)
+#endif
+#ifdef __NR_mkdirat
+	SYSCALL_NAME(mkdirat)
+#endif
+#ifdef __NR_mknod
+	SYSCALL_NAME(mknod)
+#endif
+#ifdef __NR_mknodat
+	SYSCALL_NAME(mknodat)
+#endif
+#ifdef __NR_mlock
+	SYSCALL_NAME(mlock)
+#endif
+#ifdef __NR_mlock2
+	SYSCALL_NAME(mlock2)
+#endif
+#ifdef __NR_mlockall
+	SYSCALL_NAME(mlockall)
+#endif
+#ifdef __NR_mmap
+	SYSCALL_NAME(mmap)
+#endif
+#ifdef __NR_mmap2
+	SYSCALL_NAME(mmap2)
+#endif
+#ifdef __NR_modify_ldt
+	SYSCALL_NAME(modify_ldt)
+#endif
+#ifdef __NR_mount
+	SYSCALL_NAME(mount)
+#endif
+#ifdef __NR_mount_setattr
+	SYSCALL_NAME(mount_setattr)
+#endif
+#ifdef __NR_move_mount
+	SYSCALL_NAME(move_mount)
+#endif
+#ifdef __NR_move_pages
+	SYSCALL_NAME(move_pages)
+#endif
+#ifdef __NR_mprotect
+	SYSCALL_NAME(mprotect)
+#endif
+#ifdef __NR_mpx
+	SYSCALL_NAME(mpx)
+#endif
+#ifdef __NR_mq_getsetattr
+	SYSCALL_NAME(mq_getsetattr)
+#endif
+#ifdef __NR_mq_notify
+	SYSCALL_NAME(mq_notify)
+#endif
+#ifdef __NR_mq_open
+	SYSCALL_NAME(mq_open)
+#endif
+#ifdef __NR_mq_timedreceive
+	SYSCALL_NAME(mq_timedreceive)
+#endif
+#ifdef __NR_mq_timedreceive_time64
+	SYSCALL_NAME(mq_timedreceive_time64)
+#endif
+#ifdef __NR_mq_timedsend
+	SYSCALL_NAME(mq_timedsend)
+#endif
+#ifdef __NR_mq_timedsend_time64
+	SYSCALL_NAME(mq_timedsend_time64)
+#endif
+#ifdef __NR_mq_unlink
+	SYSCALL_NAME(mq_unlink)
+#endif
+#ifdef __NR_mremap
+	SYSCALL_NAME(mremap)
+#endif
+#ifdef __NR_msgctl
+	SYSCALL_NAME(msgctl)
+#endif
+#ifdef __NR_msgget
+	SYSCALL_NAME(msgget)
+#endif
+#ifdef __NR_msgrcv
+	SYSCALL_NAME(msgrcv)
+#endif
+#ifdef __NR_msgsnd
+	SYSCALL_NAME(msgsnd)
+#endif
+#ifdef __NR_msync
+	SYSCALL_NAME(msync)
+#endif
+#ifdef __NR_munlock
+	SYSCALL_NAME(munlock)
+#endif
+#ifdef __NR_munlockall
+	SYSCALL_NAME(munlockall)
+#endif
+#ifdef __NR_munmap
+	SYSCALL_NAME(munmap)
+#endif
+#ifdef __NR_name_to_handle_at
+	SYSCALL_NAME(name_to_handle_at)
+#endif
+#ifdef __NR_nanosleep
+	SYSCALL_NAME(nanosleep)
+#endif
+#ifdef __NR_newfstatat
+	SYSCALL_NAME(newfstatat)
+#endif
+#ifdef __NR_nfsservctl
+	SYSCALL_NAME(nfsservctl)
+#endif
+#ifdef __NR_nice
+	SYSCALL_NAME(nice)
+#endif
+#ifdef __NR_oldfstat
+	SYSCALL_NAME(oldfstat)
+#endif
+#ifdef __NR_oldlstat
+	SYSCALL_NAME(oldlstat)
+#endif
+#ifdef __NR_oldolduname
+	SYSCALL_NAME(oldolduname)
+#endif
+#ifdef __NR_oldstat
+	SYSCALL_NAME(oldstat)
+#endif
+#ifdef __NR_olduname
+	SYSCALL_NAME(olduname)
+#endif
+#ifdef __NR_open
+	SYSCALL_NAME(open)
+#endif
+#ifdef __NR_open_by_handle_at
+	SYSCALL_NAME(open_by_handle_at)
+#endif
+#ifdef __NR_open_tree
+	SYSCALL_NAME(open_tree)
+#endif
+#ifdef __NR_openat
+	SYSCALL_NAME(openat)
+#endif
+#ifdef __NR_openat2
+	SYSCALL_NAME(openat2)
+#endif
+#ifdef __NR_pause
+	SYSCALL_NAME(pause)
+#endif
+#ifdef __NR_perf_event_open
+	SYSCALL_NAME(perf_event_open)
+#endif
+#ifdef __NR_personality
+	SYSCALL_NAME(personality)
+#endif
+#ifdef __NR_pidfd_getfd
+	SYSCALL_NAME(pidfd_getfd)
+#endif
+#ifdef __NR_pidfd_open
+	SYSCALL_NAME(pidfd_open)
+#endif
+#ifdef __NR_pidfd_send_signal
+	SYSCALL_NAME(pidfd_send_signal)
+#endif
+#ifdef __NR_pipe
+	SYSCALL_NAME(pipe)
+#endif
+#ifdef __NR_pipe2
+	SYSCALL_NAME(pipe2)
+#endif
+#ifdef __NR_pivot_root
+	SYSCALL_NAME(pivot_root)
+#endif
+#ifdef __NR_pkey_alloc
+	SYSCALL_NAME(pkey_alloc)
+#endif
+#ifdef __NR_pkey_free
+	SYSCALL_NAME(pkey_free)
+#endif
+#ifdef __NR_pkey_mprotect
+	SYSCALL_NAME(pkey_mprotect)
+#endif
+#ifdef __NR_poll
+	SYSCALL_NAME(poll)
+#endif
+#ifdef __NR_ppoll
+	SYSCALL_NAME(ppoll)
+#endif
+#ifdef __NR_ppoll_time64
+	SYSCALL_NAME(ppoll_time64)
+#endif
+#ifdef __NR_prctl
+	SYSCALL_NAME(prctl)
+#endif
+#ifdef __NR_pread64
+	SYSCALL_NAME(pread64)
+#endif
+#ifdef __NR_preadv
+	SYSCALL_NAME(preadv)
+#endif
+#ifdef __NR_preadv2
+	SYSCALL_NAME(preadv2)
+#endif
+#ifdef __NR_prlimit64
+	SYSCALL_NAME(prlimit64)
+#endif
+#ifdef __NR_process_madvise
+	SYSCALL_NAME(process_madvise)
+#endif
+#ifdef __NR_process_mrelease
+	SYSCALL_NAME(process_mrelease)
+#endif
+#ifdef __NR_process_vm_readv
+	SYSCALL_NAME(process_vm_readv)
+#endif
+#ifdef __NR_process_vm_writev
+	SYSCALL_NAME(process_vm_writev)
+#endif
+#ifdef __NR_prof
+	SYSCALL_NAME(prof)
+#endif
+#ifdef __NR_profil
+	SYSCALL_NAME(profil)
+#endif
+#ifdef __NR_pselect6
+	SYSCALL_NAME(pselect6)
+#endif
+#ifdef __NR_pselect6_time64
+	SYSCALL_NAME(pselect6_time64)
+#endif
+#ifdef __NR_ptrace
+	SYSCALL_NAME(ptrace)
+#endif
+#ifdef __NR_putpmsg
+	SYSCALL_NAME(putpmsg)
+#endif
+#ifdef __NR_pwrite64
+	SYSCALL_NAME(pwrite64)
+#endif
+#ifdef __NR_pwritev
+	SYSCALL_NAME(pwritev)
+#endif
+#ifdef __NR_pwritev2
+	SYSCALL_NAME(pwritev2)
+#endif
+#ifdef __NR_query_module
+	SYSCALL_NAME(query_module)
+#endif
+#ifdef __NR_quotactl
+	SYSCALL_NAME(quotactl)
+#endif
+#ifdef __NR_quotactl_fd
+	SYSCALL_NAME(quotactl_fd)
+#endif
+#ifdef __NR_read
+	SYSCALL_NAME(read)
+#endif
+#ifdef __NR_readahead
+	SYSCALL_NAME(readahead)
+#endif
+#ifdef __NR_readdir
+	SYSCALL_NAME(readdir)
+#endif
+#ifdef __NR_readlink
+	SYSCALL_NAME(readlink)
+#endif
+#ifdef __NR_readlinkat
+	SYSCALL_NAME(readlinkat)
+#endif
+#ifdef __NR_readv
+	SYSCALL_NAME(readv)
+#endif
+#ifdef __NR_reboot
+	SYSCALL_NAME(reboot)
+#endif
+#ifdef __NR_recvfrom
+	SYSCALL_NAME(recvfrom)
+#endif
+#ifdef __NR_recvmmsg
+	SYSCALL_NAME(recvmmsg)
+#endif
+#ifdef __NR_recvmmsg_time64
+	SYSCALL_NAME(recvmmsg_time64)
+#endif
+#ifdef __NR_recvmsg
+	SYSCALL_NAME(recvmsg)
+#endif
+#ifdef __NR_remap_file_pages
+	SYSCALL_NAME(remap_file_pages)
+#endif
+#ifdef __NR_removexattr
+	SYSCALL_NAME(removexattr)
+#endif
+#ifdef __NR_rename
+	SYSCALL_NAME(rename)
+#endif
+#ifdef __NR_renameat
+	SYSCALL_NAME(renameat)
+#endif
+#ifdef __NR_renameat2
+	SYSCALL_NAME(renameat2)
+#endif
+#ifdef __NR_request_key
+	SYSCALL_NAME(request_key)
+#endif
+#ifdef __NR_restart_syscall
+	SYSCALL_NAME(restart_syscall)
+#endif
+#ifdef __NR_rmdir
+	SYSCALL_NAME(rmdir)
+#endif
+#ifdef __NR_rseq
+	SYSCALL_NAME(rseq)
+#endif
+#ifdef __NR_rt_sigaction
+	SYSCALL_NAME(rt_sigaction)
+#endif
+#ifdef __NR_rt_sigpending
+	SYSCALL_NAME(rt_sigpending)
+#endif
+#ifdef __NR_rt_sigprocmask
+	SYSCALL_NAME(rt_sigprocmask)
+#endif
+#ifdef __NR_rt_sigqueueinfo
+	SYSCALL_NAME(rt_sigqueueinfo)
+#endif
+#ifdef __NR_rt_sigreturn
+	SYSCALL_NAME(rt_sigreturn)
+#endif
+#ifdef __NR_rt_sigsuspend
+	SYSCALL_NAME(rt_sigsuspend)
+#endif
+#ifdef __NR_rt_sigtimedwait
+	SYSCALL_NAME(rt_sigtimedwait)
+#endif
+#ifdef __NR_rt_sigtimedwait_time64
+	SYSCALL_NAME(rt_sigtimedwait_time64)
+#endif
+#ifdef __NR_rt_tgsigqueueinfo
+	SYSCALL_NAME(rt_tgsigqueueinfo)
+#endif
+#ifdef __NR_sched_get_priority_max
+	SYSCALL_NAME(sched_get_priority_max)
+#endif
+#ifdef __NR_sched_get_priority_min
+	SYSCALL_NAME(sched_get_priority_min)
+#endif
+#ifdef __NR_sched_getaffinity
+	SYSCALL_NAME(sched_getaffinity)
+#endif
+#ifdef __NR_sched_getattr
+	SYSCALL_NAME(sched_getattr)
+#endif
+#ifdef __NR_sched_getparam
+	SYSCALL_NAME(sched_getparam)
+#endif
+#ifdef __NR_sched_getscheduler
+	SYSCALL_NAME(sched_getscheduler)
+#endif
+#ifdef __NR_sched_rr_get_interval
+	SYSCALL_NAME(sched_rr_get_interval)
+#endif
+#ifdef __NR_sched_rr_get_interval_time64
+	SYSCALL_NAME(sched_rr_get_interval_time64)
+#endif
+#ifdef __NR_sched_setaffinity
+	SYSCALL_NAME(sched_setaffinity)
+#endif
+#ifdef __NR_sched_setattr
+	SYSCALL_NAME(sched_setattr)
+#endif
+#ifdef __NR_sched_setparam
+	SYSCALL_NAME(sched_setparam)
+#endif
+#ifdef __NR_sched_setscheduler
+	SYSCALL_NAME(sched_setscheduler)
+#endif
+#ifdef __NR_sched_yield
+	SYSCALL_NAME(sched_yield)
+#endif
+#ifdef __NR_seccomp
+	SYSCALL_NAME(seccomp)
+#endif
+#ifdef __NR_security
+	SYSCALL_NAME(security)
+#endif
+#ifdef __NR_select
+	SYSCALL_NAME(select)
+#endif
+#ifdef __NR_semctl
+	SYSCALL_NAME(semctl)
+#endif
+#ifdef __NR_semget
+	SYSCALL_NAME(semget)
+#endif
+#ifdef __NR_semop
+	SYSCALL_NAME(semop)
+#endif
+#ifdef __NR_semtimedop
+	SYSCALL_NAME(semtimedop)
+#endif
+#ifdef __NR_semtimedop_time64
+	SYSCALL_NAME(semtimedop_time64)
+#endif
+#ifdef __NR_sendfile
+	SYSCALL_NAME(sendfile)
+#endif
+#ifdef __NR_sendfile64
+	SYSCALL_NAME(sendfile64)
+#endif
+#ifdef __NR_sendmmsg
+	SYSCALL_NAME(sendmmsg)
+#endif
+#ifdef __NR_sendmsg
+	SYSCALL_NAME(sendmsg)
+#endif
+#ifdef __NR_sendto
+	SYSCALL_NAME(sendto)
+#endif
+#ifdef __NR_set_mempolicy
+	SYSCALL_NAME(set_mempolicy)
+#endif
+#ifdef __NR_set_mempolicy_home_node
+	SYSCALL_NAME(set_mempolicy_home_node)
+#endif
+#ifdef __NR_set_robust_list
+	SYSCALL_NAME(set_robust_list)
+#endif
+#ifdef __NR_set_thread_area
+	SYSCALL_NAME(set_thread_area)
+#endif
+#ifdef __NR_set_tid_address
+	SYSCALL_NAME(set_tid_address)
+#endif
+#ifdef __NR_setdomainname
+	SYSCALL_NAME(setdomainname)
+#endif
+#ifdef __NR_setfsgid
+	SYSCALL_NAME(setfsgid)
+#endif
+#ifdef __NR_setfsgid32
+	SYSCALL_NAME(setfsgid32)
+#endif
+#ifdef __NR_setfsuid
+	SYSCALL_NAME(setfsuid)
+#endif
+#ifdef __NR_setfsuid32
+	SYSCALL_NAME(setfsuid32)
+#endif
+#ifdef __NR_setgid
+	SYSCALL_NAME(setgid)
+#endif
+#ifdef __NR_setgid32
+	SYSCALL_NAME(setgid32)
+#endif
+#ifdef __NR_setgroups
+	SYSCALL_NAME(setgroups)
+#endif
+#ifdef __NR_setgroups32
+	SYSCALL_NAME(setgroups32)
+#endif
+#ifdef __NR_sethostname
+	SYSCALL_NAME(sethostname)
+#endif
+#ifdef __NR_setitimer
+	SYSCALL_NAME(setitimer)
+#endif
+#ifdef __NR_setns
+	SYSCALL_NAME(setns)
+#endif
+#ifdef __NR_setpgid
+	SYSCALL_NAME(setpgid)
+#endif
+#ifdef __NR_setpriority
+	SYSCALL_NAME(setpriority)
+#endif
+#ifdef __NR_setregid
+	SYSCALL_NAME(setregid)
+#endif
+#ifdef __NR_setregid32
+	SYSCALL_NAME(setregid32)
+#endif
+#ifdef __NR_setresgid
+	SYSCALL_NAME(setresgid)
+#endif
+#ifdef __NR_setresgid32
+	SYSCALL_NAME(setresgid32)
+#endif
+#ifdef __NR_setresuid
+	SYSCALL_NAME(setresuid)
+#endif
+#ifdef __NR_setresuid32
+	SYSCALL_NAME(setresuid32)
+#endif
+#ifdef __NR_setreuid
+	SYSCALL_NAME(setreuid)
+#endif
+#ifdef __NR_setreuid32
+	SYSCALL_NAME(setreuid32)
+#endif
+#ifdef __NR_setrlimit
+	SYSCALL_NAME(setrlimit)
+#endif
+#ifdef __NR_setsid
+	SYSCALL_NAME(setsid)
+#endif
+#ifdef __NR_setsockopt
+	SYSCALL_NAME(setsockopt)
+#endif
+#ifdef __NR_settimeofday
+	SYSCALL_NAME(settimeofday)
+#endif
+#ifdef __NR_setuid
+	SYSCALL_NAME(setuid)
+#endif
+#ifdef __NR_setuid32
+	SYSCALL_NAME(setuid32)
+#endif
+#ifdef __NR_setxattr
+	SYSCALL_NAME(setxattr)
+#endif
+#ifdef __NR_sgetmask
+	SYSCALL_NAME(sgetmask)
+#endif
+#ifdef __NR_shmat
+	SYSCALL_NAME(shmat)
+#endif
+#ifdef __NR_shmctl
+	SYSCALL_NAME(shmctl)
+#endif
+#ifdef __NR_shmdt
+	SYSCALL_NAME(shmdt)
+#endif
+#ifdef __NR_shmget
+	SYSCALL_NAME(shmget)
+#endif
+#ifdef __NR_shutdown
+	SYSCALL_NAME(shutdown)
+#endif
+#ifdef __NR_sigaction
+	SYSCALL_NAME(sigaction)
+#endif
+#ifdef __NR_sigaltstack
+	SYSCALL_NAME(sigaltstack)
+#endif
+#ifdef __NR_signal
+	SYSCALL_NAME(signal)
+#endif
+#ifdef __NR_signalfd
+	SYSCALL_NAME(signalfd)
+#endif
+#ifdef __NR_signalfd4
+	SYSCALL_NAME(signalfd4)
+#endif
+#ifdef __NR_sigpending
+	SYSCALL_NAME(sigpending)
+#endif
+#ifdef __NR_sigprocmask
+	SYSCALL_NAME(sigprocmask)
+#endif
+#ifdef __NR_sigreturn
+	SYSCALL_NAME(sigreturn)
+#endif
+#ifdef __NR_sigsuspend
+	SYSCALL_NAME(sigsuspend)
+#endif
+#ifdef __NR_socket
+	SYSCALL_NAME(socket)
+#endif
+#ifdef __NR_socketcall
+	SYSCALL_NAME(socketcall)
+#endif
+#ifdef __NR_socketpair
+	SYSCALL_NAME(socketpair)
+#endif
+#ifdef __NR_splice
+	SYSCALL_NAME(splice)
+#endif
+#ifdef __NR_ssetmask
+	SYSCALL_NAME(ssetmask)
+#endif
+#ifdef __NR_stat
+	SYSCALL_NAME(stat)
+#endif
+#ifdef __NR_stat64
+	SYSCALL_NAME(stat64)
+#endif
+#ifdef __NR_statfs
+	SYSCALL_NAME(statfs)
+#endif
+#ifdef __NR_statfs64
+	SYSCALL_NAME(statfs64)
+#endif
+#ifdef __NR_statx
+	SYSCALL_NAME(statx)
+#endif
+#ifdef __NR_stime
+	SYSCALL_NAME(stime)
+#endif
+#ifdef __NR_stty
+	SYSCALL_NAME(stty)
+#endif
+#ifdef __NR_swapoff
+	SYSCALL_NAME(swapoff)
+#endif
+#ifdef __NR_swapon
+	SYSCALL_NAME(swapon)
+#endif
+#ifdef __NR_symlink
+	SYSCALL_NAME(symlink)
+#endif
+#ifdef __NR_symlinkat
+	SYSCALL_NAME(symlinkat)
+#endif
+#ifdef __NR_sync
+	SYSCALL_NAME(sync)
+#endif
+#ifdef __NR_sync_file_range
+	SYSCALL_NAME(sync_file_range)
+#endif
+#ifdef __NR_sync_file_range2
+	SYSCALL_NAME(sync_file_range2)
+#endif
+#ifdef __NR_syncfs
+	SYSCALL_NAME(syncfs)
+#endif
+#ifdef __NR_sysfs
+	SYSCALL_NAME(sysfs)
+#endif
+#ifdef __NR_sysinfo
+	SYSCALL_NAME(sysinfo)
+#endif
+#ifdef __NR_syslog
+	SYSCALL_NAME(syslog)
+#endif
+#ifdef __NR_tee
+	SYSCALL_NAME(tee)
+#endif
+#ifdef __NR_tgkill
+	SYSCALL_NAME(tgkill)
+#endif
+#ifdef __NR_time
+	SYSCALL_NAME(time)
+#endif
+#ifdef __NR_timer_create
+	SYSCALL_NAME(timer_create)
+#endif
+#ifdef __NR_timer_delete
+	SYSCALL_NAME(timer_delete)
+#endif
+#ifdef __NR_timer_getoverrun
+	SYSCALL_NAME(timer_getoverrun)
+#endif
+#ifdef __NR_timer_gettime
+	SYSCALL_NAME(timer_gettime)
+#endif
+#ifdef __NR_timer_gettime64
+	SYSCALL_NAME(timer_gettime64)
+#endif
+#ifdef __NR_timer_settime
+	SYSCALL_NAME(timer_settime)
+#endif
+#ifdef __NR_timer_settime64
+	SYSCALL_NAME(timer_settime64)
+#endif
+#ifdef __NR_timerfd_create
+	SYSCALL_NAME(timerfd_create)
+#endif
+#ifdef __NR_timerfd_gettime
+	SYSCALL_NAME(timerfd_gettime)
+#endif
+#ifdef __NR_timerfd_gettime64
+	SYSCALL_NAME(timerfd_gettime64)
+#endif
+#ifdef __NR_timerfd_settime
+	SYSCALL_NAME(timerfd_settime)
+#endif
+#ifdef __NR_timerfd_settime64
+	SYSCALL_NAME(timerfd_settime64)
+#endif
+#ifdef __NR_times
+	SYSCALL_NAME(times)
+#endif
+#ifdef __NR_tkill
+	SYSCALL_NAME(tkill)
+#endif
+#ifdef __NR_truncate
+	SYSCALL_NAME(truncate)
+#endif
+#ifdef __NR_truncate64
+	SYSCALL_NAME(truncate64)
+#endif
+#ifdef __NR_tuxcall
+	SYSCALL_NAME(tuxcall)
+#endif
+#ifdef __NR_ugetrlimit
+	SYSCALL_NAME(ugetrlimit)
+#endif
+#ifdef __NR_ulimit
+	SYSCALL_NAME(ulimit)
+#endif
+#ifdef __NR_umask
+	SYSCALL_NAME(umask)
+#endif
+#ifdef __NR_umount
+	SYSCALL_NAME(umount)
+#endif
+#ifdef __NR_umount2
+	SYSCALL_NAME(umount2)
+#endif
+#ifdef __NR_uname
+	SYSCALL_NAME(uname)
+#endif
+#ifdef __NR_unlink
+	SYSCALL_NAME(unlink)
+#endif
+#ifdef __NR_unlinkat
+	SYSCALL_NAME(unlinkat)
+#endif
+#ifdef __NR_unshare
+	SYSCALL_NAME(unshare)
+#endif
+#ifdef __NR_uselib
+	SYSCALL_NAME(uselib)
+#endif
+#ifdef __NR_userfaultfd
+	SYSCALL_NAME(userfaultfd)
+#endif
+#ifdef __NR_ustat
+	SYSCALL_NAME(ustat)
+#endif
+#ifdef __NR_utime
+	SYSCALL_NAME(utime)
+#endif
+#ifdef __NR_utimensat
+	SYSCALL_NAME(utimensat)
+#endif
+#ifdef __NR_utimensat_time64
+	SYSCALL_NAME(utimensat_time64)
+#endif
+#ifdef __NR_utimes
+	SYSCALL_NAME(utimes)
+#endif
+#ifdef __NR_vfork
+	SYSCALL_NAME(vfork)
+#endif
+#ifdef __NR_vhangup
+	SYSCALL_NAME(vhangup)
+#endif
+#ifdef __NR_vm86
+	SYSCALL_NAME(vm86)
+#endif
+#ifdef __NR_vm86old
+	SYSCALL_NAME(vm86old)
+#endif
+#ifdef __NR_vmsplice
+	SYSCALL_NAME(vmsplice)
+#endif
+#ifdef __NR_vserver
+	SYSCALL_NAME(vserver)
+#endif
+#ifdef __NR_wait4
+	SYSCALL_NAME(wait4)
+#endif
+#ifdef __NR_waitid
+	SYSCALL_NAME(waitid)
+#endif
+#ifdef __NR_waitpid
+	SYSCALL_NAME(waitpid)
+#endif
+#ifdef __NR_write
+	SYSCALL_NAME(write)
+#endif
+#ifdef __NR_writev
+	SYSCALL_NAME(writev)
+#endif
+};
+
+#undef SYSCALL_NAME
+
+#endif
@@ -0,0 +1,228 @@
+#ifndef HAKO_TRACE_H
+#define HAKO_TRACE_H
+
+#include <inttypes.h>
+#include <time.h>
+#include <fcntl.h>
+#include "hako-common.h"
+
+// Phase timing, one JSON object per line:
+// {"pid":42,"phase":"mount","target":"/usr","start":123,"duration":45}
+// pid is the sandbox's pid as seen from the host, target is optional.
+// Timestamps are in nanoseconds from CLOCK_MONOTONIC.
+// A phase without duration ends when the process exits, this is used for
+// exec.
+// Records are buffered and written at once, usually right before exec.
+
+#define TRACE_BUF_SIZE 4096
+
+#define CASE_TRACE_OPT case 'T': case 'F'
+#define TRACE_OPTS \
+	{"trace-fd", 'T', OPTPARSE_REQUIRED}, \
+	{"trace-file", 'F', OPTPARSE_REQUIRED}
+
+#define TRACE_HELP \
+	"FD", "Write setup phase timings to this file descriptor", \
+	"FILE", "Append setup phase timings to this file"
+
+struct trace_s
+{
+	int fd;
+	pid_t pid;
+	size_t len;
+	char* buf;
+};
+
+static HAKO_UNUSED uint64_t
+trace_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static HAKO_UNUSED bool
+trace_enabled(const struct trace_s* trace)
+{
+	return trace != NULL && trace->fd >= 0;
+}
+
+static HAKO_UNUSED void
+trace_flush(struct trace_s* trace)
+{
+	if(!trace_enabled(trace)) { return; }
+
+	size_t written = 0;
+	while(written < trace->len)
+	{
+		ssize_t result = write(trace->fd, trace->buf + written, trace->len - written);
+		if(result == -1 && errno == EINTR) { continue; }
+		if(result <= 0) { break; }
+
+		written += result;
+	}
+
+	trace->len = 0;
+}
+
+// Paths are the only strings which need escaping
+static HAKO_UNUSED size_t
+trace_escape(char* buf, size_t size, const char* str)
+{
+	size_t len = 0;
+	for(; *str != '\0' && len + 7 < size; ++str)
+	{
+		unsigned char c = *str;
+		if(c == '"' || c == '\\')
+		{
+			buf[len++] = '\\';
+			buf[len++] = c;
+		}
+		else if(c < 0x20)
+		{
+			len += snprintf(buf + len, size - len, "\\u%04x", c);
+		}
+		else
+		{
+			buf[len++] = c;
+		}
+	}
+
+	buf[len] = '\0';
+	return len;
+}
+
+static HAKO_UNUSED void
+trace_record(
+	struct trace_s* trace,
+	const char* phase,
+	const char* target,
+	uint64_t start,
+	uint64_t end
+)
+{
+	if(!trace_enabled(trace)) { return; }
+
+	char record[512];
+	int len = snprintf(
+		record, sizeof(record), "{\"pid\":%d,\"phase\":\"%s\"",
+		(int)trace->pid, phase
+	);
+
+	if(target != NULL)
+	{
+		char escaped[256];
+		trace_escape(escaped, sizeof(escaped), target);
+		len += snprintf(
+			record + len, sizeof(record) - len, ",\"target\":\"%s\"", escaped
+		);
+	}
+
+	len += snprintf(record + len, sizeof(record) - len, ",\"start\":%" PRIu64, start);
+	if(end != 0)
+	{
+		len += snprintf(
+			record + len, sizeof(record) - len, ",\"duration\":%" PRIu64,
+			end - start
+		);
+	}
+	len += snprintf(record + len, sizeof(record) - len, "}\n");
+	if(len >= (int)sizeof(record)) { return; }
+
+	if(trace->len + len > TRACE_BUF_SIZE) { trace_flush(trace); }
+
+	memcpy(trace->buf + trace->len, record, len);
+	trace->len += len;
+}
+
+// Returns the end of the phase so that it can start the next one
+static HAKO_UNUSED uint64_t
+trace_phase(
+	struct trace_s* trace, const char* phase, const char* target, uint64_t start
+)
+{
+	uint64_t end = trace_now();
+	if(!trace_enabled(trace)) { return end; }
+
+	trace_record(trace, phase, target, start, end);
+
+	return trace_now();
+}
+
+// Starts a phase which lasts until the process exits
+static HAKO_UNUSED void
+trace_open_phase(struct trace_s* trace, const char* phase)
+{
+	trace_record(trace, phase, NULL, trace_now(), 0);
+}
+
+// The pid seen by the host, even from a new pid namespace as long as the
+// host's /proc is still mounted
+static HAKO_UNUSED void
+trace_set_host_pid(struct trace_s* trace)
+{
+	if(!trace_enabled(trace)) { return; }
+
+	char pid[32];
+	ssize_t len = readlink("/proc/self", pid, sizeof(pid) - 1);
+	if(len > 0)
+	{
+		pid[len] = '\0';
+		trace->pid = atoi(pid);
+	}
+}
+
+static HAKO_UNUSED void
+cleanup_trace(struct trace_s* trace)
+{
+	trace_flush(trace);
+	free(trace->buf);
+	trace->buf = NULL;
+}
+
+static HAKO_UNUSED bool
+parse_trace_option(
+	struct trace_s* trace,
+	const char* prog_name,
+	char option,
+	const char* optarg
+)
+{
+	int fd;
+	long num;
+	switch(option)
+	{
+		case 'T':
+			fd = strtonum(optarg, &num) && num >= 0 ? num : -1;
+			if(fd < 0 || fcntl(fd, F_SETFD, FD_CLOEXEC) == -1)
+			{
+				fprintf(stderr, "%s: invalid trace fd: %s\n", prog_name, optarg);
+				return false;
+			}
+			break;
+		case 'F':
+			fd = open(optarg, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+			if(fd < 0)
+			{
+				fprintf(
+					stderr, "%s: could not open %s: %s\n",
+					prog_name, optarg, strerror(errno)
+				);
+				return false;
+			}
+			break;
+		default:
+			return false;
+	}
+
+	if(trace->buf == NULL && (trace->buf = malloc(TRACE_BUF_SIZE)) == NULL)
+	{
+		perror("Could not allocate trace buffer");
+		return false;
+	}
+
+	trace->fd = fd;
+	return true;
+}
+
+#endif